@@ -0,0 +1,103 @@
+// Benchmark.cpp : Microbenchmarks for the raytracer kernels.
+// Usage: Benchmark [--json file] [--csv file] [--label text] [--option value ...] [suite ...]
+// Runs every default suite when none is given, --json and --csv also write the results to file.
+// The render, startup, distributed, stream, png, fastmath, environment and region suites only run when named, see their headers for their options.
+// Benchmark --worker HOST:PORT renders tiles for the distributed suite and exits.
+
+#include <stdio.h>
+#include <float.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <fstream>
+
+#include "scene.h"
+#include "benchmark.h"
+#include "bench_occlusion.h"
+#include "bench_volume.h"
+#include "bench_interval.h"
+#include "bench_box.h"
+#include "bench_heightfield.h"
+#include "bench_kernels.h"
+#include "bench_render.h"
+#include "bench_startup.h"
+#include "bench_dynamic.h"
+#include "bench_distributed.h"
+#include "bench_stream.h"
+#include "bench_png.h"
+#include "bench_simd.h"
+#include "bench_fastmath.h"
+#include "bench_environment.h"
+#include "bench_region.h"
+
+struct bench_suite {
+	const char *name;
+	void (*run)();
+	bool by_default;	// runs when no suite is named
+};
+
+static const bench_suite suites[] = {
+	{ "kernels", bench_kernels, true },
+	{ "occlusion", bench_occlusion, true },
+	{ "volume", bench_volume, true },
+	{ "interval", bench_interval, true },
+	{ "box", bench_box, true },
+	{ "heightfield", bench_heightfield, true },
+	{ "render", bench_render, false },
+	{ "startup", bench_startup, false },
+	{ "dynamic", bench_dynamic, true },
+	{ "distributed", bench_distributed, false },
+	{ "stream", bench_stream, false },
+	{ "png", bench_png, false },
+	{ "simd", bench_simd, true },
+	{ "fastmath", bench_fastmath, false },
+	{ "environment", bench_environment, false },
+	{ "region", bench_region, false },
+};
+
+int main(int argc, char **argv) {
+
+	std::vector<std::string> selected;
+	for (int a = 1; a < argc; a++) {
+
+		std::string arg = argv[a];
+		if (arg.compare(0, 2, "--") == 0 && a + 1 < argc) {
+			benchmark::options()[arg.substr(2)] = argv[++a];
+		}
+		else {
+			selected.push_back(arg);
+		}
+	}
+
+	std::string worker = benchmark::option("worker", std::string());
+	if (!worker.empty()) {
+		return run_worker(worker, unsigned(benchmark::option("threads", 0)));
+	}
+
+	int n_suites = sizeof(suites) / sizeof(suites[0]);
+	for (int i = 0; i < n_suites; i++) {
+
+		if ((selected.empty() && suites[i].by_default) || std::find(selected.begin(), selected.end(), suites[i].name) != selected.end()) {
+
+			// every suite gets the same inputs no matter which suites ran before it
+			s_RndState = 1;
+			std::cout << "== " << suites[i].name << " ==" << std::endl;
+			suites[i].run();
+		}
+	}
+
+	std::string json_file = benchmark::option("json", std::string());
+	std::string csv_file = benchmark::option("csv", std::string());
+	std::string label = benchmark::option("label", std::string());
+	if (!json_file.empty()) {
+		std::ofstream out(json_file);
+		benchmark::write_json(out, label);
+	}
+	if (!csv_file.empty()) {
+		std::ofstream out(csv_file);
+		benchmark::write_csv(out, label);
+	}
+	return 0;
+}
@@ -0,0 +1,147 @@
+#pragma once
+#ifndef BENCH_BOXH
+#define BENCH_BOXH
+
+#include "benchmark.h"
+
+// The six rect composition box.h used before the slab box, kept for comparison
+hitable* rect_box(const vec3& p0, const vec3& p1, material *mat) {
+
+	hitable **list = new hitable*[6];
+	list[0] = new xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), mat);
+	list[1] = new flip_normals(new xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), mat));
+	list[2] = new xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), mat);
+	list[3] = new flip_normals(new xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), mat));
+	list[4] = new yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), mat);
+	list[5] = new flip_normals(new yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), mat));
+	return new hitable_list(list, 6);
+}
+
+// Wraps a hitable with the bounding box of the box it was made from, bhv_node needs one
+class rect_box_bounds : public hitable {
+public:
+	rect_box_bounds(hitable *p, const aabb& b) : ptr(p), bbox(b) {}
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+		return ptr->hit(r, t_min, t_max, rec);
+	}
+	virtual bool occluded(const ray& r, float t_min, float t_max) const {
+		return ptr->occluded(r, t_min, t_max);
+	}
+	virtual bool bounding_box(float t0, float t1, aabb& box) const {
+		box = bbox;
+		return true;
+	}
+	hitable *ptr;
+	aabb bbox;
+};
+
+void bench_box_world(const std::string& suite, const std::string& name, hitable *world, const std::vector<ray>& rays) {
+
+	benchmark::run(suite, name, rays.size(), [&]() {
+		long long hits = 0;
+		for (const ray& r : rays) {
+			hit_record rec;
+			if (world->hit(r, 0.001, FLT_MAX, rec)) {
+				complete_hit(r, rec);
+				hits++;
+			}
+		}
+		benchmark::sink = hits;
+	});
+}
+
+// Leaves of one to three boxes, whose unused lanes must never answer, against the scalar boxes
+// they hold. Rays have long directions and run to FLT_MAX. Returns the rays that disagree.
+int check_partial_leaves() {
+
+	int mismatches = 0;
+	for (int n = 1; n < 4; n++) {
+		for (int k = 0; k < 2000; k++) {
+
+			box *boxes[3];
+			for (int i = 0; i < n; i++) {
+				vec3 p0(random_float() * 10, random_float() * 10, random_float() * 10);
+				boxes[i] = new box(p0, p0 + vec3(1 + random_float(), 1 + random_float(), 1 + random_float()), nullptr);
+			}
+			box4 leaf(boxes, n);
+			for (int j = 0; j < 50; j++) {
+				vec3 from(random_float() * 30 - 10, random_float() * 30 - 10, random_float() * 30 - 10);
+				ray r(from, 5 * unit_vector(random_in_unit_sphere()));
+				bool occluded = false, hit = false;
+				float t = FLT_MAX;
+				for (int i = 0; i < n; i++) {
+					hit_record rec;
+					occluded |= boxes[i]->occluded(r, 0.001f, FLT_MAX);
+					if (boxes[i]->hit(r, 0.001f, t, rec)) {
+						hit = true;
+						t = rec.t;
+					}
+				}
+				hit_record rec;
+				bool leaf_hit = leaf.hit(r, 0.001f, FLT_MAX, rec);
+				mismatches += leaf.occluded(r, 0.001f, FLT_MAX) != occluded || leaf_hit != hit || (hit && rec.t != t);
+			}
+			for (int i = 0; i < n; i++) delete boxes[i];
+		}
+	}
+	return mismatches;
+}
+
+void bench_box() {
+
+	int partial = check_partial_leaves();
+	std::cout << "  " << partial << " rays disagree between partial box4 leaves and their scalar boxes" << std::endl;
+
+	// ground plane of final_scene
+	int nb = 20;
+	material *ground = new lambertian(new constant_texture(vec3(0.48, 0.83, 0.53)));
+	hitable **rects = new hitable*[nb * nb];
+	hitable **boxes = new hitable*[nb * nb];
+	box **boxes4 = new box*[nb * nb];
+	hitable **leaves = new hitable*[nb * nb];
+	int b = 0;
+	for (int i = 0; i < nb; i++) {
+		for (int j = 0; j < nb; j++) {
+			float w = 100;
+			vec3 p0(-1000 + i * w, 0, -1000 + j * w);
+			vec3 p1(p0.x() + w, int(100 * (random_float() + 0.01)), p0.z() + w);
+			rects[b] = new rect_box_bounds(rect_box(p0, p1, ground), aabb(p0, p1));
+			boxes[b] = new box(p0, p1, ground);
+			boxes4[b] = new box(p0, p1, ground);
+			b++;
+		}
+	}
+	hitable *rect_world = new bhv_node(rects, b, 0, 1);
+	hitable *box_world = new bhv_node(boxes, b, 0, 1);
+	int n_leaves = box4::make_leaves(boxes4, b, leaves);
+	hitable *box4_world = new bhv_node(leaves, n_leaves, 0, 1);
+
+	// final_scene camera rays plus grazing rays across the ground
+	std::vector<ray> rays;
+	camera cam(vec3(278, 278, -800), vec3(278, 278, 0), vec3(0, 1, 0), 40, 1, 0, 10, 0, 1);
+	for (int i = 0; i < 200000; i++) {
+		rays.push_back(cam.get_ray(random_float(), random_float() * 0.5f));
+		vec3 from(-1000 + 2000 * random_float(), 150, -1000 + 2000 * random_float());
+		vec3 to(-1000 + 2000 * random_float(), 0, -1000 + 2000 * random_float());
+		rays.push_back(ray(from, to - from));
+	}
+
+	int mismatches = 0;
+	for (const ray& r : rays) {
+		hit_record a, c;
+		bool ha = rect_world->hit(r, 0.001, FLT_MAX, a);
+		bool hc = box4_world->hit(r, 0.001, FLT_MAX, c);
+		if (ha) complete_hit(r, a);
+		if (hc) complete_hit(r, c);
+		if (ha != hc || (ha && (fabs(a.t - c.t) > 1e-3f * a.t || dot(a.normal, c.normal) < 0.99f))) {
+			mismatches++;
+		}
+	}
+	std::cout << "  " << rays.size() << " ground rays, " << mismatches << " disagree between rect and slab boxes" << std::endl;
+
+	bench_box_world("box", "ground/six_rect_boxes", rect_world, rays);
+	bench_box_world("box", "ground/slab_boxes", box_world, rays);
+	bench_box_world("box", "ground/box4_leaves", box4_world, rays);
+}
+
+#endif
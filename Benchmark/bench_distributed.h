@@ -0,0 +1,68 @@
+#pragma once
+#ifndef BENCH_DISTRIBUTEDH
+#define BENCH_DISTRIBUTEDH
+
+#include "benchmark.h"
+#include "distributed.h"
+
+// Options: --scene (scenes/cornell_box.scn), --workers (largest count of the sweep, one per
+// hardware thread), --tile (32). Renders the scene in tiles on 1, 2, 4 ... local worker processes
+// of one thread each, against one process on one thread. The workers are this program started
+// with --worker. Setup (starting the workers, sending and loading the scene) is reported apart.
+void bench_distributed() {
+
+	std::string path = benchmark::option("scene", std::string("scenes/cornell_box.scn"));
+	int max_workers = benchmark::option("workers", int(std::thread::hardware_concurrency()));
+	int tile = benchmark::option("tile", 32);
+
+	scene_desc desc;
+	if (!desc.load(path)) {
+		std::cout << "  no scene, give one with --scene" << std::endl;
+		return;
+	}
+	ThreadPool::SetThreads(1);
+	scene *single = desc.make_scene();
+	single->quiet();
+	render_stats stats;
+	single->render("bench_distributed_single", &stats);
+	ThreadPool::SetThreads(0);
+	bench_result base;
+	base.suite = "distributed";
+	base.name = "single process/t1";
+	base.ops = stats.rays;
+	base.seconds = stats.seconds;
+	benchmark::results().push_back(base);
+	benchmark::print(base);
+
+	std::vector<int> counts;
+	for (int n = 1; n < max_workers; n *= 2) {
+		counts.push_back(n);
+	}
+	counts.push_back(std::max(max_workers, 1));
+	std::string exe = current_executable("");
+	for (int n : counts) {
+
+		tile_coordinator coordinator(path, tile);
+		tile_stats ts;
+		if (!coordinator.render("bench_distributed", exe, n, 1, 0, &ts)) {
+			std::cout << "  distributed render on " << n << " workers failed" << std::endl;
+			continue;
+		}
+		bench_result res;
+		res.suite = "distributed";
+		res.name = "workers/w" + std::to_string(n);
+		res.ops = ts.rays;
+		res.seconds = ts.seconds;
+		res.metrics.push_back(std::make_pair("workers", double(n)));
+		res.metrics.push_back(std::make_pair("tiles", double(ts.tiles)));
+		res.metrics.push_back(std::make_pair("setup_seconds", ts.setup_seconds));
+		res.metrics.push_back(std::make_pair("speedup", base.seconds / ts.seconds));
+		res.metrics.push_back(std::make_pair("efficiency", base.seconds / (n * ts.seconds)));
+		benchmark::results().push_back(res);
+		benchmark::print(res);
+		std::cout << "  " << ts.tiles << " tiles, setup " << std::setprecision(3) << ts.setup_seconds << " s, speedup " << std::setprecision(2)
+			<< res.metric("speedup") << ", efficiency " << res.metric("efficiency") * 100 << "%" << (ts.rays != stats.rays ? ", rays differ from the single render" : "") << std::endl;
+	}
+}
+
+#endif
@@ -0,0 +1,133 @@
+#pragma once
+#ifndef BENCH_DYNAMICH
+#define BENCH_DYNAMICH
+
+#include "benchmark.h"
+#include "dynamic_bvh.h"
+#include "flat_bvh.h"
+
+// An editing session: each edit moves a sphere a little, moves one across the scene, or deletes
+// one and adds a new one, like an artist dragging and placing objects.
+struct dynamic_edit_stats {
+	double seconds;
+	double p99_us;
+	double max_us;
+};
+
+vec3 dynamic_random_point(float size) {
+	return vec3(size * random_float(), size * random_float(), size * random_float());
+}
+
+dynamic_edit_stats dynamic_edits(dynamic_bvh& tree, std::vector<sphere*>& spheres, std::vector<int>& ids, int edits, float size, material *mat) {
+
+	std::vector<double> latency(edits);
+	for (int e = 0; e < edits; e++) {
+
+		int i = int(random_float() * spheres.size());
+		float kind = random_float();
+		auto start = std::chrono::steady_clock::now();
+		if (kind < 0.6f) {
+			spheres[i]->center += vec3(random_float() - 0.5f, random_float() - 0.5f, random_float() - 0.5f) * 0.05f * size;
+			tree.update(ids[i]);
+		}
+		else if (kind < 0.8f) {
+			spheres[i]->center = dynamic_random_point(size);
+			tree.update(ids[i]);
+		}
+		else {
+			tree.remove(ids[i]);
+			spheres[i] = new sphere(dynamic_random_point(size), 0.002f * size + 0.02f * size * random_float(), mat);
+			ids[i] = tree.insert(spheres[i]);
+		}
+		latency[e] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	dynamic_edit_stats st;
+	st.seconds = 0;
+	for (double s : latency) st.seconds += s;
+	std::sort(latency.begin(), latency.end());
+	st.p99_us = latency[size_t(edits * 0.99)] * 1e6;
+	st.max_us = latency.back() * 1e6;
+	return st;
+}
+
+bench_result bench_dynamic_trace(const std::string& name, hitable *world, const std::vector<ray>& rays) {
+
+	return benchmark::run("dynamic", name, rays.size(), [&]() {
+		long long hits = 0;
+		for (const ray& r : rays) {
+			hit_record rec;
+			if (world->hit(r, 0.001, FLT_MAX, rec)) hits++;
+		}
+		benchmark::sink = hits;
+	});
+}
+
+// Options: --objects (spheres, 4000), --edits (10000). Insert, update and remove latency of
+// dynamic_bvh during an editing session, and the tree it leaves against a flat BVH built from
+// scratch over the same spheres: SAH cost and the time to trace the same rays.
+void bench_dynamic() {
+
+	int objects = benchmark::option("objects", 4000);
+	int edits = benchmark::option("edits", 10000);
+	float size = 1000;
+	material *mat = new lambertian(new constant_texture(vec3(0.5, 0.5, 0.5)));
+
+	std::vector<sphere*> spheres(objects);
+	std::vector<int> ids(objects);
+	for (int i = 0; i < objects; i++) {
+		spheres[i] = new sphere(dynamic_random_point(size), 0.002f * size + 0.02f * size * random_float(), mat);
+	}
+	dynamic_bvh tree;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < objects; i++) {
+		ids[i] = tree.insert(spheres[i]);
+	}
+	bench_result insert;
+	insert.suite = "dynamic";
+	insert.name = "insert";
+	insert.ops = objects;
+	insert.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	benchmark::results().push_back(insert);
+	benchmark::print(insert);
+
+	dynamic_edit_stats st = dynamic_edits(tree, spheres, ids, edits, size, mat);
+	bench_result edit;
+	edit.suite = "dynamic";
+	edit.name = "edit";
+	edit.ops = edits;
+	edit.seconds = st.seconds;
+	edit.metrics.push_back(std::make_pair("p99_us", st.p99_us));
+	edit.metrics.push_back(std::make_pair("max_us", st.max_us));
+	benchmark::results().push_back(edit);
+	benchmark::print(edit);
+
+	// the full build an edit would cost without the dynamic tree
+	hitable **list = new hitable*[objects];
+	std::copy(spheres.begin(), spheres.end(), list);
+	flat_bvh *rebuilt = new flat_bvh(nullptr, 0, nullptr, list, objects);
+	bench_result build = benchmark::run("dynamic", "full rebuild", 1, [&]() { rebuilt->rebuild(); });
+
+	std::vector<ray> rays;
+	camera cam(vec3(size / 2, size / 2, -1.5f * size), vec3(size / 2, size / 2, 0), vec3(0, 1, 0), 40, 1, 0, 10, 0, 1);
+	for (int i = 0; i < 200000; i++) {
+		rays.push_back(cam.get_ray(random_float(), random_float()));
+	}
+	int mismatches = 0;
+	for (const ray& r : rays) {
+		hit_record a, b;
+		bool ha = tree.hit(r, 0.001, FLT_MAX, a);
+		bool hb = rebuilt->hit(r, 0.001, FLT_MAX, b);
+		if (ha != hb || (ha && a.t != b.t)) mismatches++;
+	}
+	bench_result traced = bench_dynamic_trace("trace/dynamic after edits", &tree, rays);
+	bench_result reference = bench_dynamic_trace("trace/full rebuild", rebuilt, rays);
+
+	float dynamic_cost = tree.sah_cost(), rebuilt_cost = rebuilt->sah_cost();
+	std::cout << "  " << objects << " spheres, " << edits << " edits: insert " << std::setprecision(2) << insert.ns_per_op() / 1e3 << " us, edit "
+		<< edit.ns_per_op() / 1e3 << " us (p99 " << st.p99_us << " us, max " << st.max_us << " us), full rebuild " << build.seconds * 1e3 << " ms" << std::endl;
+	std::cout << "  SAH cost " << dynamic_cost << " against " << rebuilt_cost << " rebuilt (x" << dynamic_cost / rebuilt_cost << "), trace x"
+		<< traced.seconds / reference.seconds << ", " << mismatches << " rays disagree" << std::endl;
+}
+
+#endif
@@ -0,0 +1,124 @@
+#pragma once
+#ifndef BENCH_ENVIRONMENTH
+#define BENCH_ENVIRONMENTH
+
+#include "benchmark.h"
+#include "bench_render.h"
+#include <sstream>
+
+// The sky gradient as a width x height lat-long map, with a sun of the given angular radius and
+// radiance toward sun
+std::vector<float> make_sun_sky(int width, int height, vec3 sun, float radius, float power) {
+
+	sun = unit_vector(sun);
+	float cos_radius = cosf(radius);
+	std::vector<float> rgb(size_t(width) * height * 3);
+	for (int j = 0; j < height; j++) {
+		for (int i = 0; i < width; i++) {
+			float theta = float(M_PI) * (j + 0.5f) / height, phi = float(M_PI) - 2 * float(M_PI) * (i + 0.5f) / width;
+			vec3 d(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi));
+			float t = 0.5f * (d.y() + 1);
+			vec3 c = ((1 - t) * vec3(1, 1, 1) + t * vec3(0.5f, 0.7f, 1.0f)) * 0.3f;
+			if (dot(d, sun) > cos_radius) c += vec3(1, 0.9f, 0.7f) * power;
+			for (int k = 0; k < 3; k++) rgb[3 * (size_t(j) * width + i) + k] = c[k];
+		}
+	}
+	return rgb;
+}
+
+// Linear mean radiance of every pixel from samples first to first + spp, rows bottom up. Returns
+// the seconds.
+double render_linear(const scene& s, int first, int spp, std::vector<vec3>& pixels, long long& rays) {
+
+	int w = s.width(), h = s.height();
+	pixels.resize(size_t(w) * h);
+	std::atomic<long long> traced(0);
+	auto start = std::chrono::steady_clock::now();
+	ThreadPool::ParallelFor(0, h, [&](int y) {
+		long long rays_before = s_RayCount;
+		for (int x = 0; x < w; x++) {
+			pixels[size_t(y) * w + x] = s.radiance(x, y, first, first + spp) / float(spp);
+		}
+		traced += s_RayCount - rays_before;
+	});
+	rays = traced;
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// RMS difference of two linear images once gamma corrected and clamped as they are saved, in
+// 8 bit steps, so a rare sun path through a glass ball weighs what it does on screen
+double display_rmse(const std::vector<vec3>& a, const std::vector<vec3>& b) {
+
+	double sum = 0;
+	for (size_t i = 0; i < a.size(); i++) {
+		for (int k = 0; k < 3; k++) {
+			double d = 255.99 * (sqrt(clip(a[i][k], 0, 1)) - sqrt(clip(b[i][k], 0, 1)));
+			sum += d * d;
+		}
+	}
+	return sqrt(sum / (3.0 * a.size()));
+}
+
+// Options: --width (160), --height (90), --spp (4,16,64), --reference (512), --map (1024 wide),
+// --sun (500, 0 for none). random_scene under the sky gradient as a map with a sun 2 degrees
+// across, at every spp with the map sampled directly and weighted by MIS (sampled) and with
+// only the rays that leave the scene seeing it (escaped). rmse is the displayed error against a
+// sampled render at reference spp from other seeds, efficiency the sampled render's 1 / (mse x seconds) over
+// the escaped one's, how much sooner it reaches the same error.
+void bench_environment() {
+
+	int width = benchmark::option("width", 160);
+	int height = benchmark::option("height", 90);
+	std::string spps = benchmark::option("spp", std::string("4,16,64"));
+	int reference_spp = benchmark::option("reference", 512);
+	int map = benchmark::option("map", 1024);
+	int sun = benchmark::option("sun", 500);
+
+	std::vector<float> sky = make_sun_sky(map, map / 2, vec3(-0.3f, 0.6f, 1), 0.0175f, float(sun));
+	const render_preset& p = render_presets[0];
+	s_RndState = 1;
+	scene s(width, height, 1, p.look_from, p.look_at, p.build(), p.max_depth);
+	s.quiet();
+	auto start = std::chrono::steady_clock::now();
+	environment_light *env = new environment_light(sky.data(), map, map / 2);
+	std::cout << "  distribution of a " << map << " x " << map / 2 << " map built in " << std::fixed << std::setprecision(1)
+		<< std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1000 << " ms" << std::endl;
+	s.environment(env);
+
+	std::vector<vec3> reference, pixels;
+	long long rays;
+	double seconds = render_linear(s, 1 << 20, reference_spp, reference, rays);
+	std::cout << "  reference " << reference_spp << " spp in " << std::fixed << std::setprecision(1) << seconds << " s" << std::endl;
+
+	std::stringstream list(spps);
+	std::string item;
+	while (std::getline(list, item, ',')) {
+
+		int spp = atoi(item.c_str());
+		if (spp <= 0) continue;
+		bench_result res[2];
+		for (int sampled = 1; sampled >= 0; sampled--) {
+
+			env->sampled = sampled != 0;
+			bench_result& r = res[1 - sampled];
+			r.suite = "environment";
+			r.name = std::string(sampled ? "sampled/" : "escaped/") + item;
+			r.seconds = render_linear(s, 0, spp, pixels, rays);
+			r.ops = (long long)width * height * spp;
+			double rmse = display_rmse(pixels, reference);
+			r.metrics.push_back(std::make_pair("rmse", rmse));
+			r.metrics.push_back(std::make_pair("rays_per_path", double(rays) / r.ops));
+		}
+		double efficiency = (res[1].metric("rmse") * res[1].metric("rmse") * res[1].seconds) / (res[0].metric("rmse") * res[0].metric("rmse") * res[0].seconds);
+		res[0].metrics.push_back(std::make_pair("efficiency", efficiency));
+		for (const bench_result& r : res) {
+			benchmark::results().push_back(r);
+			benchmark::print(r);
+			std::cout << "  rmse " << std::setprecision(2) << r.metric("rmse") << std::endl;
+		}
+		std::cout << "  efficiency " << std::setprecision(1) << efficiency << "x" << std::endl;
+	}
+	env->sampled = true;
+}
+
+#endif
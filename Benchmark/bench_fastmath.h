@@ -0,0 +1,122 @@
+#pragma once
+#ifndef BENCH_FASTMATHH
+#define BENCH_FASTMATHH
+
+#include "benchmark.h"
+#include "bench_render.h"
+#include <sstream>
+
+// libm and the polynomial over the same inputs, max_error is the largest absolute difference to
+// the double precision result. The loops write every result so the compiler may vectorize them.
+template<typename Precise, typename Fast, typename Exact>
+void bench_fastmath_function(const std::string& name, float lo, float hi, Precise precise, Fast fast, Exact exact) {
+
+	const int n = 1000000;
+	std::vector<float> x(n), y(n);
+	for (float& v : x) v = lo + (hi - lo) * random_float();
+	double max_error = 0;
+	for (float v : x) max_error = std::max(max_error, fabs(double(fast(v)) - exact(double(v))));
+	benchmark::run("fastmath", name + "/precise", n, [&]() {
+		for (int i = 0; i < n; i++) y[i] = precise(x[i]);
+		benchmark::sink = (long long)y[n / 2];
+	});
+	benchmark::run("fastmath", name + "/fast", n, [&]() {
+		for (int i = 0; i < n; i++) y[i] = fast(x[i]);
+		benchmark::sink = (long long)y[n / 2];
+	});
+	benchmark::results().back().metrics.push_back(std::make_pair("max_error", max_error));
+	std::cout << "  max error " << std::scientific << std::setprecision(2) << max_error << std::fixed << std::endl;
+}
+
+// One image rendered in the current mode, rows bottom up
+bench_result render_fastmath(const render_preset& p, int width, int height, int spp, std::vector<vec3>& pixels) {
+
+	s_RndState = 1;
+	scene s(width, height, spp, p.look_from, p.look_at, p.build(), p.max_depth);
+	s.quiet();
+	pixels.resize(size_t(width) * height);
+	auto start = std::chrono::steady_clock::now();
+	long long rays = s.render_tile(0, 0, width, height, pixels.data());
+	bench_result res;
+	res.suite = "fastmath";
+	res.ops = rays;
+	res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return res;
+}
+
+// Options: --presets (random_scene,cornell_box_smoke,final_scene), --width (200), --height (200),
+// --spp (16), --repeats (3). First each replaced function precise and fast with its largest error,
+// then every preset rendered in both modes from the same seeds, the modes taking turns and the
+// fastest render of each kept. rmse and max_diff are of the 8 bit images,
+// psnr in dB, differing the share of pixels that changed at all. The glass in random_scene and
+// final_scene goes through schlick's pow 5, the media in cornell_box_smoke and
+// final_scene through log.
+void bench_fastmath() {
+
+	// atan2 sweeps y against a fixed x on both sides, so every octant is covered
+	bench_fastmath_function("sin", -100, 100, [](float x) { return float(sin(x)); }, [](float x) { return fast_sin(x); }, [](double x) { return sin(x); });
+	bench_fastmath_function("sin_wide", -10000, 10000, [](float x) { return float(sin(x)); }, [](float x) { return fast_sin(x); }, [](double x) { return sin(x); });
+	bench_fastmath_function("atan2", -50, 50, [](float y) { return float(atan2(y, y > 0 ? 0.5f : -0.5f)); },
+		[](float y) { return fast_atan2(y, y > 0 ? 0.5f : -0.5f); }, [](double y) { return atan2(y, y > 0 ? 0.5 : -0.5); });
+	bench_fastmath_function("asin", -1, 1, [](float x) { return float(asin(x)); }, [](float x) { return fast_asin(x); }, [](double x) { return asin(x); });
+	bench_fastmath_function("log", 1e-6f, 1, [](float x) { return float(log(x)); }, [](float x) { return fast_log(x); }, [](double x) { return log(x); });
+	bench_fastmath_function("pow5", 0, 1, [](float x) { return float(pow(x, 5)); }, [](float x) { return fast_pow5(x); }, [](double x) { return pow(x, 5); });
+
+	std::string presets = benchmark::option("presets", std::string("random_scene,cornell_box_smoke,final_scene"));
+	int width = benchmark::option("width", 200);
+	int height = benchmark::option("height", 200);
+	int spp = benchmark::option("spp", 16);
+	int repeats = benchmark::option("repeats", 3);
+	math_mode before = current_math_mode();
+	std::stringstream list(presets);
+	std::string item;
+	while (std::getline(list, item, ',')) {
+
+		const render_preset *p = nullptr;
+		for (const render_preset& r : render_presets) {
+			if (item == r.name) p = &r;
+		}
+		if (!p) continue;
+		std::vector<vec3> precise_pixels, fast_pixels;
+		bench_result precise, fast;
+		for (int r = 0; r < repeats; r++) {
+			set_math_mode(MATH_PRECISE);
+			bench_result a = render_fastmath(*p, width, height, spp, precise_pixels);
+			set_math_mode(MATH_FAST);
+			bench_result b = render_fastmath(*p, width, height, spp, fast_pixels);
+			if (r == 0 || a.seconds < precise.seconds) precise = a;
+			if (r == 0 || b.seconds < fast.seconds) fast = b;
+		}
+
+		double sum = 0;
+		int max_diff = 0;
+		long long differing = 0;
+		for (size_t i = 0; i < precise_pixels.size(); i++) {
+			bool differs = false;
+			for (int k = 0; k < 3; k++) {
+				int d = abs(int(255.99 * precise_pixels[i][k]) - int(255.99 * fast_pixels[i][k]));
+				sum += double(d) * d;
+				max_diff = std::max(max_diff, d);
+				differs |= d != 0;
+			}
+			differing += differs;
+		}
+		double rmse = sqrt(sum / (3.0 * precise_pixels.size()));
+		precise.name = item + "/precise";
+		fast.name = item + "/fast";
+		fast.metrics.push_back(std::make_pair("speedup", precise.seconds / fast.seconds));
+		fast.metrics.push_back(std::make_pair("rmse", rmse));
+		fast.metrics.push_back(std::make_pair("psnr", rmse > 0 ? 20 * log10(255 / rmse) : 99.0));
+		fast.metrics.push_back(std::make_pair("max_diff", double(max_diff)));
+		fast.metrics.push_back(std::make_pair("differing", double(differing) / precise_pixels.size()));
+		for (const bench_result *res : { &precise, &fast }) {
+			benchmark::results().push_back(*res);
+			benchmark::print(*res);
+		}
+		std::cout << "  speedup " << std::setprecision(2) << fast.metric("speedup") << "x, rmse " << rmse << ", psnr " << std::setprecision(1)
+			<< fast.metric("psnr") << " dB, max " << max_diff << ", " << fast.metric("differing") * 100 << "% of pixels differ" << std::endl;
+	}
+	set_math_mode(before);
+}
+
+#endif
@@ -0,0 +1,82 @@
+#pragma once
+#ifndef BENCH_HEIGHTFIELDH
+#define BENCH_HEIGHTFIELDH
+
+#include "benchmark.h"
+#include "bench_box.h"
+
+// Rolling terrain over final_scene's ground square, n * n cells of random jitter on two waves
+float* make_terrain(int n) {
+
+	float *heights = new float[size_t(n) * n];
+	for (int j = 0; j < n; j++) {
+		for (int i = 0; i < n; i++) {
+			float x = float(i) / n, z = float(j) / n;
+			heights[size_t(j) * n + i] = 50 + 30 * sin(x * 12) * cos(z * 9) + 20 * random_float();
+		}
+	}
+	return heights;
+}
+
+void bench_heightfield_size(int n, bool with_boxes) {
+
+	material *ground = new lambertian(new constant_texture(vec3(0.48, 0.83, 0.53)));
+	float cell = 2000.0f / n;
+	float *heights = make_terrain(n);
+	hitable *field = new heightfield(-1000, -1000, cell, n, n, 0, heights, ground);
+
+	// views from above plus rays grazing across the terrain
+	std::vector<ray> rays;
+	camera cam(vec3(0, 400, -1400), vec3(0, 0, 0), vec3(0, 1, 0), 60, 1, 0, 10, 0, 1);
+	for (int i = 0; i < 100000; i++) {
+		rays.push_back(cam.get_ray(random_float(), random_float()));
+		vec3 from(-1000 + 2000 * random_float(), 120, -1000 + 2000 * random_float());
+		vec3 to(-1000 + 2000 * random_float(), 0, -1000 + 2000 * random_float());
+		rays.push_back(ray(from, to - from));
+	}
+
+	std::string size = std::to_string(n) + "x" + std::to_string(n);
+	if (with_boxes) {
+
+		box **boxes = new box*[size_t(n) * n];
+		hitable **leaves = new hitable*[size_t(n) * n];
+		for (int j = 0; j < n; j++) {
+			for (int i = 0; i < n; i++) {
+				vec3 p0(-1000 + i * cell, 0, -1000 + j * cell);
+				boxes[size_t(j) * n + i] = new box(p0, vec3(p0.x() + cell, heights[size_t(j) * n + i], p0.z() + cell), ground);
+			}
+		}
+		auto start = std::chrono::steady_clock::now();
+		int n_leaves = box4::make_leaves(boxes, n * n, leaves);
+		hitable *box_world = new bhv_node(leaves, n_leaves, 0, 1);
+		double build = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		int mismatches = 0;
+		for (const ray& r : rays) {
+			hit_record a, c;
+			bool ha = box_world->hit(r, 0.001, FLT_MAX, a);
+			bool hc = field->hit(r, 0.001, FLT_MAX, c);
+			if (ha) complete_hit(r, a);
+			if (hc) complete_hit(r, c);
+			if (ha != hc || (ha && (fabs(a.t - c.t) > 1e-3f * a.t || dot(a.normal, c.normal) < 0.99f))) {
+				mismatches++;
+			}
+		}
+		std::cout << "  " << size << ": box BVH built in " << build << " s, " << mismatches << " of " << rays.size() << " rays disagree with the heightfield" << std::endl;
+		bench_box_world("heightfield", "terrain/" + size + "/box4_bvh", box_world, rays);
+	}
+	else {
+		// n * n boxes plus their leaves and nodes would not fit in memory, the heightfield needs 4 bytes a cell
+		std::cout << "  " << size << ": box BVH skipped, heightfield uses " << (size_t(n) * n * sizeof(float)) / (1024 * 1024) << " MiB" << std::endl;
+	}
+	bench_box_world("heightfield", "terrain/" + size + "/heightfield", field, rays);
+}
+
+void bench_heightfield() {
+
+	bench_heightfield_size(20, true);
+	bench_heightfield_size(1000, true);
+	bench_heightfield_size(10000, false);
+}
+
+#endif
@@ -0,0 +1,74 @@
+#pragma once
+#ifndef BENCH_INTERVALH
+#define BENCH_INTERVALH
+
+#include "benchmark.h"
+
+// Hides the closed-form hit_interval of a boundary so the medium falls back to two hit() calls
+class two_hit_boundary : public hitable {
+public:
+	two_hit_boundary(hitable *p) : ptr(p) {}
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+		return ptr->hit(r, t_min, t_max, rec);
+	}
+	virtual bool occluded(const ray& r, float t_min, float t_max) const {
+		return ptr->occluded(r, t_min, t_max);
+	}
+	virtual void compute_surface_interaction(const ray& r, hit_record& rec) const {
+		ptr->compute_surface_interaction(r, rec);
+	}
+	virtual bool bounding_box(float t0, float t1, aabb& box) const {
+		return ptr->bounding_box(t0, t1, box);
+	}
+	hitable *ptr;
+};
+
+std::vector<ray> make_camera_rays(camera cam, int n) {
+
+	std::vector<ray> rays;
+	rays.reserve(n);
+	for (int i = 0; i < n; i++) {
+		rays.push_back(cam.get_ray(random_float(), random_float()));
+	}
+	return rays;
+}
+
+void bench_interval_medium(const std::string& name, hitable *boundary, float density, const std::vector<ray>& rays) {
+
+	texture *albedo = new constant_texture(vec3(1, 1, 1));
+	constant_medium single(boundary, density, albedo);
+	constant_medium two_hit(new two_hit_boundary(boundary), density, albedo);
+	auto query = [&](const constant_medium& m) {
+		return [&]() {
+			long long scattered = 0;
+			for (const ray& r : rays) {
+				float t;
+				if (m.sample_distance(r, 0.001, FLT_MAX, t)) {
+					scattered++;
+				}
+			}
+			benchmark::sink = scattered;
+		};
+	};
+	bench_result before = benchmark::run("interval", name + "/two_hit", rays.size(), query(two_hit));
+	bench_result after = benchmark::run("interval", name + "/hit_interval", rays.size(), query(single));
+	std::cout << "  " << name << " saves " << std::setprecision(2) << before.ns_per_op() - after.ns_per_op() << " ns per ray" << std::endl;
+}
+
+void bench_interval() {
+
+	const int n = 500000;
+	material *white = new lambertian(new constant_texture(vec3(0.73, 0.73, 0.73)));
+
+	// the two media of final_scene, every camera ray queries the fog
+	std::vector<ray> final_rays = make_camera_rays(camera(vec3(278, 278, -800), vec3(278, 278, 0), vec3(0, 1, 0), 40, 1, 0, 10, 0, 1), n);
+	bench_interval_medium("final_scene/fog", new sphere(vec3(0, 0, 0), 5000, white), 0.0001, final_rays);
+	bench_interval_medium("final_scene/blue_sphere", new sphere(vec3(360, 150, 145), 70, white), 0.2, final_rays);
+
+	// the rotated boxes of cornell_box_smoke
+	std::vector<ray> cornell_rays = make_camera_rays(camera(vec3(278, 278, -800), vec3(278, 278, 0), vec3(0, 1, 0), 40, 1, 0, 10, 0, 1), n);
+	bench_interval_medium("cornell_box_smoke/box1", new translate(new rotate_y(new box(vec3(0, 0, 0), vec3(165, 165, 165), white), -18), vec3(130, 0, 65)), 0.01, cornell_rays);
+	bench_interval_medium("cornell_box_smoke/box2", new translate(new rotate_y(new box(vec3(0, 0, 0), vec3(165, 330, 165), white), 15), vec3(265, 0, 295)), 0.01, cornell_rays);
+}
+
+#endif
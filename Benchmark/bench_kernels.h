@@ -0,0 +1,149 @@
+#pragma once
+#ifndef BENCH_KERNELSH
+#define BENCH_KERNELSH
+
+#include "benchmark.h"
+
+// Rays from random points on a sphere of radius dist around center, aimed at random points
+// within spread of it, so a known share of them hits a primitive of that size
+std::vector<ray> make_kernel_rays(const vec3& center, float dist, float spread, int n) {
+
+	std::vector<ray> rays;
+	rays.reserve(n);
+	for (int i = 0; i < n; i++) {
+		vec3 from = center + dist * unit_vector(random_in_unit_sphere());
+		vec3 to = center + spread * random_in_unit_sphere();
+		rays.push_back(ray(from, to - from, random_float()));
+	}
+	return rays;
+}
+
+// hit() alone and hit() plus the deferred surface interaction of the hits
+void bench_kernel_hitable(const std::string& name, hitable *h, const std::vector<ray>& rays) {
+
+	benchmark::run("kernels", name + "/hit", rays.size(), [&]() {
+		long long hits = 0;
+		for (const ray& r : rays) {
+			hit_record rec;
+			if (h->hit(r, 0.001, FLT_MAX, rec)) {
+				hits++;
+			}
+		}
+		benchmark::sink = hits;
+	});
+	benchmark::run("kernels", name + "/hit_surface", rays.size(), [&]() {
+		long long hits = 0;
+		for (const ray& r : rays) {
+			hit_record rec;
+			if (h->hit(r, 0.001, FLT_MAX, rec)) {
+				complete_hit(r, rec);
+				hits++;
+			}
+		}
+		benchmark::sink = hits;
+	});
+}
+
+// Incoming rays and hit records on a unit sphere, front and back facing
+void bench_kernel_scatter(const std::string& name, material *mat, int n) {
+
+	std::vector<ray> in;
+	std::vector<hit_record> recs;
+	in.reserve(n);
+	recs.reserve(n);
+	for (int i = 0; i < n; i++) {
+		hit_record rec;
+		rec.normal = unit_vector(random_in_unit_sphere());
+		rec.p = rec.normal;
+		rec.t = 1;
+		rec.u = random_float();
+		rec.v = random_float();
+		rec.mat_ptr = mat;
+		rec.obj = nullptr;
+		vec3 from = 3 * unit_vector(random_in_unit_sphere());
+		in.push_back(ray(from, rec.p - from));
+		recs.push_back(rec);
+	}
+	benchmark::run("kernels", "scatter/" + name, n, [&]() {
+		long long scattered = 0;
+		for (int i = 0; i < n; i++) {
+			vec3 attenuation;
+			ray scattered_ray;
+			if (mat->scatter(in[i], recs[i], attenuation, scattered_ray)) {
+				scattered++;
+			}
+		}
+		benchmark::sink = scattered;
+	});
+}
+
+void bench_kernels() {
+
+	const int n = 1000000;
+	material *mat = new lambertian(new constant_texture(vec3(0.5, 0.5, 0.5)));
+
+	// about half of the rays hit each primitive
+	bench_kernel_hitable("sphere", new sphere(vec3(0, 0, 0), 1, mat), make_kernel_rays(vec3(0, 0, 0), 10, 1.4f, n));
+	bench_kernel_hitable("moving_sphere", new moving_sphere(vec3(0, -0.2f, 0), vec3(0, 0.2f, 0), 0, 1, 1, mat), make_kernel_rays(vec3(0, 0, 0), 10, 1.4f, n));
+	bench_kernel_hitable("triangle", new triangle(vec3(-1, -1, 0), vec3(1, -1, 0), vec3(0, 1, 0), mat), make_kernel_rays(vec3(0, 0, 0), 10, 1.4f, n));
+	bench_kernel_hitable("xy_rect", new xy_rect(-1, 1, -1, 1, 0, mat), make_kernel_rays(vec3(0, 0, 0), 10, 1.4f, n));
+
+	std::vector<ray> box_rays = make_kernel_rays(vec3(0, 0, 0), 10, 1.8f, n);
+	aabb bounds(vec3(-1, -1, -1), vec3(1, 1, 1));
+	benchmark::run("kernels", "aabb/hit", n, [&]() {
+		long long hits = 0;
+		for (const ray& r : box_rays) {
+			if (bounds.hit(r, 0.001, FLT_MAX)) {
+				hits++;
+			}
+		}
+		benchmark::sink = hits;
+	});
+
+	// random_scene spheres under one bhv_node, primary rays of its usual camera
+	hitable *spheres = scene::random_scene();
+	camera cam(vec3(13, 2, 3), vec3(0, 0, 0), vec3(0, 1, 0), 20, 1, 0, 10, 0, 1);
+	std::vector<ray> cam_rays;
+	cam_rays.reserve(n);
+	for (int i = 0; i < n; i++) {
+		cam_rays.push_back(cam.get_ray(random_float(), random_float()));
+	}
+	bench_kernel_hitable("bhv_node/random_scene", spheres, cam_rays);
+
+	std::vector<vec3> points;
+	points.reserve(n);
+	for (int i = 0; i < n; i++) {
+		points.push_back(10 * vec3(random_float(), random_float(), random_float()));
+	}
+	perlin noise;
+	benchmark::run("kernels", "perlin/turb", n, [&]() {
+		float sum = 0;
+		for (const vec3& p : points) {
+			sum += noise.turb(p);
+		}
+		benchmark::sink = (long long)sum;
+	});
+
+	// synthetic 2048 x 1024 RGB image, the size of a typical earth map
+	int nx = 2048, ny = 1024;
+	unsigned char *pixels = new unsigned char[3 * nx * ny];
+	for (int i = 0; i < 3 * nx * ny; i++) {
+		pixels[i] = (unsigned char)(XorShift32() & 0xFF);
+	}
+	image_texture image(pixels, nx, ny);
+	benchmark::run("kernels", "image_texture/value", n, [&]() {
+		float sum = 0;
+		for (const vec3& p : points) {
+			sum += image.value(p.x() * 0.1f, p.y() * 0.1f, p).x();
+		}
+		benchmark::sink = (long long)sum;
+	});
+
+	bench_kernel_scatter("lambertian", mat, n);
+	bench_kernel_scatter("metal", new metal(vec3(0.7, 0.6, 0.5), 0.1), n);
+	bench_kernel_scatter("dialectric", new dialectric(1.5), n);
+	bench_kernel_scatter("diffuse_light", new diffuse_light(new constant_texture(vec3(4, 4, 4))), n);
+	bench_kernel_scatter("isotropic", new isotropic(new constant_texture(vec3(1, 1, 1))), n);
+}
+
+#endif
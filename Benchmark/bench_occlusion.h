@@ -0,0 +1,81 @@
+#pragma once
+#ifndef BENCH_OCCLUSIONH
+#define BENCH_OCCLUSIONH
+
+#include "benchmark.h"
+
+struct shadow_ray {
+	ray r;
+	float t_max;
+};
+
+// Shoots camera rays into world and connects every primary hit to a point picked by light_point
+template<typename LightSampler>
+std::vector<shadow_ray> make_shadow_rays(hitable *world, camera& cam, int n, LightSampler light_point) {
+
+	std::vector<shadow_ray> rays;
+	rays.reserve(n);
+	int tries = 0;
+	while (int(rays.size()) < n && tries < 100 * n) {
+
+		tries++;
+		ray r = cam.get_ray(random_float(), random_float());
+		hit_record rec;
+		if (world->hit(r, 0.001, FLT_MAX, rec)) {
+
+			complete_hit(r, rec);
+			shadow_ray s;
+			s.r = ray(rec.p, light_point() - rec.p, r.time());
+			s.t_max = 0.999f;
+			rays.push_back(s);
+		}
+	}
+	return rays;
+}
+
+void bench_occlusion_scene(const std::string& name, hitable *world, camera cam, vec3 light_min, vec3 light_max) {
+
+	const int n = 200000;
+	vec3 extent = light_max - light_min;
+	std::vector<shadow_ray> rays = make_shadow_rays(world, cam, n, [&]() {
+		return light_min + vec3(random_float() * extent.x(), random_float() * extent.y(), random_float() * extent.z());
+	});
+	long long count = rays.size();
+
+	bench_result closest = benchmark::run("occlusion", name + "/closest_hit", count, [&]() {
+		long long blocked = 0;
+		for (const shadow_ray& s : rays) {
+			hit_record rec;
+			if (world->hit(s.r, 0.001, s.t_max, rec)) {
+				complete_hit(s.r, rec);
+				blocked++;
+			}
+		}
+		benchmark::sink = blocked;
+	});
+	bench_result any = benchmark::run("occlusion", name + "/occluded", count, [&]() {
+		long long blocked = 0;
+		for (const shadow_ray& s : rays) {
+			if (world->occluded(s.r, 0.001, s.t_max)) {
+				blocked++;
+			}
+		}
+		benchmark::sink = blocked;
+	});
+	std::cout << "  " << name << " shadow ray speedup: " << std::setprecision(2) << closest.seconds / any.seconds << "x" << std::endl;
+}
+
+void bench_occlusion() {
+
+	bench_occlusion_scene("random_scene", scene::random_scene(),
+		camera(vec3(13, 2, 3), vec3(0, 0, 0), vec3(0, 1, 0), 40, 1, 0, 10, 0, 1),
+		vec3(-5, 20, -5), vec3(5, 20, 5));
+	bench_occlusion_scene("cornell_box", scene::cornell_box(),
+		camera(vec3(278, 278, -800), vec3(278, 278, 0), vec3(0, 1, 0), 40, 1, 0, 10, 0, 1),
+		vec3(213, 554, 227), vec3(343, 554, 332));
+	bench_occlusion_scene("final_scene", scene::final_scene(),
+		camera(vec3(278, 278, -800), vec3(278, 278, 0), vec3(0, 1, 0), 40, 1, 0, 10, 0, 1),
+		vec3(123, 554, 147), vec3(423, 554, 412));
+}
+
+#endif
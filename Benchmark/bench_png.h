@@ -0,0 +1,74 @@
+#pragma once
+#ifndef BENCH_PNGH
+#define BENCH_PNGH
+
+#include "benchmark.h"
+#include "bench_render.h"
+
+// Options: --width (3840), --height (2160), --spp (1), --preset (random_scene), --threads (largest
+// count of the sweep). Renders one image, then encodes it with stbi_write_png_to_mem on one thread
+// and with write_png_striped on 1, 2, 4 ... threads, one stripe per thread. Throughput is of the
+// raw RGB bytes, ratio the PNG size over stb's.
+void bench_png() {
+
+	int width = benchmark::option("width", 3840);
+	int height = benchmark::option("height", 2160);
+	int spp = benchmark::option("spp", 1);
+	std::string preset = benchmark::option("preset", std::string("random_scene"));
+	unsigned max_threads = benchmark::option("threads", int(ThreadPool::Threads()));
+
+	const render_preset *p = &render_presets[0];
+	for (const render_preset& r : render_presets) {
+		if (preset == r.name) p = &r;
+	}
+	scene s(width, height, spp, p->look_from, p->look_at, p->build(), p->max_depth);
+	s.quiet();
+	std::vector<vec3> pixels(size_t(width) * height);
+	s.render_tile(0, 0, width, height, pixels.data());
+	std::vector<uint8_t> rgb(pixels.size() * 3);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			// render_tile rows run bottom up, PNG rows top down
+			const vec3& c = pixels[size_t(height - 1 - y) * width + x];
+			for (int k = 0; k < 3; k++) {
+				rgb[(size_t(y) * width + x) * 3 + k] = uint8_t(int(255.99 * c[k]));
+			}
+		}
+	}
+	double mb = double(rgb.size()) / 1048576;
+
+	int stb_size = 0;
+	bench_result base = benchmark::run("png", "stb/t1", (long long)rgb.size(), [&]() {
+		unsigned char *png = stbi_write_png_to_mem(rgb.data(), 0, width, height, 3, &stb_size);
+		STBIW_FREE(png);
+	});
+	base.metrics.push_back(std::make_pair("mb_per_s", mb / base.seconds));
+	benchmark::results().back().metrics = base.metrics;
+	std::cout << "  " << std::setprecision(1) << base.metric("mb_per_s") << " MB/s, " << stb_size / 1024 << " KB" << std::endl;
+
+	for (unsigned t = 1; ; t = std::min(t * 2, max_threads)) {
+
+		ThreadPool::SetThreads(t);
+		bench_result res = benchmark::run("png", "striped/t" + std::to_string(t), (long long)rgb.size(), [&]() {
+			write_png_striped("_ImgOutput/bench_png.png", width, height, rgb.data(), int(t));
+		});
+		FILE *f = fopen("_ImgOutput/bench_png.png", "rb");
+		long size = 0;
+		if (f) {
+			fseek(f, 0, SEEK_END);
+			size = ftell(f);
+			fclose(f);
+		}
+		res.metrics.push_back(std::make_pair("threads", double(t)));
+		res.metrics.push_back(std::make_pair("mb_per_s", mb / res.seconds));
+		res.metrics.push_back(std::make_pair("speedup", base.seconds / res.seconds));
+		res.metrics.push_back(std::make_pair("ratio", double(size) / stb_size));
+		benchmark::results().back().metrics = res.metrics;
+		std::cout << "  " << std::setprecision(1) << res.metric("mb_per_s") << " MB/s, " << size / 1024 << " KB, x" << std::setprecision(2)
+			<< res.metric("speedup") << " over stb, size x" << res.metric("ratio") << std::endl;
+		if (t >= max_threads) break;
+	}
+	ThreadPool::SetThreads(0);
+}
+
+#endif
@@ -0,0 +1,101 @@
+#pragma once
+#ifndef BENCH_REGIONH
+#define BENCH_REGIONH
+
+#include "benchmark.h"
+#include "bench_render.h"
+#include "accumulation.h"
+
+bench_result region_result(const std::string& name, long long rays, double seconds) {
+
+	bench_result res;
+	res.suite = "region";
+	res.name = name;
+	res.ops = rays;
+	res.seconds = seconds;
+	return res;
+}
+
+// Options: --width (240), --height (160), --spp (16), --tile (32). random_scene rendered whole
+// and cropped to its middle quarter (crop/full, crop/window). Then a sphere is added in front of
+// the big ones and the accumulation buffer of the first image brought up to date by rendering
+// the tiles that see it again (update/tiles), against accumulating the changed scene from
+// scratch (update/full). rmse (8 bit steps) and differing compare the two images: the tiles
+// miss the new sphere's shadow and its reflections in the rest of the scene.
+void bench_region() {
+
+	int width = benchmark::option("width", 240);
+	int height = benchmark::option("height", 160);
+	int spp = benchmark::option("spp", 16);
+	int tile = benchmark::option("tile", 32);
+	const render_preset& p = render_presets[0];
+	s_RndState = 1;
+	hitable *world = p.build();
+
+	scene s(width, height, spp, p.look_from, p.look_at, world, p.max_depth);
+	s.quiet();
+	render_stats full, window;
+	s.render("bench_region_full", &full);
+	s.crop({ width / 4, height / 4, width - width / 4, height - height / 4 });
+	s.render("bench_region_crop", &window);
+	bench_result res[2] = { region_result("crop/full", full.rays, full.seconds), region_result("crop/window", window.rays, window.seconds) };
+	res[1].metrics.push_back(std::make_pair("pixels", double(s.crop_window().area()) / (double(width) * height)));
+	res[1].metrics.push_back(std::make_pair("speedup", full.seconds / window.seconds));
+	for (const bench_result& r : res) {
+		benchmark::results().push_back(r);
+		benchmark::print(r);
+	}
+	std::cout << "  " << std::fixed << std::setprecision(1) << res[1].metric("pixels") * 100 << "% of the pixels, speedup " << res[1].metric("speedup") << "x" << std::endl;
+
+	accum_buffer before(width, height, 1);
+	accumulate(s, before, 0, uint32_t(spp), uint32_t(spp), "", 0);
+	vec3 center(6, 0.5f, 1.5f);
+	float radius = 0.5f;
+	hitable **list = new hitable*[2];
+	list[0] = world;
+	list[1] = new sphere(center, radius, new lambertian(new constant_texture(vec3(0.9f, 0.2f, 0.1f))));
+	scene changed(width, height, spp, p.look_from, p.look_at, new hitable_list(list, 2), p.max_depth);
+
+	accum_buffer after(width, height, 2);
+	auto start = std::chrono::steady_clock::now();
+	accumulate(changed, after, 0, uint32_t(spp), uint32_t(spp), "", 0);
+	bench_result scratch = region_result("update/full", (long long)width * height * spp, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+	start = std::chrono::steady_clock::now();
+	std::vector<pixel_rect> tiles = changed.tiles_seeing(aabb(center - vec3(radius, radius, radius), center + vec3(radius, radius, radius)), tile);
+	long long pixels = 0;
+	for (const pixel_rect& t : tiles) pixels += t.area();
+	rerender_tiles(changed, before, tiles);
+	bench_result update = region_result("update/tiles", pixels * spp, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+	double sum = 0;
+	long long differing = 0;
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			vec3 a = before.color(x, y), b = after.color(x, y);
+			bool differs = false;
+			for (int k = 0; k < 3; k++) {
+				int d = int(255.99 * a[k]) - int(255.99 * b[k]);
+				sum += double(d) * d;
+				differs |= d != 0;
+			}
+			differing += differs;
+		}
+	}
+	double rmse = sqrt(sum / (3.0 * width * height));
+	update.metrics.push_back(std::make_pair("tiles", double(tiles.size())));
+	update.metrics.push_back(std::make_pair("pixels", double(pixels) / (double(width) * height)));
+	update.metrics.push_back(std::make_pair("speedup", scratch.seconds / update.seconds));
+	update.metrics.push_back(std::make_pair("rmse", rmse));
+	update.metrics.push_back(std::make_pair("differing", double(differing) / (double(width) * height)));
+	for (const bench_result *r : { &scratch, &update }) {
+		benchmark::results().push_back(*r);
+		benchmark::print(*r);
+	}
+	std::cout << "  " << tiles.size() << " tiles, " << std::fixed << std::setprecision(1) << update.metric("pixels") * 100 << "% of the pixels, speedup "
+		<< update.metric("speedup") << "x, rmse " << std::setprecision(2) << rmse << ", " << std::setprecision(1) << update.metric("differing") * 100
+		<< "% of pixels differ" << std::endl;
+	background_writer::shared().wait();
+}
+
+#endif
@@ -0,0 +1,129 @@
+#pragma once
+#ifndef BENCH_RENDERH
+#define BENCH_RENDERH
+
+#include "benchmark.h"
+
+// A scene with the camera it is usually rendered with
+struct render_preset {
+
+	const char *name;
+	hitable* (*build)();
+	vec3 look_from, look_at;
+	int max_depth;
+};
+
+static const render_preset render_presets[] = {
+	{ "random_scene", scene::random_scene, vec3(13, 2, 3), vec3(0, 0, 0), 50 },
+	{ "cornell_box", scene::cornell_box, vec3(278, 278, -800), vec3(278, 278, 0), 50 },
+	{ "cornell_box_smoke", scene::cornell_box_smoke, vec3(278, 278, -800), vec3(278, 278, 0), 50 },
+	{ "final_scene", scene::final_scene, vec3(278, 278, -800), vec3(278, 278, 0), 10 },
+	{ "triangle_random", scene::triangle_random, vec3(0, 2, -15), vec3(0, 1, 0), 50 },
+};
+
+// One render of preset p from a fixed seed, the world is rebuilt every time so its build is measured too
+bench_result render_once(const render_preset& p, int width, int height, int spp, unsigned threads, const std::string& name) {
+
+	ThreadPool::SetThreads(threads);
+	s_RndState = 1;
+	auto start = std::chrono::steady_clock::now();
+	hitable *world = p.build();
+	double build = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	scene s(width, height, spp, p.look_from, p.look_at, world, p.max_depth);
+	s.quiet();
+	render_stats stats;
+	s.render("bench_" + std::string(p.name), &stats);
+
+	bench_result res;
+	res.suite = "render";
+	res.name = name;
+	res.ops = stats.rays;
+	res.seconds = stats.seconds;
+	res.metrics.push_back(std::make_pair("threads", double(stats.threads)));
+	res.metrics.push_back(std::make_pair("width", double(width)));
+	res.metrics.push_back(std::make_pair("height", double(height)));
+	res.metrics.push_back(std::make_pair("spp", double(spp)));
+	res.metrics.push_back(std::make_pair("rays", double(stats.rays)));
+	res.metrics.push_back(std::make_pair("paths_per_sec", stats.paths / stats.seconds));
+	res.metrics.push_back(std::make_pair("build_seconds", build));
+	return res;
+}
+
+// Fastest of repeats renders
+bench_result render_best(const render_preset& p, int width, int height, int spp, unsigned threads, const std::string& name, int repeats) {
+
+	bench_result best = render_once(p, width, height, spp, threads, name);
+	for (int i = 1; i < repeats; i++) {
+		bench_result res = render_once(p, width, height, spp, threads, name);
+		if (res.seconds < best.seconds) {
+			best = res;
+		}
+	}
+	return best;
+}
+
+void report_render(bench_result res, double speedup, double efficiency) {
+
+	res.metrics.push_back(std::make_pair("speedup", speedup));
+	res.metrics.push_back(std::make_pair("efficiency", efficiency));
+	benchmark::results().push_back(res);
+	benchmark::print(res);
+	std::cout << "  " << std::setprecision(0) << res.metric("paths_per_sec") << " paths/s, build " << std::setprecision(3) << res.metric("build_seconds")
+		<< " s, speedup " << std::setprecision(2) << speedup << ", efficiency " << efficiency * 100 << "%" << std::endl;
+}
+
+// Options: --preset name|all, --width, --height, --spp, --threads (largest count of the sweep),
+// --scaling strong|weak|both|none, --repeats. Thread counts double from 1 up to --threads.
+void bench_render() {
+
+	std::string preset = benchmark::option("preset", std::string("all"));
+	int width = benchmark::option("width", 200);
+	int height = benchmark::option("height", 200);
+	int spp = benchmark::option("spp", 16);
+	unsigned max_threads = benchmark::option("threads", int(ThreadPool::Threads()));
+	std::string scaling = benchmark::option("scaling", std::string("both"));
+	int repeats = benchmark::option("repeats", 1);
+
+	std::vector<unsigned> counts;
+	for (unsigned t = 1; t < max_threads; t *= 2) {
+		counts.push_back(t);
+	}
+	counts.push_back(max_threads);
+
+	for (const render_preset& p : render_presets) {
+
+		if (preset != "all" && preset != p.name) {
+			continue;
+		}
+		std::string prefix = std::string(p.name) + "/" + std::to_string(width) + "x" + std::to_string(height) + "/";
+
+		// fixed work, more threads: ideal time is T1 / n
+		if (scaling == "strong" || scaling == "both") {
+
+			double t1 = 0;
+			for (unsigned n : counts) {
+				bench_result res = render_best(p, width, height, spp, n, prefix + "strong/t" + std::to_string(n), repeats);
+				if (n == 1) t1 = res.seconds;
+				report_render(res, t1 / res.seconds, t1 / (n * res.seconds));
+			}
+		}
+		// work grows with the threads (n * spp samples): ideal time stays T1
+		if (scaling == "weak" || scaling == "both") {
+
+			double t1 = 0;
+			for (unsigned n : counts) {
+				bench_result res = render_best(p, width, height, spp * n, n, prefix + "weak/t" + std::to_string(n), repeats);
+				if (n == 1) t1 = res.seconds;
+				report_render(res, n * t1 / res.seconds, t1 / res.seconds);
+			}
+		}
+		// a single render at the largest thread count
+		if (scaling == "none") {
+			report_render(render_best(p, width, height, spp, max_threads, prefix + "t" + std::to_string(max_threads), repeats), 1, 1);
+		}
+	}
+	ThreadPool::SetThreads(0);
+}
+
+#endif
@@ -0,0 +1,125 @@
+#pragma once
+#ifndef BENCH_SIMDH
+#define BENCH_SIMDH
+
+#include "benchmark.h"
+#include "bench_kernels.h"
+
+// A sphere of radius 1 cut into stacks x slices quads, two triangles each
+std::vector<vec3> make_sphere_mesh(int stacks, int slices) {
+
+	std::vector<vec3> v;
+	v.reserve(size_t(stacks) * slices * 6);
+	auto at = [&](int i, int j) {
+		float theta = float(M_PI) * i / stacks, phi = 2 * float(M_PI) * j / slices;
+		return vec3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+	};
+	for (int i = 0; i < stacks; i++) {
+		for (int j = 0; j < slices; j++) {
+			vec3 a = at(i, j), b = at(i + 1, j), c = at(i + 1, j + 1), d = at(i, j + 1);
+			v.push_back(a); v.push_back(b); v.push_back(c);
+			v.push_back(a); v.push_back(c); v.push_back(d);
+		}
+	}
+	return v;
+}
+
+// A tree of the given leaf size over the triangles, which it sorts into leaf order
+const flat_node* build_mesh_tree(std::vector<vec3>& v, int leaf_size) {
+
+	int n = int(v.size() / 3);
+	std::vector<aabb> boxes(n);
+	for (int k = 0; k < n; k++) {
+		triangle(v[3 * k], v[3 * k + 1], v[3 * k + 2], nullptr).bounding_box(0, 1, boxes[k]);
+	}
+	std::vector<flat_node> *nodes = new std::vector<flat_node>();
+	std::vector<int32_t> order;
+	build_flat_bvh(boxes.data(), n, *nodes, order, leaf_size);
+	std::vector<vec3> sorted(v.size());
+	for (int k = 0; k < n; k++) {
+		for (int j = 0; j < 3; j++) sorted[3 * k + j] = v[3 * order[k] + j];
+	}
+	v.swap(sorted);
+	return nodes->data();
+}
+
+// Options: --batch (8 triangles), --stacks (128). Runs every kernel set the CPU has:
+// triangles/<isa> tests rays against batches of random triangles with simd_kernels_for(isa)
+// .nearest_triangle, mesh/<isa> traces a sphere mesh of stacks x 2 stacks quads through
+// triangle_mesh with the set selected. mesh/scalar_leaf2 is the tree with the old two triangle
+// leaves. mismatches counts the rays whose answer differs from the scalar one, which must be 0.
+void bench_simd() {
+
+	int batch = benchmark::option("batch", 8);
+	int stacks = benchmark::option("stacks", 128);
+	const int n = 1000000;
+	simd_isa best = simd_supported();
+	std::cout << "  widest set on this CPU: " << simd_name(best) << std::endl;
+
+	// random triangles within the unit cube, each ray tests one batch
+	const int batches = 4096;
+	std::vector<vec3> tris(size_t(batches) * batch * 3);
+	for (vec3& p : tris) p = vec3(random_float(), random_float(), random_float()) * 2 - vec3(1, 1, 1);
+	std::vector<ray> rays = make_kernel_rays(vec3(0, 0, 0), 10, 1.0f, n);
+	std::vector<int> expected(n);
+	for (int i = 0; i < n; i++) {
+		float t = FLT_MAX;
+		expected[i] = nearest_triangle_scalar(&tris[size_t(i % batches) * batch * 3], batch, rays[i], 0.001f, t);
+	}
+	for (int isa = SIMD_SCALAR; isa <= best; isa++) {
+
+		nearest_triangle_fn nearest = simd_kernels_for(simd_isa(isa)).nearest_triangle;
+		benchmark::run("simd", "triangles/" + std::string(simd_name(simd_isa(isa))), (long long)n * batch, [&]() {
+			long long hits = 0;
+			for (int i = 0; i < n; i++) {
+				float t = FLT_MAX;
+				hits += nearest(&tris[size_t(i % batches) * batch * 3], batch, rays[i], 0.001f, t) >= 0;
+			}
+			benchmark::sink = hits;
+		});
+		long long mismatches = 0;
+		for (int i = 0; i < n; i++) {
+			float t = FLT_MAX;
+			mismatches += nearest(&tris[size_t(i % batches) * batch * 3], batch, rays[i], 0.001f, t) != expected[i];
+		}
+		benchmark::results().back().metrics.push_back(std::make_pair("mismatches", double(mismatches)));
+		std::cout << "  " << mismatches << " mismatches" << std::endl;
+	}
+
+	// closest hits through the mesh, the old leaves with the scalar kernel first
+	std::vector<vec3> wide = make_sphere_mesh(stacks, 2 * stacks), narrow = wide;
+	const flat_node *wide_tree = build_mesh_tree(wide, MESH_LEAF_SIZE), *narrow_tree = build_mesh_tree(narrow, FLAT_LEAF_SIZE);
+	triangle_mesh wide_mesh(wide_tree, wide.data(), nullptr), narrow_mesh(narrow_tree, narrow.data(), nullptr);
+	std::vector<ray> mesh_rays = make_kernel_rays(vec3(0, 0, 0), 10, 1.4f, n);
+	std::vector<float> reference(n);
+	simd_select(SIMD_SCALAR);
+	for (int i = 0; i < n; i++) {
+		hit_record rec;
+		reference[i] = narrow_mesh.hit(mesh_rays[i], 0.001f, FLT_MAX, rec) ? rec.t : -1;
+	}
+	auto trace = [&](const std::string& name, const triangle_mesh& mesh) {
+		benchmark::run("simd", "mesh/" + name, n, [&]() {
+			long long hits = 0;
+			for (const ray& r : mesh_rays) {
+				hit_record rec;
+				hits += mesh.hit(r, 0.001f, FLT_MAX, rec);
+			}
+			benchmark::sink = hits;
+		});
+		long long mismatches = 0;
+		for (int i = 0; i < n; i++) {
+			hit_record rec;
+			mismatches += (mesh.hit(mesh_rays[i], 0.001f, FLT_MAX, rec) ? rec.t : -1) != reference[i];
+		}
+		benchmark::results().back().metrics.push_back(std::make_pair("mismatches", double(mismatches)));
+		std::cout << "  " << mismatches << " mismatches" << std::endl;
+	};
+	trace("scalar_leaf2", narrow_mesh);
+	for (int isa = SIMD_SCALAR; isa <= best; isa++) {
+		simd_select(simd_isa(isa));
+		trace(simd_name(simd_isa(isa)), wide_mesh);
+	}
+	simd_select(best);
+}
+
+#endif
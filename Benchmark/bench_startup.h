@@ -0,0 +1,134 @@
+#pragma once
+#ifndef BENCH_STARTUPH
+#define BENCH_STARTUPH
+
+#include "benchmark.h"
+#include "scene_file.h"
+#include <cstdio>
+
+// Writes a cornell box holding a latitude/longitude sphere of about n triangles as OBJ and .scn
+void write_startup_scene(int n, const std::string& obj, const std::string& scn) {
+
+	int rings = std::max(2, int(sqrt(n / 4.0)));
+	int segments = 2 * rings;
+	FILE *f = fopen(obj.c_str(), "w");
+	for (int i = 0; i <= rings; i++) {
+		for (int j = 0; j < segments; j++) {
+			float theta = float(M_PI) * i / rings, phi = 2 * float(M_PI) * j / segments;
+			fprintf(f, "v %.5f %.5f %.5f\n", 150 * sin(theta) * cos(phi), 150 * cos(theta), 150 * sin(theta) * sin(phi));
+		}
+	}
+	for (int i = 0; i < rings; i++) {
+		for (int j = 0; j < segments; j++) {
+			int a = i * segments + j + 1, b = i * segments + (j + 1) % segments + 1;
+			fprintf(f, "f %d %d %d %d\n", a, a + segments, b + segments, b);
+		}
+	}
+	fclose(f);
+
+	std::ofstream out(scn);
+	out << "camera from 278 278 -800 at 278 278 0 vfov 40\n"
+		<< "material red lambertian 0.65 0.05 0.05\nmaterial white lambertian 0.73 0.73 0.73\n"
+		<< "material green lambertian 0.12 0.45 0.15\nmaterial light light 15 15 15\n"
+		<< "yz_rect 0 555 0 555 555 green flip\nyz_rect 0 555 0 555 0 red\nxz_rect 213 343 227 332 554 light\n"
+		<< "xz_rect 0 555 0 555 555 white flip\nxz_rect 0 555 0 555 0 white\nxy_rect 0 555 0 555 555 white flip\n"
+		<< "mesh " << obj.substr(obj.find_last_of("/\\") + 1) << " white translate 278 250 278\n";
+}
+
+// Load, build and trace the first pixel. cache_path empty runs without the cache.
+bench_result startup_once(const std::string& name, const std::string& path, const std::string& cache_path, float& first_t) {
+
+	auto start = std::chrono::steady_clock::now();
+	scene_desc desc;
+	desc.load(path);
+	auto loaded = std::chrono::steady_clock::now();
+
+	bvh_cache *cache = nullptr;
+	if (!cache_path.empty()) {
+		cache = new bvh_cache();
+		cache->map(cache_path, desc.hash());
+	}
+	hitable *world = desc.build_world(cache);
+	if (cache && cache->changed()) {
+		cache->write(cache_path, desc.hash());
+	}
+	auto built = std::chrono::steady_clock::now();
+
+	camera cam(desc.look_from, desc.look_at, vec3(0, 1, 0), desc.vfov, 1, desc.aperture, desc.focus_dist, 0, 1);
+	ray r = cam.get_ray(0.5f, 0.5f);
+	hit_record rec;
+	first_t = world->hit(r, 0.001f, FLT_MAX, rec) ? rec.t : -1;
+	auto end = std::chrono::steady_clock::now();
+
+	bench_result res;
+	res.suite = "startup";
+	res.name = name;
+	res.ops = 1;
+	res.seconds = std::chrono::duration<double>(end - start).count();
+	res.metrics.push_back(std::make_pair("load_seconds", std::chrono::duration<double>(loaded - start).count()));
+	res.metrics.push_back(std::make_pair("build_seconds", std::chrono::duration<double>(built - loaded).count()));
+	res.metrics.push_back(std::make_pair("triangles", double(desc.vertices.size() / 3)));
+	delete cache;
+	return res;
+}
+
+// Options: --triangles (mesh size, 500000), --repeats (best of, 3). Time to the first pixel of a mesh
+// scene from text and from the compiled form, without the BVH cache, writing it and mapping it.
+// The files live in the working directory and are removed afterwards. The OS keeps them in its
+// file cache, so this is the cost of the work done at startup rather than of a cold disk.
+void bench_startup() {
+
+	int triangles = benchmark::option("triangles", 500000);
+	int repeats = benchmark::option("repeats", 3);
+	std::string obj = "bench_startup.obj", scn = "bench_startup.scn", bin = "bench_startup.scnb";
+	write_startup_scene(triangles, obj, scn);
+	{
+		scene_desc desc;
+		desc.load(scn);
+		desc.save_binary(bin);
+	}
+
+	struct variant {
+		const char *name;
+		std::string path;
+		std::string cache;
+		bool fresh;		// the cache file is removed first, so it is built and written
+	};
+	const variant variants[] = {
+		{ "text/no cache", scn, "", false },
+		{ "binary/no cache", bin, "", false },
+		{ "binary/cache write", bin, bin + ".bvh", true },
+		{ "binary/cache mapped", bin, bin + ".bvh", false },
+		{ "text/cache mapped", scn, bin + ".bvh", false },
+	};
+	float reference_t = 0;
+	for (const variant& v : variants) {
+
+		bench_result best;
+		best.seconds = 1e30;
+		for (int i = 0; i < repeats; i++) {
+
+			if (v.fresh) {
+				std::remove(v.cache.c_str());
+			}
+			float t;
+			bench_result res = startup_once(v.name, v.path, v.cache, t);
+			if (&v == variants) reference_t = t;
+			if (t != reference_t) {
+				std::cout << "  first hit differs: t " << t << " instead of " << reference_t << std::endl;
+			}
+			if (res.seconds < best.seconds) best = res;
+		}
+		benchmark::results().push_back(best);
+		benchmark::print(best);
+		std::cout << "  " << std::setprecision(0) << best.metric("triangles") << " triangles, load " << std::setprecision(1) << best.metric("load_seconds") * 1e3
+			<< " ms, build " << best.metric("build_seconds") * 1e3 << " ms, first pixel after " << best.seconds * 1e3 << " ms" << std::endl;
+	}
+
+	std::remove(obj.c_str());
+	std::remove(scn.c_str());
+	std::remove(bin.c_str());
+	std::remove((bin + ".bvh").c_str());
+}
+
+#endif
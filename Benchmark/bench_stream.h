@@ -0,0 +1,86 @@
+#pragma once
+#ifndef BENCH_STREAMH
+#define BENCH_STREAMH
+
+#include "benchmark.h"
+#include "bench_render.h"
+#include <sstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+// Most memory the process has held at once, in bytes
+double peak_rss() {
+
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+	return double(counters.PeakWorkingSetSize);
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return double(usage.ru_maxrss);
+#else
+	return double(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+// Options: --sizes (16384,65536), --format png|tiles, --band (64 rows), --preset (random_scene),
+// --spp (1), --depth (4). Renders square images of each size with scene::render_streamed and
+// reports the peak RSS after each. The peak only grows, so sizes run smallest first and every
+// reading holds for that size and the ones before it. in_memory_mb is what render and save would
+// need for the image alone: a pointer and a vec3 per pixel, the bytes and stb's filtered copy.
+void bench_stream() {
+
+	std::string sizes = benchmark::option("sizes", std::string("16384,65536"));
+	std::string format = benchmark::option("format", std::string("png"));
+	int band = benchmark::option("band", 64);
+	std::string preset = benchmark::option("preset", std::string("random_scene"));
+	int spp = benchmark::option("spp", 1);
+	int depth = benchmark::option("depth", 4);
+
+	const render_preset *p = &render_presets[0];
+	for (const render_preset& r : render_presets) {
+		if (preset == r.name) p = &r;
+	}
+	hitable *world = p->build();
+	double before = peak_rss();
+	std::cout << "  peak RSS before: " << std::fixed << std::setprecision(1) << before / 1048576 << " MB" << std::endl;
+
+	std::stringstream list(sizes);
+	std::string item;
+	while (std::getline(list, item, ',')) {
+
+		int size = atoi(item.c_str());
+		if (size <= 0) continue;
+		scene s(size, size, spp, p->look_from, p->look_at, world, depth);
+		s.quiet();
+		render_stats stats;
+		if (!s.render_streamed("bench_stream", format, band, &stats)) {
+			std::cout << "  streamed render at " << size << " failed" << std::endl;
+			continue;
+		}
+		double pixels = double(size) * size;
+		bench_result res;
+		res.suite = "stream";
+		res.name = format + "/" + std::to_string(size);
+		res.ops = (long long)pixels;
+		res.seconds = stats.seconds;
+		res.metrics.push_back(std::make_pair("peak_rss_mb", peak_rss() / 1048576));
+		res.metrics.push_back(std::make_pair("in_memory_mb", pixels * (sizeof(vec3*) + sizeof(vec3) + 3 + 3) / 1048576));
+		res.metrics.push_back(std::make_pair("band_mb", double(size) * band * 3 * 2 / 1048576));
+		benchmark::results().push_back(res);
+		benchmark::print(res);
+		std::cout << "  peak RSS " << std::setprecision(1) << res.metric("peak_rss_mb") << " MB, the image in memory would take "
+			<< res.metric("in_memory_mb") << " MB, two bands " << res.metric("band_mb") << " MB" << std::endl;
+	}
+}
+
+#endif
@@ -0,0 +1,61 @@
+#pragma once
+#ifndef BENCH_VOLUMEH
+#define BENCH_VOLUMEH
+
+#include "benchmark.h"
+
+// Rays from a sphere around the volume aimed at random points inside it
+std::vector<ray> make_volume_rays(const aabb& bounds, int n) {
+
+	std::vector<ray> rays;
+	rays.reserve(n);
+	vec3 center = 0.5f * (bounds.min() + bounds.max());
+	vec3 extent = bounds.max() - bounds.min();
+	for (int i = 0; i < n; i++) {
+		vec3 from = center + 2 * extent.length() * unit_vector(random_in_unit_sphere());
+		vec3 to = bounds.min() + vec3(random_float() * extent.x(), random_float() * extent.y(), random_float() * extent.z());
+		rays.push_back(ray(from, to - from));
+	}
+	return rays;
+}
+
+void bench_volume_medium(const std::string& name, const grid_medium& medium, const std::vector<ray>& rays) {
+
+	benchmark::run("volume", name + "/delta_tracking", rays.size(), [&]() {
+		long long collided = 0;
+		for (const ray& r : rays) {
+			float t;
+			if (medium.sample_distance(r, 0.001, FLT_MAX, t)) {
+				collided++;
+			}
+		}
+		benchmark::sink = collided;
+	});
+	benchmark::run("volume", name + "/ratio_tracking", rays.size(), [&]() {
+		float sum = 0;
+		for (const ray& r : rays) {
+			sum += medium.transmittance(r, 0.001, FLT_MAX);
+		}
+		benchmark::sink = (long long)sum;
+	});
+}
+
+void bench_volume() {
+
+	const int res = 128;
+	aabb bounds(vec3(0, 0, 0), vec3(1, 1, 1));
+	texture *albedo = new constant_texture(vec3(0.9, 0.9, 0.9));
+	dense_grid *dense = make_smoke_grid(res);
+	sparse_grid *sparse = new sparse_grid(*dense);
+	std::cout << "  smoke " << res << "^3: dense " << dense->memory() / 1024 << " KiB, sparse "
+		<< sparse->memory() / 1024 << " KiB (" << sparse->n_bricks << "/" << sparse->bx * sparse->by * sparse->bz << " bricks)" << std::endl;
+
+	std::vector<ray> rays = make_volume_rays(bounds, 50000);
+	float density = 40;
+	bench_volume_medium("dense/majorant8", grid_medium(dense, bounds, density, albedo, 8), rays);
+	bench_volume_medium("sparse/majorant8", grid_medium(sparse, bounds, density, albedo, 8), rays);
+	bench_volume_medium("sparse/majorant16", grid_medium(sparse, bounds, density, albedo, 16), rays);
+	bench_volume_medium("sparse/global_majorant", grid_medium(sparse, bounds, density, albedo, res), rays);
+}
+
+#endif
@@ -0,0 +1,130 @@
+#pragma once
+#ifndef BENCHMARKH
+#define BENCHMARKH
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <ostream>
+#include <map>
+#include <utility>
+
+struct bench_result {
+
+	std::string suite;
+	std::string name;
+	long long ops;
+	double seconds;
+
+	// suite specific numbers, written after the common fields
+	std::vector<std::pair<std::string, double> > metrics;
+
+	double metric(const std::string& key) const {
+		for (const auto& m : metrics) {
+			if (m.first == key) return m.second;
+		}
+		return 0;
+	}
+
+	double ns_per_op() const { return seconds * 1e9 / double(ops); }
+	double ops_per_sec() const { return double(ops) / seconds; }
+};
+
+class benchmark {
+
+public:
+
+	// Runs func (which performs ops operations) repeats times and keeps the fastest run
+	template<typename Callable>
+	static bench_result run(const std::string& suite, const std::string& name, long long ops, Callable func, int repeats = 5) {
+
+		bench_result res;
+		res.suite = suite;
+		res.name = name;
+		res.ops = ops;
+		res.seconds = 1e30;
+		for (int i = 0; i < repeats; i++) {
+
+			auto start = std::chrono::steady_clock::now();
+			func();
+			auto end = std::chrono::steady_clock::now();
+			double s = std::chrono::duration<double>(end - start).count();
+			if (s < res.seconds) {
+				res.seconds = s;
+			}
+		}
+		results().push_back(res);
+		print(res);
+		return res;
+	}
+
+	static void print(const bench_result& res) {
+
+		std::cout << std::left << std::setw(12) << res.suite << std::setw(40) << res.name
+			<< std::right << std::fixed << std::setprecision(2)
+			<< std::setw(12) << res.ns_per_op() << " ns/op"
+			<< std::setw(12) << res.ops_per_sec() / 1e6 << " Mops/s" << std::endl;
+	}
+
+	// One object per result, label tells runs apart (a commit id for instance)
+	static void write_json(std::ostream& out, const std::string& label) {
+
+		out << "{\n  \"label\": \"" << label << "\",\n  \"results\": [\n";
+		out << std::setprecision(6) << std::fixed;
+		for (size_t i = 0; i < results().size(); i++) {
+
+			const bench_result& res = results()[i];
+			out << "    { \"suite\": \"" << res.suite << "\", \"name\": \"" << res.name << "\", \"ops\": " << res.ops
+				<< ", \"seconds\": " << res.seconds << ", \"ns_per_op\": " << res.ns_per_op() << ", \"ops_per_sec\": " << res.ops_per_sec();
+			for (const auto& m : res.metrics) {
+				out << ", \"" << m.first << "\": " << m.second;
+			}
+			out << " }" << (i + 1 < results().size() ? "," : "") << "\n";
+		}
+		out << "  ]\n}\n";
+	}
+
+	static void write_csv(std::ostream& out, const std::string& label) {
+
+		// suite specific metrics go into the last column as key=value pairs
+		out << "label,suite,name,ops,seconds,ns_per_op,ops_per_sec,metrics\n";
+		out << std::setprecision(6) << std::fixed;
+		for (const bench_result& res : results()) {
+			out << label << "," << res.suite << "," << res.name << "," << res.ops << "," << res.seconds << "," << res.ns_per_op() << "," << res.ops_per_sec() << ",";
+			for (size_t i = 0; i < res.metrics.size(); i++) {
+				out << (i ? ";" : "") << res.metrics[i].first << "=" << res.metrics[i].second;
+			}
+			out << "\n";
+		}
+	}
+
+	static std::vector<bench_result>& results() {
+		static std::vector<bench_result> all;
+		return all;
+	}
+
+	// --key value pairs from the command line
+	static std::map<std::string, std::string>& options() {
+		static std::map<std::string, std::string> all;
+		return all;
+	}
+
+	static std::string option(const std::string& key, const std::string& fallback) {
+		auto it = options().find(key);
+		return it == options().end() ? fallback : it->second;
+	}
+
+	static int option(const std::string& key, int fallback) {
+		auto it = options().find(key);
+		return it == options().end() ? fallback : std::stoi(it->second);
+	}
+
+	// Keeps results the compiler could otherwise throw away
+	static volatile long long sink;
+};
+
+volatile long long benchmark::sink = 0;
+
+#endif
@@ -2,26 +2,44 @@
 #ifndef ThreadPoolH
 #define ThreadPoolH
 
+#include "trace.h"
+#include "perf_counters.h"
+
 class ThreadPool {
 
 public:
 
+	// perf_phase, when given, counts every worker's slice into that phase with PERF_THREAD_SCOPE.
+	// One counter group per slice, per item the syscalls would land inside what they measure.
 	template<typename Index, typename Callable>
-	static void ParallelFor(Index start, Index end, Callable func) {
-		// Estimate number of threads in the pool
-		const static unsigned nb_threads_hint = std::thread::hardware_concurrency();
-		const static unsigned nb_threads = (nb_threads_hint == 0u ? 8u : nb_threads_hint);
+	static void ParallelFor(Index start, Index end, Callable func, const char *perf_phase = nullptr) {
+		const unsigned nb_threads = Threads();
 
 		// Size of a slice for the range functions
 		Index n = end - start + 1;
 		Index slice = (Index)std::round(n / static_cast<double> (nb_threads));
 		slice = std::max(slice, Index(1));
 
+#ifdef RAYTRACER_TRACE
+		TRACE_SCOPE("ParallelFor");
+		// where and when each worker finished its slice
+		std::vector<std::pair<trace_buffer*, double> > slice_end(nb_threads + 1, std::make_pair((trace_buffer*)nullptr, 0.0));
+#endif
+
 		// [Helper] Inner loop
-		auto launchRange = [&func](int k1, int k2) {
-			for (Index k = k1; k < k2; k++) {
-				func(k);
+		auto launchRange = [&](unsigned w, Index k1, Index k2) {
+			{
+				PERF_THREAD_SCOPE(perf_phase, w);
+				TRACE_SCOPE_ARG("slice", "count", int(k2 - k1));
+				for (Index k = k1; k < k2; k++) {
+					func(k);
+				}
 			}
+#ifdef RAYTRACER_TRACE
+			if (trace::is_enabled()) {
+				slice_end[w] = std::make_pair(trace::local(), trace::now());
+			}
+#endif
 		};
 
 		// Create pool and launch jobs
@@ -30,12 +48,12 @@ public:
 		Index i1 = start;
 		Index i2 = std::min(start + slice, end);
 		for (unsigned i = 0; i + 1 < nb_threads && i1 < end; ++i) {
-			pool.emplace_back(launchRange, i1, i2);
+			pool.emplace_back(launchRange, i, i1, i2);
 			i1 = i2;
 			i2 = std::min(i2 + slice, end);
 		}
 		if (i1 < end) {
-			pool.emplace_back(launchRange, i1, end);
+			pool.emplace_back(launchRange, unsigned(pool.size()), i1, end);
 		}
 
 		// Wait for jobs to finish
@@ -44,6 +62,34 @@ public:
 				t.join();
 			}
 		}
+#ifdef RAYTRACER_TRACE
+		// time every worker spent waiting for the slowest one
+		double all_done = trace::now();
+		for (auto& e : slice_end) {
+			if (e.first) {
+				trace::span(e.first, "idle", e.second, all_done);
+			}
+		}
+#endif
+	}
+
+	// Number of threads ParallelFor uses, 0 (the default) means one per hardware thread
+	static void SetThreads(unsigned n) {
+		ThreadCount() = n;
+	}
+
+	static unsigned Threads() {
+		if (ThreadCount() != 0u) {
+			return ThreadCount();
+		}
+		// Estimate number of threads in the pool
+		const static unsigned nb_threads_hint = std::thread::hardware_concurrency();
+		return nb_threads_hint == 0u ? 8u : nb_threads_hint;
+	}
+
+	static unsigned& ThreadCount() {
+		static unsigned count = 0u;
+		return count;
 	}
 
 	// Serial version for easy comparison
@@ -3,6 +3,7 @@
 
 #include "ray.h"
 #include "hitable.h"
+#include "stats.h"
 
 
 class aabb {
@@ -20,6 +21,7 @@ public:
 
 	bool hit(const ray& ray, float tmin, float tmax) const {
 
+		STAT(STAT_BOX_TESTS);
 		for (int i = 0; i < 3; i++) {
 
 			float invD = 1.0f / ray.direction()[i];
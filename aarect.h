@@ -11,13 +11,29 @@ public:
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
 
 		if (ptr->hit(r, t_min, t_max, rec)) {
-			rec.normal = -rec.normal;
+			if (rec.obj == ptr) {
+				rec.obj = this;
+			}
+			else {
+				complete_hit(r, rec);
+				rec.normal = -rec.normal;
+			}
 			return true;
 		}
 		else {
 			return false;
 		}
 	}
+	virtual bool occluded(const ray& r, float t_min, float t_max) const {
+		return ptr->occluded(r, t_min, t_max);
+	}
+	virtual bool hit_interval(const ray& r, float& t0, float& t1) const {
+		return ptr->hit_interval(r, t0, t1);
+	}
+	virtual void compute_surface_interaction(const ray& r, hit_record& rec) const {
+		ptr->compute_surface_interaction(r, rec);
+		rec.normal = -rec.normal;
+	}
 	virtual bool bounding_box(float t0, float t1, aabb& box) const {
 		return ptr->bounding_box(t0, t1, box);
 	}
@@ -30,6 +46,8 @@ public:
 	xy_rect(float _x0, float _x1, float _y0, float _y1, float _k, material *_mat) : x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(_mat) {}
 
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const;
+	virtual void compute_surface_interaction(const ray& r, hit_record& rec) const;
 
 	virtual bool bounding_box(float t0, float t1, aabb& b) const {
 		b = aabb(vec3(x0, y0, k - 0.001), vec3(x1, y1, k + 0.001));
@@ -46,6 +64,8 @@ public:
 	xz_rect(float _x0, float _x1, float _z0, float _z1, float _k, material *mat) : x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
 
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const;
+	virtual void compute_surface_interaction(const ray& r, hit_record& rec) const;
 	virtual bool bounding_box(float t0, float t1, aabb& box) const {
 		box = aabb(vec3(x0, k - 0.0001, z0), vec3(x1, k + 0.0001, z1));
 		return true;
@@ -60,6 +80,8 @@ public:
 	yz_rect() {}
 	yz_rect(float _y0, float _y1, float _z0, float _z1, float _k, material *mat) : y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const;
+	virtual void compute_surface_interaction(const ray& r, hit_record& rec) const;
 	virtual bool bounding_box(float t0, float t1, aabb& box) const {
 		box = aabb(vec3(k - 0.0001, y0, z0), vec3(k + 0.0001, y1, z1));
 		return true;
@@ -71,47 +93,96 @@ public:
 
 bool xy_rect::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
 
+	STAT(STAT_RECT_TESTS);
 	float t = (k - r.origin().z()) / r.direction().z();
 	if (t < t_min || t > t_max) return false;
 	float x = r.origin().x() + t * r.direction().x();
 	float y = r.origin().y() + t * r.direction().y();
 	if (x < x0 || x > x1 || y < y0 || y > y1) return false;
-	rec.u = (x - x0) / (x1 - x0);
-	rec.v = (y - y0) / (y1 - y0);
+	// the in-plane coordinates are normalized once the closest hit is known
+	rec.u = x;
+	rec.v = y;
 	rec.t = t;
+	rec.obj = this;
+	return true;
+}
+
+bool xy_rect::occluded(const ray& r, float t_min, float t_max) const {
+	STAT(STAT_RECT_TESTS);
+	float t = (k - r.origin().z()) / r.direction().z();
+	if (t < t_min || t > t_max) return false;
+	float x = r.origin().x() + t * r.direction().x();
+	float y = r.origin().y() + t * r.direction().y();
+	return x >= x0 && x <= x1 && y >= y0 && y <= y1;
+}
+
+void xy_rect::compute_surface_interaction(const ray& r, hit_record& rec) const {
+	rec.u = (rec.u - x0) / (x1 - x0);
+	rec.v = (rec.v - y0) / (y1 - y0);
 	rec.mat_ptr = mp;
-	rec.p = r.point_at_parameter(t);
+	rec.p = r.point_at_parameter(rec.t);
 	rec.normal = vec3(0, 0, 1);
-	return true;
 }
 
 bool xz_rect::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+	STAT(STAT_RECT_TESTS);
 	float t = (k - r.origin().y()) / r.direction().y();
 	if (t < t_min || t > t_max) return false;
 	float x = r.origin().x() + t * r.direction().x();
 	float z = r.origin().z() + t * r.direction().z();
 	if (x < x0 || x > x1 || z < z0 || z > z1) return false;
-	rec.u = (x - x0) / (x1 - x0);
-	rec.v = (z - z0) / (z1 - z0);
+	rec.u = x;
+	rec.v = z;
 	rec.t = t;
+	rec.obj = this;
+	return true;
+}
+
+bool xz_rect::occluded(const ray& r, float t_min, float t_max) const {
+	STAT(STAT_RECT_TESTS);
+	float t = (k - r.origin().y()) / r.direction().y();
+	if (t < t_min || t > t_max) return false;
+	float x = r.origin().x() + t * r.direction().x();
+	float z = r.origin().z() + t * r.direction().z();
+	return x >= x0 && x <= x1 && z >= z0 && z <= z1;
+}
+
+void xz_rect::compute_surface_interaction(const ray& r, hit_record& rec) const {
+	rec.u = (rec.u - x0) / (x1 - x0);
+	rec.v = (rec.v - z0) / (z1 - z0);
 	rec.mat_ptr = mp;
-	rec.p = r.point_at_parameter(t);
+	rec.p = r.point_at_parameter(rec.t);
 	rec.normal = vec3(0, 1, 0);
-	return true;
 }
 
 bool yz_rect::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+	STAT(STAT_RECT_TESTS);
 	float t = (k - r.origin().x()) / r.direction().x();
 	if (t < t_min || t > t_max) return false;
 	float y = r.origin().y() + t * r.direction().y();
 	float z = r.origin().z() + t * r.direction().z();
 	if (y < y0 || y > y1 || z < z0 || z > z1) return false;
-	rec.u = (y - y0) / (y1 - y0);
-	rec.v = (z - z0) / (z1 - z0);
+	rec.u = y;
+	rec.v = z;
 	rec.t = t;
+	rec.obj = this;
+	return true;
+}
+
+bool yz_rect::occluded(const ray& r, float t_min, float t_max) const {
+	STAT(STAT_RECT_TESTS);
+	float t = (k - r.origin().x()) / r.direction().x();
+	if (t < t_min || t > t_max) return false;
+	float y = r.origin().y() + t * r.direction().y();
+	float z = r.origin().z() + t * r.direction().z();
+	return y >= y0 && y <= y1 && z >= z0 && z <= z1;
+}
+
+void yz_rect::compute_surface_interaction(const ray& r, hit_record& rec) const {
+	rec.u = (rec.u - y0) / (y1 - y0);
+	rec.v = (rec.v - z0) / (z1 - z0);
 	rec.mat_ptr = mp;
-	rec.p = r.point_at_parameter(t);
+	rec.p = r.point_at_parameter(rec.t);
 	rec.normal = vec3(1, 0, 0);
-	return true;
 }
 #endif
\ No newline at end of file
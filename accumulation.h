@@ -0,0 +1,252 @@
+#pragma once
+#ifndef ACCUMULATIONH
+#define ACCUMULATIONH
+
+#include "scene.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+// Samples first to last (exclusive) of every pixel
+struct sample_range {
+	uint32_t first, last;
+};
+
+// Linear radiance sums and sample counts per pixel, with the sample ranges they hold. A render
+// adds ranges to it and can save it at any point, a later run loads it and renders only the
+// samples it misses. Buffers of the same image holding different samples merge into one, every
+// sample has a fixed seed (see scene::radiance) so the result does not depend on the split.
+//
+// File: "RTACC001", int32 width, height, uint64 key, uint32 range count, the ranges, then
+// uint32 counts and double rgb sums per pixel, row by row.
+class accum_buffer {
+
+public:
+	accum_buffer() : width(0), height(0), key(0) {}
+	accum_buffer(int w, int h, uint64_t _key) : width(w), height(h), key(_key), sum(size_t(w) * h * 3, 0.0), count(size_t(w) * h, 0) {}
+
+	bool load(const std::string& path);
+	bool save(const std::string& path) const;
+	bool merge(const accum_buffer& other);
+
+	void add_range(uint32_t first, uint32_t last);
+	std::vector<sample_range> missing(uint32_t first, uint32_t last) const;
+	uint32_t samples() const;
+
+	void add(int x, int y, const vec3& radiance, uint32_t n) {
+		double *p = &sum[3 * (size_t(y) * width + x)];
+		p[0] += radiance[0];
+		p[1] += radiance[1];
+		p[2] += radiance[2];
+		count[size_t(y) * width + x] += n;
+	}
+	// mean radiance, gamma corrected and clamped like scene::pixel
+	vec3 color(int x, int y) const {
+		size_t i = size_t(y) * width + x;
+		if (count[i] == 0) return vec3(0, 0, 0);
+		vec3 c(float(sqrt(sum[3 * i] / count[i])), float(sqrt(sum[3 * i + 1] / count[i])), float(sqrt(sum[3 * i + 2] / count[i])));
+		c.Clamp01();
+		return c;
+	}
+
+	int width, height;
+	uint64_t key;						// which image the samples belong to, see scene_desc::image_hash
+	std::vector<double> sum;
+	std::vector<uint32_t> count;
+	std::vector<sample_range> ranges;	// sorted, adjacent ones joined
+};
+
+void accum_buffer::add_range(uint32_t first, uint32_t last) {
+
+	if (first >= last) return;
+	ranges.push_back({ first, last });
+	std::sort(ranges.begin(), ranges.end(), [](const sample_range& a, const sample_range& b) { return a.first < b.first; });
+	std::vector<sample_range> joined;
+	for (const sample_range& r : ranges) {
+		if (!joined.empty() && r.first <= joined.back().last) joined.back().last = std::max(joined.back().last, r.last);
+		else joined.push_back(r);
+	}
+	ranges = joined;
+}
+
+// The parts of first to last no range covers
+std::vector<sample_range> accum_buffer::missing(uint32_t first, uint32_t last) const {
+
+	std::vector<sample_range> gaps;
+	for (const sample_range& r : ranges) {
+		if (r.last <= first) continue;
+		if (r.first >= last) break;
+		if (r.first > first) gaps.push_back({ first, r.first });
+		first = std::max(first, r.last);
+	}
+	if (first < last) gaps.push_back({ first, last });
+	return gaps;
+}
+
+uint32_t accum_buffer::samples() const {
+
+	uint32_t n = 0;
+	for (const sample_range& r : ranges) n += r.last - r.first;
+	return n;
+}
+
+// Adds the samples of other, which must be of the same image and hold none of ours
+bool accum_buffer::merge(const accum_buffer& other) {
+
+	if (other.width != width || other.height != height || other.key != key) {
+		std::cerr << "accumulation buffers of different images do not merge" << std::endl;
+		return false;
+	}
+	for (const sample_range& r : other.ranges) {
+		std::vector<sample_range> gaps = missing(r.first, r.last);
+		if (gaps.size() != 1 || gaps[0].first != r.first || gaps[0].last != r.last) {
+			std::cerr << "samples " << r.first << " to " << r.last << " are in both buffers" << std::endl;
+			return false;
+		}
+	}
+	for (size_t i = 0; i < sum.size(); i++) sum[i] += other.sum[i];
+	for (size_t i = 0; i < count.size(); i++) count[i] += other.count[i];
+	for (const sample_range& r : other.ranges) add_range(r.first, r.last);
+	return true;
+}
+
+// Written next to path first and then moved over it, so a crash while saving keeps the old file
+bool accum_buffer::save(const std::string& path) const {
+
+	std::string temp = path + ".tmp";
+	FILE *f = fopen(temp.c_str(), "wb");
+	if (!f) {
+		std::cerr << temp << ": cannot write" << std::endl;
+		return false;
+	}
+	int32_t size[2] = { width, height };
+	uint32_t n = uint32_t(ranges.size());
+	fwrite("RTACC001", 1, 8, f);
+	fwrite(size, sizeof(size), 1, f);
+	fwrite(&key, sizeof(key), 1, f);
+	fwrite(&n, sizeof(n), 1, f);
+	if (n) fwrite(ranges.data(), sizeof(sample_range), n, f);
+	fwrite(count.data(), sizeof(uint32_t), count.size(), f);
+	fwrite(sum.data(), sizeof(double), sum.size(), f);
+	bool ok = ferror(f) == 0;
+	ok = fclose(f) == 0 && ok;
+	if (!ok) return false;
+	// the file is replaced in one step, a crash leaves the old one or the new one
+#ifdef _WIN32
+	return MoveFileExA(temp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return std::rename(temp.c_str(), path.c_str()) == 0;
+#endif
+}
+
+bool accum_buffer::load(const std::string& path) {
+
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f) return false;
+	char magic[8];
+	int32_t size[2];
+	uint32_t n = 0;
+	bool ok = fread(magic, 8, 1, f) == 1 && memcmp(magic, "RTACC001", 8) == 0 && fread(size, sizeof(size), 1, f) == 1
+		&& fread(&key, sizeof(key), 1, f) == 1 && fread(&n, sizeof(n), 1, f) == 1 && size[0] > 0 && size[1] > 0;
+	if (ok) {
+		// the header must describe the whole file before anything is allocated for it
+		int64_t at = 8 + sizeof(size) + sizeof(key) + sizeof(n);
+		int64_t expected = at + int64_t(n) * sizeof(sample_range) + int64_t(size[0]) * size[1] * int64_t(sizeof(uint32_t) + 3 * sizeof(double));
+#ifdef _WIN32
+		ok = _fseeki64(f, 0, SEEK_END) == 0 && _ftelli64(f) == expected && _fseeki64(f, at, SEEK_SET) == 0;
+#else
+		ok = fseeko(f, 0, SEEK_END) == 0 && int64_t(ftello(f)) == expected && fseeko(f, off_t(at), SEEK_SET) == 0;
+#endif
+	}
+	if (ok) {
+		width = size[0];
+		height = size[1];
+		ranges.resize(n);
+		count.resize(size_t(width) * height);
+		sum.resize(size_t(width) * height * 3);
+		ok = (n == 0 || fread(ranges.data(), sizeof(sample_range), n, f) == n) && fread(count.data(), sizeof(uint32_t), count.size(), f) == count.size()
+			&& fread(sum.data(), sizeof(double), sum.size(), f) == sum.size();
+	}
+	fclose(f);
+	if (!ok) {
+		std::cerr << path << ": not an accumulation file or truncated" << std::endl;
+	}
+	return ok;
+}
+
+// Renders samples first to last of s into acc in passes of pass samples each, skipping the ones it
+// already holds. After a pass acc is saved to checkpoint (when given) once interval seconds have
+// passed since the last save, and always at the end.
+void accumulate(const scene& s, accum_buffer& acc, uint32_t first, uint32_t last, uint32_t pass, const std::string& checkpoint, double interval) {
+
+	auto saved = std::chrono::steady_clock::now();
+	for (const sample_range& gap : acc.missing(first, last)) {
+
+		for (uint32_t p0 = gap.first; p0 < gap.last; p0 += pass) {
+
+			uint32_t p1 = std::min(p0 + pass, gap.last);
+			ThreadPool::ParallelFor(0, acc.height, [&](int y) {
+				for (int x = 0; x < acc.width; x++) {
+					acc.add(x, y, s.radiance(x, y, int(p0), int(p1)), p1 - p0);
+				}
+			}, "render");
+			acc.add_range(p0, p1);
+			std::cout << "Samples " << p1 << " of " << last << std::endl;
+			if (!checkpoint.empty() && std::chrono::duration<double>(std::chrono::steady_clock::now() - saved).count() >= interval) {
+				acc.save(checkpoint);
+				saved = std::chrono::steady_clock::now();
+			}
+		}
+	}
+	if (!checkpoint.empty()) {
+		acc.save(checkpoint);
+	}
+}
+
+// Drops what the pixels of tiles hold and renders every sample range of acc there again from s,
+// after the scene changed where those pixels look (see scene::tiles_seeing). The other pixels
+// keep their samples, the ranges stay as they were. Returns the rays traced.
+long long rerender_tiles(const scene& s, accum_buffer& acc, const std::vector<pixel_rect>& tiles) {
+
+	std::atomic<long long> rays(0);
+	ThreadPool::ParallelFor(0, int(tiles.size()), [&](int i) {
+
+		long long rays_before = s_RayCount;
+		const pixel_rect& t = tiles[i];
+		for (int y = t.y0; y < t.y1; y++) {
+			for (int x = t.x0; x < t.x1; x++) {
+				size_t p = size_t(y) * acc.width + x;
+				acc.sum[3 * p] = acc.sum[3 * p + 1] = acc.sum[3 * p + 2] = 0;
+				acc.count[p] = 0;
+				for (const sample_range& r : acc.ranges) {
+					acc.add(x, y, s.radiance(x, y, int(r.first), int(r.last)), r.last - r.first);
+				}
+			}
+		}
+		rays += s_RayCount - rays_before;
+	}, "render");
+	return rays;
+}
+
+// The buffer as a PNG in _ImgOutput, like scene::render writes it
+bool save_accumulated(const accum_buffer& acc, const std::string& name) {
+
+	scene image(acc.width, acc.height, 1, vec3(0, 0, 0), vec3(0, 0, 1), nullptr);
+	for (int y = 0; y < acc.height; y++) {
+		for (int x = 0; x < acc.width; x++) {
+			image.set_pixel(x, y, acc.color(x, y));
+		}
+	}
+	return image.save(name);
+}
+
+#endif
@@ -0,0 +1,220 @@
+#pragma once
+#ifndef ANIMATIONH
+#define ANIMATIONH
+
+#include "scene.h"
+#include "flat_bvh.h"
+#include <cstdio>
+
+struct motion_key {
+
+	float frame;
+	vec3 offset;
+	float angle;	// degrees about y, applied before the offset
+};
+
+struct camera_key {
+
+	float frame;
+	vec3 from, at;
+};
+
+// Index of the key a frame starts from and how far it is towards the next one, n keys sorted by frame
+template<typename Key>
+int key_segment(const Key *keys, int n, float frame, float& t) {
+
+	t = 0;
+	if (frame <= keys[0].frame) return 0;
+	for (int i = 0; i + 1 < n; i++) {
+		if (frame < keys[i + 1].frame) {
+			t = (frame - keys[i].frame) / (keys[i + 1].frame - keys[i].frame);
+			return i;
+		}
+	}
+	return n - 1;
+}
+
+// A hitable moved rigidly along keyframes, linear in between and held before the first and after
+// the last key. It is a rotate_y inside a translate of its own, set anew on every frame. The
+// rotate_y keeps the bounds of what it holds, refit() takes them again once that has moved.
+class keyed_instance : public hitable {
+
+public:
+	keyed_instance(hitable *p, const std::vector<motion_key>& _keys) : ptr(p), n_keys(int(_keys.size())), rot(p, 0), moved(&rot, vec3(0, 0, 0)) {
+		keys = arena_array<motion_key>(n_keys);
+		std::copy(_keys.begin(), _keys.end(), keys);
+		set_frame(keys[0].frame);
+	}
+
+	void set_frame(float frame);
+	void refit() { rot = rotate_y(ptr, angle); }
+
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+		if (!moved.hit(r, t_min, t_max, rec)) return false;
+		if (rec.obj == &moved) rec.obj = this;
+		return true;
+	}
+	virtual bool occluded(const ray& r, float t_min, float t_max) const {
+		return moved.occluded(r, t_min, t_max);
+	}
+	virtual bool hit_interval(const ray& r, float& t0, float& t1) const {
+		return moved.hit_interval(r, t0, t1);
+	}
+	virtual void compute_surface_interaction(const ray& r, hit_record& rec) const {
+		moved.compute_surface_interaction(r, rec);
+	}
+	virtual bool bounding_box(float t0, float t1, aabb& b) const {
+		return moved.bounding_box(t0, t1, b);
+	}
+
+	hitable *ptr;
+	motion_key *keys;
+	int n_keys;
+	float angle;
+	rotate_y rot;
+	translate moved;	// holds rot
+};
+
+void keyed_instance::set_frame(float frame) {
+
+	float t;
+	int i = key_segment(keys, n_keys, frame, t);
+	const motion_key& a = keys[i];
+	const motion_key& b = keys[i + 1 < n_keys ? i + 1 : i];
+	angle = a.angle + t * (b.angle - a.angle);
+	refit();
+	moved.offset = a.offset + t * (b.offset - a.offset);
+}
+
+// Per frame timings, update moves the instances and the camera
+struct frame_stats {
+
+	double update_seconds;
+	double refit_seconds;
+	double rebuild_seconds;
+	int rebuilds;
+	float quality;		// largest SAH cost of a tree after refitting, relative to its cost when built
+};
+
+// Renders frames of a scene whose instances move. Between frames the trees are refit bottom-up
+// and only rebuilt once refitting has made one rebuild_ratio times as costly as when it was built.
+class animation {
+
+public:
+	// made while the scene's arena is open, the trees copy themselves into it
+	animation(scene *_s, const std::vector<keyed_instance*>& _instances, const std::vector<int>& _inner_trees, const std::vector<flat_bvh*>& _trees,
+		const std::vector<camera_key>& _cameras)
+		: s(_s), instances(_instances), inner_trees(_inner_trees), trees(_trees), cameras(_cameras), built_cost(_trees.size(), 0), rebuild_ratio(1.5f) {
+		for (flat_bvh *t : trees) t->writable();
+	}
+
+	double rebuild_all();
+	frame_stats set_frame(float frame);
+	bool render(const std::string& name, int first, int last);
+	void refit_instances(size_t& next, size_t n_trees);
+
+	scene *s;
+	std::vector<keyed_instance*> instances;
+	std::vector<int> inner_trees;		// per instance, how many trees were made before it, all it can hold
+	std::vector<flat_bvh*> trees;		// children before the trees that hold them
+	std::vector<camera_key> cameras;
+	std::vector<float> built_cost;
+	float rebuild_ratio;
+};
+
+// Takes the bounds again of the instances from next on that hold none but the first n_trees trees
+void animation::refit_instances(size_t& next, size_t n_trees) {
+
+	for (; next < instances.size() && size_t(inner_trees[next]) <= n_trees; next++) {
+		instances[next]->refit();
+	}
+}
+
+// Builds every tree from scratch where the instances are now, returns the seconds it took
+double animation::rebuild_all() {
+
+	auto start = std::chrono::steady_clock::now();
+	size_t next = 0;
+	for (size_t i = 0; i < trees.size(); i++) {
+		refit_instances(next, i);
+		trees[i]->rebuild();
+		built_cost[i] = trees[i]->sah_cost();
+	}
+	refit_instances(next, trees.size());
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+frame_stats animation::set_frame(float frame) {
+
+	frame_stats st = {};
+	auto start = std::chrono::steady_clock::now();
+	for (keyed_instance *k : instances) {
+		k->set_frame(frame);
+	}
+	if (!cameras.empty()) {
+		float t;
+		int i = key_segment(cameras.data(), int(cameras.size()), frame, t);
+		const camera_key& a = cameras[i];
+		const camera_key& b = cameras[i + 1 < int(cameras.size()) ? i + 1 : i];
+		s->look(a.from + t * (b.from - a.from), a.at + t * (b.at - a.at));
+	}
+	auto updated = std::chrono::steady_clock::now();
+	st.update_seconds = std::chrono::duration<double>(updated - start).count();
+
+	// an instance holding a tree is refit after it, before the trees holding the instance
+	size_t next = 0;
+	for (size_t i = 0; i < trees.size(); i++) {
+
+		auto t0 = std::chrono::steady_clock::now();
+		refit_instances(next, i);
+		trees[i]->refit();
+		float quality = built_cost[i] > 0 ? trees[i]->sah_cost() / built_cost[i] : 1;
+		auto t1 = std::chrono::steady_clock::now();
+		st.refit_seconds += std::chrono::duration<double>(t1 - t0).count();
+		if (quality > rebuild_ratio) {
+			trees[i]->rebuild();
+			built_cost[i] = trees[i]->sah_cost();
+			st.rebuild_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - t1).count();
+			st.rebuilds++;
+		}
+		st.quality = std::max(st.quality, quality);
+	}
+	refit_instances(next, trees.size());
+	return st;
+}
+
+// Frames first to last into name_0000.png and on, with a line of timings per frame
+bool animation::render(const std::string& name, int first, int last) {
+
+	if (last < first) {
+		std::cerr << "frames run from the first to the last, got " << first << " to " << last << std::endl;
+		return false;
+	}
+	set_frame(float(first));
+	double full = rebuild_all();
+	std::cout << "Full rebuild of " << trees.size() << " trees: " << std::fixed << std::setprecision(3) << full * 1e3 << " ms" << std::endl;
+
+	double refit = 0, rebuild = 0;
+	int rebuilds = 0;
+	for (int f = first; f <= last; f++) {
+
+		frame_stats st = set_frame(float(f));
+		refit += st.refit_seconds;
+		rebuild += st.rebuild_seconds;
+		rebuilds += st.rebuilds;
+
+		char frame_name[16];
+		snprintf(frame_name, sizeof(frame_name), "_%04d", f);
+		render_stats rs;
+		s->render(name + frame_name, &rs);
+		std::cout << "Frame " << f << ": update " << std::setprecision(3) << st.update_seconds * 1e3 << " ms, refit " << st.refit_seconds * 1e3
+			<< " ms, rebuild " << st.rebuild_seconds * 1e3 << " ms (" << st.rebuilds << " trees, SAH x" << std::setprecision(2) << st.quality
+			<< "), render " << rs.seconds << " s" << std::endl;
+	}
+	int frames = last - first + 1;
+	std::cout << "Per frame: refit " << std::setprecision(3) << refit / frames * 1e3 << " ms, rebuild " << rebuild / frames * 1e3 << " ms ("
+		<< rebuilds << " rebuilds in " << frames << " frames), full rebuild " << full * 1e3 << " ms" << std::endl;
+	return true;
+}
+
+#endif
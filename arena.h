@@ -0,0 +1,240 @@
+#pragma once
+#ifndef ARENAH
+#define ARENAH
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <iomanip>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Memory a scene is built in. Objects are bumped one after the other into large blocks, so the
+// primitives, BVH nodes and wrappers made together sit next to each other, and the whole scene
+// goes at once. No object is freed on its own.
+//
+// Scene objects keep their buffers in the arena too (arena_array), so they own nothing that needs
+// a destructor and release only frees the blocks, whatever the number of objects. A class that
+// does own heap memory passes its destructor to allocate, release runs those, newest first.
+//
+// While an arena_scope is open, every hitable, material and texture made with new on that thread
+// lands in its arena (see their operator new), so the builders keep writing new sphere(...).
+// make and array are the typed way in for everything else. One thread builds into an arena.
+class arena {
+
+public:
+	enum kind { HITABLE, MATERIAL, TEXTURE, ARRAY, OTHER, KINDS };
+
+	explicit arena(size_t _block_size = size_t(1) << 20) : block_size(_block_size), top(nullptr), end(nullptr), used(0), reserved(0) {
+		for (int k = 0; k < KINDS; k++) {
+			count[k] = 0;
+			bytes[k] = 0;
+		}
+	}
+	~arena() { release(); }
+
+	void *alloc(size_t size, size_t align, kind k);
+
+	template<typename T, typename... Args>
+	T* make(Args&&... args) {
+		T *t = new (alloc(sizeof(T), alignof(T), OTHER)) T(std::forward<Args>(args)...);
+		if (!std::is_trivially_destructible<T>::value) {
+			destructors.push_back({ t, [](void *p) { static_cast<T*>(p)->~T(); } });
+		}
+		return t;
+	}
+	// n value initialized Ts, for lists of pointers and plain numbers
+	template<typename T>
+	T* array(size_t n) {
+		static_assert(std::is_trivially_destructible<T>::value, "arena arrays hold plain values");
+		T *p = static_cast<T*>(alloc(sizeof(T) * n, alignof(T), ARRAY));
+		for (size_t i = 0; i < n; i++) new (p + i) T();
+		return p;
+	}
+
+	void release();
+	void report(std::ostream& out) const;
+	size_t used_bytes() const { return used; }
+	size_t reserved_bytes() const { return reserved; }
+
+	// The arena new puts objects into on this thread, nullptr for the heap
+	static arena*& current() {
+		thread_local arena *a = nullptr;
+		return a;
+	}
+	// Holds the arrays made outside any arena_scope until the program ends, lock its mutex to use it
+	static arena& unscoped() {
+		// the block map is made first so it is still there when this arena is released at exit
+		blocks();
+		blocks_mutex();
+		static arena a;
+		return a;
+	}
+	static std::mutex& unscoped_mutex() {
+		static std::mutex m;
+		return m;
+	}
+	// operator new and delete of the polymorphic scene classes. destroy, when given, runs the
+	// destructor on release. delete of an object in an arena only runs its destructor.
+	static void* allocate(size_t size, kind k, void (*destroy)(void*) = nullptr);
+	static void deallocate(void *p);
+
+private:
+	struct block {
+		char *begin, *end;
+		arena *owner;
+	};
+	struct destructor {
+		void *object;
+		void (*destroy)(void*);
+	};
+
+	static std::map<uintptr_t, block>& blocks() {
+		static std::map<uintptr_t, block> b;
+		return b;
+	}
+	static std::mutex& blocks_mutex() {
+		static std::mutex m;
+		return m;
+	}
+	static arena* owner(const void *p);
+
+	size_t block_size;
+	char *top, *end;
+	size_t used, reserved;
+	size_t count[KINDS], bytes[KINDS];
+	std::vector<char*> own_blocks;
+	std::vector<destructor> destructors;
+};
+
+void *arena::alloc(size_t size, size_t align, kind k) {
+
+	uintptr_t at = (uintptr_t(top) + align - 1) & ~uintptr_t(align - 1);
+	if (!top || at + size > uintptr_t(end)) {
+		// objects larger than a block get a block of their own
+		size_t n = size + align > block_size ? size + align : block_size;
+		char *b = static_cast<char*>(malloc(n));
+		if (!b) throw std::bad_alloc();
+		own_blocks.push_back(b);
+		reserved += n;
+		{
+			std::lock_guard<std::mutex> lock(blocks_mutex());
+			blocks()[uintptr_t(b)] = { b, b + n, this };
+		}
+		top = b;
+		end = b + n;
+		at = (uintptr_t(top) + align - 1) & ~uintptr_t(align - 1);
+	}
+	top = (char*)(at + size);
+	used += size;
+	count[k]++;
+	bytes[k] += size;
+	return (void*)at;
+}
+
+void arena::release() {
+
+	while (!destructors.empty()) {
+		destructor d = destructors.back();
+		destructors.pop_back();
+		if (d.object) d.destroy(d.object);
+	}
+	{
+		std::lock_guard<std::mutex> lock(blocks_mutex());
+		for (char *b : own_blocks) blocks().erase(uintptr_t(b));
+	}
+	for (char *b : own_blocks) free(b);
+	own_blocks.clear();
+	top = end = nullptr;
+	used = reserved = 0;
+	for (int k = 0; k < KINDS; k++) {
+		count[k] = 0;
+		bytes[k] = 0;
+	}
+}
+
+arena* arena::owner(const void *p) {
+
+	std::lock_guard<std::mutex> lock(blocks_mutex());
+	auto it = blocks().upper_bound(uintptr_t(p));
+	if (it == blocks().begin()) return nullptr;
+	--it;
+	return (const char*)p < it->second.end ? it->second.owner : nullptr;
+}
+
+void* arena::allocate(size_t size, kind k, void (*destroy)(void*)) {
+
+	arena *a = current();
+	if (!a) return ::operator new(size);
+	void *p = a->alloc(size, alignof(std::max_align_t), k);
+	if (destroy) a->destructors.push_back({ p, destroy });
+	return p;
+}
+
+void arena::deallocate(void *p) {
+
+	arena *a = owner(p);
+	if (!a) {
+		::operator delete(p);
+		return;
+	}
+	// the memory stays until release, a recorded destructor must not run twice. Only the few
+	// objects that own heap memory have one, and those deleted are mostly the ones made last.
+	for (size_t i = a->destructors.size(); i-- > 0;) {
+		if (a->destructors[i].object == p) {
+			a->destructors[i].object = nullptr;
+			break;
+		}
+	}
+}
+
+void arena::report(std::ostream& out) const {
+
+	static const char *names[KINDS] = { "hitables", "materials", "textures", "arrays", "other" };
+	std::ios::fmtflags flags = out.flags();
+	std::streamsize precision = out.precision();
+	out << std::fixed << std::setprecision(2) << "Scene memory: " << used / 1048576.0 << " MB used of " << reserved / 1048576.0 << " MB in "
+		<< own_blocks.size() << " blocks" << std::endl << std::setprecision(1);
+	for (int k = 0; k < KINDS; k++) {
+		if (count[k]) {
+			out << "  " << std::left << std::setw(10) << names[k] << std::right << std::setw(9) << count[k] << " objects " << std::setw(10)
+				<< bytes[k] / 1024.0 << " KB" << std::endl;
+		}
+	}
+	out.flags(flags);
+	out.precision(precision);
+}
+
+// Puts new scene objects on this thread into a while it is open
+class arena_scope {
+
+public:
+	arena_scope(arena& a) : previous(arena::current()) { arena::current() = &a; }
+	~arena_scope() { arena::current() = previous; }
+
+private:
+	arena *previous;
+};
+
+// A T in the current arena, or on the heap when there is none
+template<typename T, typename... Args>
+T* arena_new(Args&&... args) {
+	arena *a = arena::current();
+	return a ? a->make<T>(std::forward<Args>(args)...) : new T(std::forward<Args>(args)...);
+}
+
+// n value initialized Ts in the current arena, or in arena::unscoped when there is none
+template<typename T>
+T* arena_array(size_t n) {
+	arena *a = arena::current();
+	if (a) return a->array<T>(n);
+	std::lock_guard<std::mutex> lock(arena::unscoped_mutex());
+	return arena::unscoped().array<T>(n);
+}
+
+#endif
@@ -2,6 +2,8 @@
 #define BHV_NODEH
 
 #include "hitable.h"
+#include "perf_counters.h"
+#include "trace.h"
 #include <iostream>
 
 int box_x_compare(const void * a, const void * b) {
@@ -58,6 +60,7 @@ public:
 	bhv_node(hitable **l, int n, float time0, float time1);
 
 	virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float tmin, float tmax) const;
 	virtual bool bounding_box(float t0, float t1, aabb& b)  const;
 
 	hitable *left;
@@ -67,6 +70,8 @@ public:
 
 inline bhv_node::bhv_node(hitable **l, int n, float time0, float time1) {
 
+	PERF_SCOPE("bvh build");
+	TRACE_SCOPE_OUTERMOST("bvh build");
 	aabb *boxes = new aabb[n];
 	float *left_area = new float[n];
 	float *right_area = new float[n];
@@ -162,40 +167,27 @@ inline bhv_node::bhv_node(hitable **l, int n, float time0, float time1) {
 
 bool bhv_node::hit(const ray& r, float tmin, float tmax, hit_record& rec) const {
 
+	STAT(STAT_BVH_NODES);
 	if (box.hit(r, tmin, tmax)) {
 
-		hit_record left_rec, right_rec;
-		bool hit_left = left->hit(r, tmin, tmax, left_rec);
-		bool hit_right = right->hit(r, tmin, tmax, right_rec);
-		if (hit_left && hit_right) {
-			
-			if (left_rec.t < right_rec.t) {
-				rec = left_rec;
-			}
-			else {
-				rec = right_rec;
-			}
-			return true;
-		}
-		else if (hit_left) {
-
-			rec = left_rec;
-			return true;
-		}
-		else if (hit_right) {
-			
-			rec = right_rec;
-			return true;
-		}
-		else {
-			return false;
-		}
+		bool hit_left = left->hit(r, tmin, tmax, rec);
+		bool hit_right = right->hit(r, tmin, hit_left ? rec.t : tmax, rec);
+		return hit_left || hit_right;
 	}
 	else {
 		return false;
 	}
 }
 
+bool bhv_node::occluded(const ray& r, float tmin, float tmax) const {
+
+	STAT(STAT_BVH_NODES);
+	if (box.hit(r, tmin, tmax)) {
+		return left->occluded(r, tmin, tmax) || (right != left && right->occluded(r, tmin, tmax));
+	}
+	return false;
+}
+
 bool bhv_node::bounding_box(float t0, float t1, aabb& b) const {
 	
 	b = box;
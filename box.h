@@ -2,40 +2,237 @@
 #ifndef BOXH
 #define BOXH
 
-#include "aarect.h"
-#include "hitable_list.h"
+#include "hitable.h"
+#include "bhv_node.h"
+#include <emmintrin.h>
+
+// Faces are numbered axis * 2 + (1 for the pmax plane, 0 for the pmin plane)
+inline void box_surface_interaction(const vec3& pmin, const vec3& pmax, material *mat, int face, const ray& r, hit_record& rec) {
+
+	int axis = face / 2;
+	int ua = axis == 0 ? 1 : 0;
+	int va = axis == 2 ? 1 : 2;
+	rec.p = r.point_at_parameter(rec.t);
+	rec.normal = vec3(0, 0, 0);
+	rec.normal[axis] = (face & 1) ? 1.0f : -1.0f;
+	rec.u = (rec.p[ua] - pmin[ua]) / (pmax[ua] - pmin[ua]);
+	rec.v = (rec.p[va] - pmin[va]) / (pmax[va] - pmin[va]);
+	rec.mat_ptr = mat;
+}
 
 class box : public hitable {
 public:
 
 	box() {}
-	box(const vec3& p0, const vec3& p1, material *_mat) {
-
-		pmin = p0;
-		pmax = p1;
-		hitable **list = new hitable*[6];
-		list[0] = new xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), _mat);
-		list[1] = new flip_normals(new xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), _mat));
-		list[2] = new xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), _mat);
-		list[3] = new flip_normals(new xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), _mat));
-		list[4] = new yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), _mat);
-		list[5] = new flip_normals(new yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), _mat));
-		list_ptr = new hitable_list(list, 6);
-	}
+	box(const vec3& p0, const vec3& p1, material *_mat) : pmin(p0), pmax(p1), mat_ptr(_mat) {}
 
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const {
+		STAT(STAT_SLAB_BOX_TESTS);
+		float t_near, t_far;
+		int near_axis, far_axis;
+		if (!slab(r, t_near, t_far, near_axis, far_axis)) return false;
+		return (t_near > t_min && t_near < t_max) || (t_far > t_min && t_far < t_max);
+	}
+	virtual bool hit_interval(const ray& r, float& t0, float& t1) const {
+		int near_axis, far_axis;
+		return slab(r, t0, t1, near_axis, far_axis);
+	}
+	virtual void compute_surface_interaction(const ray& r, hit_record& rec) const {
+		box_surface_interaction(pmin, pmax, mat_ptr, int(rec.u), r, rec);
+	}
 	virtual bool bounding_box(float t0, float t1, aabb& box) const {
 		box = aabb(pmin, pmax);
 		return true;
 	}
 
+	bool slab(const ray& r, float& t_near, float& t_far, int& near_axis, int& far_axis) const;
+
 	vec3 pmin, pmax;
-	hitable *list_ptr;
+	material *mat_ptr;
 };
 
+// Slab test over the whole line, also reports which axis the ray enters and leaves through
+bool box::slab(const ray& r, float& t_near, float& t_far, int& near_axis, int& far_axis) const {
+
+	t_near = -FLT_MAX;
+	t_far = FLT_MAX;
+	near_axis = far_axis = 0;
+	for (int a = 0; a < 3; a++) {
+
+		float invD = 1.0f / r.direction()[a];
+		float ta = (pmin[a] - r.origin()[a]) * invD;
+		float tb = (pmax[a] - r.origin()[a]) * invD;
+		if (invD < 0.0f) {
+			std::swap(ta, tb);
+		}
+		if (ta > t_near) {
+			t_near = ta;
+			near_axis = a;
+		}
+		if (tb < t_far) {
+			t_far = tb;
+			far_axis = a;
+		}
+		if (t_far <= t_near) {
+			return false;
+		}
+	}
+	return true;
+}
+
 bool box::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
-	return list_ptr->hit(r, t_min, t_max, rec);
+
+	STAT(STAT_SLAB_BOX_TESTS);
+	float t_near, t_far;
+	int near_axis, far_axis;
+	if (!slab(r, t_near, t_far, near_axis, far_axis)) {
+		return false;
+	}
+
+	// the face index waits in rec.u until the hit is final
+	if (t_near > t_min && t_near < t_max) {
+		rec.t = t_near;
+		rec.u = float(near_axis * 2 + (r.direction()[near_axis] < 0 ? 1 : 0));
+	}
+	else if (t_far > t_min && t_far < t_max) {
+		rec.t = t_far;
+		rec.u = float(far_axis * 2 + (r.direction()[far_axis] > 0 ? 1 : 0));
+	}
+	else {
+		return false;
+	}
+	rec.obj = this;
+	return true;
 }
 
+// Up to four boxes tested at once with SSE, meant as a BVH leaf
+class box4 : public hitable {
+public:
+
+	box4(box **boxes, int n);
+
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const {
+		float t[4];
+		return candidates(r, t_min, t_max, t) != 0;
+	}
+	virtual void compute_surface_interaction(const ray& r, hit_record& rec) const {
+		int lane = int(rec.v);
+		box_surface_interaction(vec3(bmin[0][lane], bmin[1][lane], bmin[2][lane]), vec3(bmax[0][lane], bmax[1][lane], bmax[2][lane]), mat_ptr[lane], int(rec.u), r, rec);
+	}
+	virtual bool bounding_box(float t0, float t1, aabb& box) const {
+		box = bbox;
+		return true;
+	}
+
+	int candidates(const ray& r, float t_min, float t_max, float *t) const;
+
+	// Groups n boxes into spatially coherent box4 leaves, returns the number of leaves written to out
+	static int make_leaves(box **l, int n, hitable **out);
+
+	float bmin[3][4];
+	float bmax[3][4];
+	material *mat_ptr[4];
+	int count;
+	aabb bbox;
+};
+
+box4::box4(box **boxes, int n) : count(n) {
+
+	for (int i = 0; i < 4; i++) {
+
+		// unused lanes get an inverted box, min and max swap it back into an unbounded slab so
+		// candidates masks them off
+		for (int a = 0; a < 3; a++) {
+			bmin[a][i] = i < n ? boxes[i]->pmin[a] : FLT_MAX;
+			bmax[a][i] = i < n ? boxes[i]->pmax[a] : -FLT_MAX;
+		}
+		mat_ptr[i] = i < n ? boxes[i]->mat_ptr : nullptr;
+	}
+	boxes[0]->bounding_box(0, 1, bbox);
+	for (int i = 1; i < n; i++) {
+		aabb b;
+		boxes[i]->bounding_box(0, 1, b);
+		bbox = surrounding_box(bbox, b);
+	}
+}
+
+// Per lane distance of the first box surface inside (t_min, t_max), returns the mask of lanes that hit
+int box4::candidates(const ray& r, float t_min, float t_max, float *t) const {
+
+	STAT(STAT_BOX4_TESTS);
+	__m128 t_near = _mm_set1_ps(-FLT_MAX);
+	__m128 t_far = _mm_set1_ps(FLT_MAX);
+	for (int a = 0; a < 3; a++) {
+
+		__m128 o = _mm_set1_ps(r.origin()[a]);
+		__m128 invD = _mm_set1_ps(1.0f / r.direction()[a]);
+		__m128 ta = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bmin[a]), o), invD);
+		__m128 tb = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bmax[a]), o), invD);
+		t_near = _mm_max_ps(t_near, _mm_min_ps(ta, tb));
+		t_far = _mm_min_ps(t_far, _mm_max_ps(ta, tb));
+	}
+	__m128 lo = _mm_set1_ps(t_min);
+	__m128 hi = _mm_set1_ps(t_max);
+	__m128 use_near = _mm_cmpgt_ps(t_near, lo);
+	__m128 tc = _mm_or_ps(_mm_and_ps(use_near, t_near), _mm_andnot_ps(use_near, t_far));
+	__m128 valid = _mm_and_ps(_mm_cmple_ps(t_near, t_far), _mm_and_ps(_mm_cmpgt_ps(tc, lo), _mm_cmplt_ps(tc, hi)));
+	_mm_storeu_ps(t, tc);
+	return _mm_movemask_ps(valid) & ((1 << count) - 1);
+}
+
+bool box4::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+
+	float t[4];
+	int mask = candidates(r, t_min, t_max, t);
+	if (!mask) {
+		return false;
+	}
+	int lane = -1;
+	for (int i = 0; i < 4; i++) {
+		if ((mask & (1 << i)) && (lane < 0 || t[i] < t[lane])) {
+			lane = i;
+		}
+	}
+
+	// only the winning lane pays for finding its face
+	box b(vec3(bmin[0][lane], bmin[1][lane], bmin[2][lane]), vec3(bmax[0][lane], bmax[1][lane], bmax[2][lane]), mat_ptr[lane]);
+	if (!b.hit(r, t_min, t_max, rec)) {
+		return false;
+	}
+	rec.v = float(lane);
+	rec.obj = this;
+	return true;
+}
+
+int box4::make_leaves(box **l, int n, hitable **out) {
+
+	if (n <= 4) {
+		out[0] = new box4(l, n);
+		return 1;
+	}
+	aabb main_box;
+	l[0]->bounding_box(0, 1, main_box);
+	for (int i = 1; i < n; i++) {
+		aabb b;
+		l[i]->bounding_box(0, 1, b);
+		main_box = surrounding_box(main_box, b);
+	}
+	int axis = main_box.longest_axis();
+	if (axis == 0) {
+		qsort(l, n, sizeof(box *), box_x_compare);
+	}
+	else if (axis == 1) {
+		qsort(l, n, sizeof(box *), box_y_compare);
+	}
+	else {
+		qsort(l, n, sizeof(box *), box_z_compare);
+	}
+	// split on a multiple of four so every leaf but the last is full
+	int half = ((n / 2 + 3) / 4) * 4;
+	int k = make_leaves(l, half, out);
+	return k + make_leaves(l + half, n - half, out + k);
+}
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,221 @@
+#pragma once
+#ifndef BVH_CACHEH
+#define BVH_CACHEH
+
+#include "flat_bvh.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Built BVHs and the data their leaves index (mesh triangles in leaf order), saved to a file that is
+// mapped on later runs and used in place: the trees hold offsets only, so nothing is rebuilt or
+// patched. The file carries a version and the hash of the scene it was built from, a file of
+// another scene or version is ignored and replaced.
+//
+// File: header, entry table, then the nodes and items of each entry, every block 64 byte aligned.
+
+const uint32_t BVH_CACHE_VERSION = 2;		// 2: mesh leaves of MESH_LEAF_SIZE triangles
+
+struct bvh_entry {
+
+	int key;			// what the tree belongs to, the user of the cache decides
+	int n_nodes;
+	int n_items;
+	int item_size;		// bytes per item
+	const flat_node *nodes;
+	const void *items;
+};
+
+class bvh_cache {
+public:
+	bvh_cache() : data(nullptr), length(0) {}
+	~bvh_cache() { unmap(); }
+
+	bool map(const std::string& path, uint64_t hash);
+	bool write(const std::string& path, uint64_t hash) const;
+	const bvh_entry* find(int key) const;
+	const bvh_entry* add(int key, const std::vector<flat_node>& nodes, const void *items, int n_items, int item_size);
+
+	// entries added since the file was mapped, the file is stale when there are any
+	bool changed() const { return !owned.empty(); }
+	void unmap();
+
+	struct file_header {
+		char magic[8];
+		uint32_t version;
+		uint32_t node_size;
+		uint64_t hash;
+		uint32_t n_entries;
+		uint32_t pad;
+	};
+	struct file_entry {
+		int32_t key, n_nodes, n_items, item_size;
+		uint64_t nodes_at, items_at;
+	};
+
+	std::vector<bvh_entry> entries;
+	std::vector<std::vector<char> > owned;	// storage of added entries
+	const char *data;						// the mapped file
+	size_t length;
+};
+
+void bvh_cache::unmap() {
+
+	if (!data) return;
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+#else
+	munmap((void*)data, length);
+#endif
+	data = nullptr;
+	length = 0;
+}
+
+// Maps path and takes its entries when it was built for hash, false leaves the cache empty
+bool bvh_cache::map(const std::string& path, uint64_t hash) {
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER size;
+	GetFileSizeEx(file, &size);
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!mapping) return false;
+	const char *p = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!p) return false;
+	size_t n = size_t(size.QuadPart);
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+	size_t n = size_t(st.st_size);
+	void *m = mmap(nullptr, n, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) return false;
+	const char *p = (const char*)m;
+#endif
+	data = p;
+	length = n;
+
+	const file_header *h = (const file_header*)data;
+	bool ok = length >= sizeof(file_header) && memcmp(h->magic, "RTBVHC\0\0", 8) == 0 && h->version == BVH_CACHE_VERSION
+		&& h->node_size == sizeof(flat_node) && h->hash == hash && length >= sizeof(file_header) + h->n_entries * sizeof(file_entry);
+	const file_entry *e = (const file_entry*)(data + sizeof(file_header));
+	for (uint32_t i = 0; ok && i < h->n_entries; i++) {
+
+		ok = e[i].nodes_at + e[i].n_nodes * sizeof(flat_node) <= length && e[i].items_at + size_t(e[i].n_items) * e[i].item_size <= length;
+		bvh_entry b;
+		b.key = e[i].key;
+		b.n_nodes = e[i].n_nodes;
+		b.n_items = e[i].n_items;
+		b.item_size = e[i].item_size;
+		b.nodes = (const flat_node*)(data + e[i].nodes_at);
+		b.items = data + e[i].items_at;
+		entries.push_back(b);
+	}
+	if (!ok) {
+		// unmapped so the file can be replaced
+		entries.clear();
+		unmap();
+	}
+	return ok;
+}
+
+const bvh_entry* bvh_cache::find(int key) const {
+
+	for (const bvh_entry& e : entries) {
+		if (e.key == key) return &e;
+	}
+	return nullptr;
+}
+
+// Copies a freshly built tree into the cache. The nodes and items stay valid as long as the cache,
+// the returned entry only until the next add.
+const bvh_entry* bvh_cache::add(int key, const std::vector<flat_node>& nodes, const void *items, int n_items, int item_size) {
+
+	size_t node_bytes = nodes.size() * sizeof(flat_node);
+	owned.push_back(std::vector<char>(node_bytes + size_t(n_items) * item_size));
+	std::vector<char>& mem = owned.back();
+	memcpy(mem.data(), nodes.data(), node_bytes);
+	memcpy(mem.data() + node_bytes, items, size_t(n_items) * item_size);
+
+	bvh_entry e;
+	e.key = key;
+	e.n_nodes = int(nodes.size());
+	e.n_items = n_items;
+	e.item_size = item_size;
+	e.nodes = (const flat_node*)mem.data();
+	e.items = mem.data() + node_bytes;
+	entries.push_back(e);
+	return &entries.back();
+}
+
+bool bvh_cache::write(const std::string& path, uint64_t hash) const {
+
+	FILE *f = fopen(path.c_str(), "wb");
+	if (!f) {
+		std::cerr << path << ": cannot write" << std::endl;
+		return false;
+	}
+	auto align = [](uint64_t at) { return (at + 63) & ~uint64_t(63); };
+
+	file_header h;
+	memcpy(h.magic, "RTBVHC\0\0", 8);
+	h.version = BVH_CACHE_VERSION;
+	h.node_size = sizeof(flat_node);
+	h.hash = hash;
+	h.n_entries = uint32_t(entries.size());
+	h.pad = 0;
+	std::vector<file_entry> table(entries.size());
+	uint64_t at = align(sizeof(file_header) + table.size() * sizeof(file_entry));
+	for (size_t i = 0; i < entries.size(); i++) {
+
+		const bvh_entry& e = entries[i];
+		table[i].key = e.key;
+		table[i].n_nodes = e.n_nodes;
+		table[i].n_items = e.n_items;
+		table[i].item_size = e.item_size;
+		table[i].nodes_at = at;
+		at = align(at + e.n_nodes * sizeof(flat_node));
+		table[i].items_at = at;
+		at = align(at + size_t(e.n_items) * e.item_size);
+	}
+
+	fwrite(&h, sizeof(h), 1, f);
+	if (!table.empty()) fwrite(table.data(), sizeof(file_entry), table.size(), f);
+	static const char zeros[64] = {};
+	uint64_t written = sizeof(file_header) + table.size() * sizeof(file_entry);
+	for (size_t i = 0; i < entries.size(); i++) {
+
+		fwrite(zeros, 1, size_t(table[i].nodes_at - written), f);
+		fwrite(entries[i].nodes, sizeof(flat_node), entries[i].n_nodes, f);
+		written = table[i].nodes_at + entries[i].n_nodes * sizeof(flat_node);
+		fwrite(zeros, 1, size_t(table[i].items_at - written), f);
+		fwrite(entries[i].items, entries[i].item_size, entries[i].n_items, f);
+		written = table[i].items_at + size_t(entries[i].n_items) * entries[i].item_size;
+	}
+	bool ok = ferror(f) == 0;
+	fclose(f);
+	return ok;
+}
+
+#endif
@@ -34,6 +34,24 @@ public:
 		return ray(origin + offset, lower_left_corner + s * horizontal + t * vertical - origin - offset, time);
 	}
 
+	// Where p is seen, as the s and t get_ray takes, and how far the lens spreads it from there in
+	// s and t. False when p is not in front of the lens.
+	bool project(const vec3& p, float& s, float& t, float& spread_s, float& spread_t) const {
+
+		float focus = dot(origin - lower_left_corner, w);
+		vec3 d = p - origin;
+		float depth = -dot(d, w);
+		if (depth <= 0) return false;
+		vec3 q = d * (focus / depth) + origin - lower_left_corner;
+		s = dot(q, horizontal) / horizontal.squared_length();
+		t = dot(q, vertical) / vertical.squared_length();
+		// a ray from lens_radius off centre meets the focus plane lens_radius |depth - focus| / depth from q
+		float spread = lens_radius * fabsf(depth - focus) / depth;
+		spread_s = spread / horizontal.length();
+		spread_t = spread / vertical.length();
+		return true;
+	}
+
 	vec3 origin;
 	vec3 lower_left_corner;
 	vec3 horizontal;
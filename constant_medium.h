@@ -3,6 +3,7 @@
 #define CONSTANT_MEDIUMH
 
 #include "hitable.h"
+#include "maths.h"
 
 class constant_medium : public hitable {
 public:
@@ -11,46 +12,57 @@ public:
 	}
 
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const {
+		float t;
+		return sample_distance(r, t_min, t_max, t);
+	}
 	virtual bool bounding_box(float t0, float t1, aabb& box) const {
 		return boundary->bounding_box(t0, t1, box);
 	}
 
+	bool sample_distance(const ray& r, float t_min, float t_max, float& t) const;
+
 	hitable *boundary;
 	float density;
 	material *phase_function;
 };
 
-bool constant_medium::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+// Samples a free-flight distance through the boundary, t is only written when the ray scatters inside (t_min, t_max)
+bool constant_medium::sample_distance(const ray& r, float t_min, float t_max, float& t) const {
 
-	bool db = (random_float() < 0.00001);
-	db = false;
-	hit_record rec1, rec2;
-	if (boundary->hit(r, -FLT_MAX, FLT_MAX, rec1)) {
-		if (boundary->hit(r, rec1.t + 0.0001, FLT_MAX, rec2)) {
-			if (db) std::cerr << "\nt0 t1 " << rec1.t << " " << rec2.t << "\n";
-			if (rec1.t < t_min)
-				rec1.t = t_min;
-			if (rec2.t > t_max)
-				rec2.t = t_max;
-			if (rec1.t >= rec2.t)
-				return false;
-			if (rec1.t < 0)
-				rec1.t = 0;
-			float distance_inside_boundary = (rec2.t - rec1.t)*r.direction().length();
-			float hit_distance = -(1 / density)*log(random_float());
-			if (hit_distance < distance_inside_boundary) {
-				if (db) std::cerr << "hit_distance = " << hit_distance << "\n";
-				rec.t = rec1.t + hit_distance / r.direction().length();
-				if (db) std::cerr << "rec.t = " << rec.t << "\n";
-				rec.p = r.point_at_parameter(rec.t);
-				if (db) std::cerr << "rec.p = " << rec.p << "\n";
-				rec.normal = vec3(1, 0, 0);  // arbitrary
-				rec.mat_ptr = phase_function;
-				return true;
-			}
+	STAT(STAT_MEDIUM_TESTS);
+	float t0, t1;
+	if (boundary->hit_interval(r, t0, t1)) {
+
+		if (t0 < t_min)
+			t0 = t_min;
+		if (t1 > t_max)
+			t1 = t_max;
+		if (t0 >= t1)
+			return false;
+		if (t0 < 0)
+			t0 = 0;
+		float distance_inside_boundary = (t1 - t0)*r.direction().length();
+		float hit_distance = -(1 / density)*math_log(random_float());
+		if (hit_distance < distance_inside_boundary) {
+			t = t0 + hit_distance / r.direction().length();
+			return true;
 		}
 	}
 	return false;
 }
 
+bool constant_medium::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+
+	if (sample_distance(r, t_min, t_max, rec.t)) {
+		STAT(STAT_VOLUME_HITS);
+		rec.p = r.point_at_parameter(rec.t);
+		rec.normal = vec3(1, 0, 0);  // arbitrary
+		rec.mat_ptr = phase_function;
+		rec.obj = nullptr;
+		return true;
+	}
+	return false;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,514 @@
+#pragma once
+#ifndef DISTRIBUTEDH
+#define DISTRIBUTEDH
+
+#include "scene_file.h"
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+typedef SOCKET net_socket;
+const net_socket NET_INVALID = INVALID_SOCKET;
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+typedef int net_socket;
+const net_socket NET_INVALID = -1;
+#endif
+
+// Tile rendering over TCP. A coordinator splits the image into tiles and hands them out one at a
+// time to whichever worker asks next, workers load the scene once and render every tile they get.
+// Workers can run on other machines, they only need the coordinator's address. There is no
+// authentication, so the coordinator only listens beyond this machine when remote workers are asked for.
+//
+// Messages are framed: a header (magic, type, payload bytes) and the payload, all little endian.
+//   coordinator -> worker   NET_SCENE   the compiled scene file (see scene_file.h)
+//   worker -> coordinator   NET_READY   the scene is loaded
+//   coordinator -> worker   NET_TILE    int32 x0 y0 x1 y1
+//   worker -> coordinator   NET_PIXELS  int32 x0 y0 x1 y1, int64 rays, float rgb per pixel row by row
+//   coordinator -> worker   NET_DONE    no tiles left, the worker exits
+// The compiled scene holds meshes and heights, image textures are paths the worker must be able to read.
+// Payloads are checked against their type: a header of an unknown type or longer than the type
+// allows ends the connection, workers clamp tiles to the image, the coordinator drops a worker
+// whose pixels are not the tile it sent.
+
+const uint32_t NET_MAGIC = 0x31505452;	// "RTP1"
+enum net_message { NET_SCENE = 1, NET_READY, NET_TILE, NET_PIXELS, NET_DONE };
+
+struct net_header {
+	uint32_t magic;
+	uint32_t type;
+	uint64_t length;
+};
+
+// Most payload bytes a message of type can hold, 0 for those that hold none
+uint64_t net_max_length(uint32_t type) {
+
+	switch (type) {
+	case NET_SCENE: return uint64_t(1) << 31;
+	case NET_TILE: return 4 * sizeof(int32_t);
+	case NET_PIXELS: return uint64_t(1) << 31;
+	default: return 0;
+	}
+}
+
+void net_startup() {
+
+#ifdef _WIN32
+	static bool started = false;
+	if (!started) {
+		WSADATA data;
+		WSAStartup(MAKEWORD(2, 2), &data);
+		started = true;
+	}
+#else
+	// a worker going away must not kill the coordinator
+	signal(SIGPIPE, SIG_IGN);
+#endif
+}
+
+void net_close(net_socket s) {
+
+#ifdef _WIN32
+	closesocket(s);
+#else
+	close(s);
+#endif
+}
+
+bool net_send_all(net_socket s, const void *data, size_t n) {
+
+	const char *p = (const char*)data;
+	while (n > 0) {
+		int sent = send(s, p, int(std::min(n, size_t(1) << 30)), 0);
+		if (sent <= 0) return false;
+		p += sent;
+		n -= size_t(sent);
+	}
+	return true;
+}
+
+bool net_recv_all(net_socket s, void *data, size_t n) {
+
+	char *p = (char*)data;
+	while (n > 0) {
+		int got = recv(s, p, int(std::min(n, size_t(1) << 30)), 0);
+		if (got <= 0) return false;
+		p += got;
+		n -= size_t(got);
+	}
+	return true;
+}
+
+bool net_send(net_socket s, uint32_t type, const void *payload, size_t n) {
+
+	net_header h = { NET_MAGIC, type, n };
+	return net_send_all(s, &h, sizeof(h)) && (n == 0 || net_send_all(s, payload, n));
+}
+
+bool net_recv(net_socket s, uint32_t& type, std::vector<char>& payload) {
+
+	net_header h;
+	if (!net_recv_all(s, &h, sizeof(h)) || h.magic != NET_MAGIC) return false;
+	if (h.type < NET_SCENE || h.type > NET_DONE || h.length > net_max_length(h.type)) return false;
+	type = h.type;
+	payload.resize(size_t(h.length));
+	return h.length == 0 || net_recv_all(s, payload.data(), payload.size());
+}
+
+// True when s becomes readable (a connection to accept, data to receive) within ms milliseconds
+bool net_wait(net_socket s, int ms) {
+
+	fd_set set;
+	FD_ZERO(&set);
+	FD_SET(s, &set);
+	timeval timeout = { ms / 1000, (ms % 1000) * 1000 };
+	return select(int(s + 1), &set, nullptr, nullptr, &timeout) > 0;
+}
+
+// Listens on port on every interface when remote, else on the loopback one only. Port 0 picks a
+// free one and returns it in port.
+net_socket net_listen(int& port, bool remote) {
+
+	net_startup();
+	net_socket s = socket(AF_INET, SOCK_STREAM, 0);
+	if (s == NET_INVALID) return NET_INVALID;
+	int yes = 1;
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&yes, sizeof(yes));
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(remote ? INADDR_ANY : INADDR_LOOPBACK);
+	addr.sin_port = htons(uint16_t(port));
+	socklen_t len = sizeof(addr);
+	if (bind(s, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(s, 64) != 0 || getsockname(s, (sockaddr*)&addr, &len) != 0) {
+		net_close(s);
+		return NET_INVALID;
+	}
+	port = ntohs(addr.sin_port);
+	return s;
+}
+
+// address is HOST:PORT
+net_socket net_connect(const std::string& address) {
+
+	net_startup();
+	size_t colon = address.find_last_of(':');
+	if (colon == std::string::npos) return NET_INVALID;
+	std::string host = address.substr(0, colon), port = address.substr(colon + 1);
+	addrinfo hints = {}, *found = nullptr;
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0) return NET_INVALID;
+	net_socket s = socket(found->ai_family, found->ai_socktype, found->ai_protocol);
+	if (s != NET_INVALID && connect(s, found->ai_addr, int(found->ai_addrlen)) != 0) {
+		net_close(s);
+		s = NET_INVALID;
+	}
+	freeaddrinfo(found);
+	if (s != NET_INVALID) {
+		int yes = 1;
+		setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&yes, sizeof(yes));
+	}
+	return s;
+}
+
+// Path of the running program, for starting more of it. argv0 when the system cannot tell.
+std::string current_executable(const char *argv0) {
+
+#ifdef _WIN32
+	char path[MAX_PATH];
+	DWORD n = GetModuleFileNameA(nullptr, path, MAX_PATH);
+	if (n > 0 && n < MAX_PATH) return std::string(path, n);
+#else
+	char path[4096];
+	ssize_t n = readlink("/proc/self/exe", path, sizeof(path));
+	if (n > 0 && n < ssize_t(sizeof(path))) return std::string(path, size_t(n));
+#endif
+	return argv0;
+}
+
+// Starts exe with args in the background, true when it is running exe
+bool spawn_process(const std::string& exe, const std::vector<std::string>& args) {
+
+#ifdef _WIN32
+	std::string line = "\"" + exe + "\"";
+	for (const std::string& a : args) line += " \"" + a + "\"";
+	STARTUPINFOA si = {};
+	si.cb = sizeof(si);
+	PROCESS_INFORMATION pi;
+	if (!CreateProcessA(nullptr, &line[0], nullptr, nullptr, FALSE, 0, nullptr, nullptr, &si, &pi)) return false;
+	CloseHandle(pi.hThread);
+	CloseHandle(pi.hProcess);
+	return true;
+#else
+	// forked twice so the worker is never left a zombie of ours. The pipe closes on exec, a byte
+	// on it instead means the second fork or the exec failed.
+	int fds[2];
+	if (pipe(fds) != 0) return false;
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	pid_t pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		pid_t worker = fork();
+		if (worker == 0) {
+			std::vector<char*> argv;
+			argv.push_back((char*)exe.c_str());
+			for (const std::string& a : args) argv.push_back((char*)a.c_str());
+			argv.push_back(nullptr);
+			execv(exe.c_str(), argv.data());
+		}
+		if (worker <= 0) {
+			char failed = 1;
+			ssize_t written = write(fds[1], &failed, 1);
+			(void)written;
+		}
+		_exit(0);
+	}
+	close(fds[1]);
+	int status;
+	waitpid(pid, &status, 0);
+	char failed;
+	ssize_t n;
+	do {
+		n = read(fds[0], &failed, 1);
+	} while (n < 0 && errno == EINTR);
+	close(fds[0]);
+	return n == 0;
+#endif
+}
+
+// Connects to the coordinator at address and renders tiles until told to stop. threads is the
+// ParallelFor width per tile, 0 for every hardware thread.
+int run_worker(const std::string& address, unsigned threads) {
+
+	net_socket s = net_connect(address);
+	if (s == NET_INVALID) {
+		std::cerr << "worker: cannot connect to " << address << std::endl;
+		return 1;
+	}
+	ThreadPool::SetThreads(threads);
+	uint32_t type;
+	std::vector<char> payload;
+	if (!net_recv(s, type, payload) || type != NET_SCENE) {
+		net_close(s);
+		return 1;
+	}
+
+	// the scene goes through a file of our own, scene_desc loads from files
+#ifdef _WIN32
+	std::string path = "worker_" + std::to_string(GetCurrentProcessId()) + ".scnb";
+#else
+	std::string path = "worker_" + std::to_string(getpid()) + ".scnb";
+#endif
+	FILE *f = fopen(path.c_str(), "wb");
+	bool loaded = f && fwrite(payload.data(), 1, payload.size(), f) == payload.size();
+	if (f) fclose(f);
+	scene_desc desc;
+	loaded = loaded && desc.load_binary(path);
+	std::remove(path.c_str());
+	if (!loaded) {
+		net_close(s);
+		return 1;
+	}
+	scene *sc = desc.make_scene();
+	sc->quiet();
+	net_send(s, NET_READY, nullptr, 0);
+
+	std::vector<vec3> pixels;
+	std::vector<char> reply;
+	while (net_recv(s, type, payload) && type == NET_TILE && payload.size() == 4 * sizeof(int32_t)) {
+
+		// the reply names the tile rendered, a coordinator that sent another one drops us
+		int32_t tile[4];
+		memcpy(tile, payload.data(), sizeof(tile));
+		for (int k = 0; k < 4; k++) {
+			tile[k] = std::max(0, std::min(tile[k], k % 2 ? sc->height() : sc->width()));
+		}
+		tile[2] = std::max(tile[2], tile[0]);
+		tile[3] = std::max(tile[3], tile[1]);
+		size_t n = size_t(tile[2] - tile[0]) * (tile[3] - tile[1]);
+		pixels.resize(n);
+		int64_t rays = sc->render_tile(tile[0], tile[1], tile[2], tile[3], pixels.data());
+		reply.resize(sizeof(tile) + sizeof(rays) + n * 3 * sizeof(float));
+		memcpy(reply.data(), tile, sizeof(tile));
+		memcpy(reply.data() + sizeof(tile), &rays, sizeof(rays));
+		float *rgb = (float*)(reply.data() + sizeof(tile) + sizeof(rays));
+		for (size_t i = 0; i < n; i++) {
+			for (int k = 0; k < 3; k++) rgb[3 * i + k] = pixels[i][k];
+		}
+		if (!net_send(s, NET_PIXELS, reply.data(), reply.size())) break;
+	}
+	net_close(s);
+	return 0;
+}
+
+// Timings of a distributed render
+struct tile_stats {
+	double seconds;			// first tile sent to last tile back
+	double setup_seconds;	// connecting and loading the scene on every worker
+	long long rays;
+	int tiles;
+	int workers;
+};
+
+// Renders the scene at scene_path on workers, local ones are spawned from exe (this program run
+// with --worker), remote ones connect by themselves. Tiles are tile_size square. A worker that
+// fails gives its tile back to the others.
+class tile_coordinator {
+
+public:
+	tile_coordinator(const std::string& _scene_path, int _tile_size) : scene_path(_scene_path), tile_size(_tile_size), port(0), wait_seconds(30) {}
+
+	bool render(const std::string& name, const std::string& exe, int local, unsigned threads, int remote, tile_stats *stats);
+
+	std::string scene_path;
+	int tile_size;
+	int port;	// 0 picks a free one
+	int wait_seconds;	// for the next worker to connect, the render starts with those there are by then
+};
+
+bool tile_coordinator::render(const std::string& name, const std::string& exe, int local, unsigned threads, int remote, tile_stats *stats) {
+
+	scene_desc desc;
+	if (!desc.load(scene_path)) return false;
+	std::string compiled = scene_path + ".tiles.scnb";
+	std::vector<char> scene_bytes;
+	{
+		if (!desc.save_binary(compiled)) return false;
+		FILE *f = fopen(compiled.c_str(), "rb");
+		fseek(f, 0, SEEK_END);
+		scene_bytes.resize(size_t(ftell(f)));
+		fseek(f, 0, SEEK_SET);
+		size_t got = fread(scene_bytes.data(), 1, scene_bytes.size(), f);
+		fclose(f);
+		std::remove(compiled.c_str());
+		if (got != scene_bytes.size()) return false;
+	}
+
+	net_socket listener = net_listen(port, remote > 0);
+	if (listener == NET_INVALID) {
+		std::cerr << "coordinator: cannot listen on port " << port << std::endl;
+		return false;
+	}
+	std::cout << "Coordinator listening on port " << port << ", waiting for " << local + remote << " workers" << std::endl;
+	auto start = std::chrono::steady_clock::now();
+	int expected = remote;
+	for (int i = 0; i < local; i++) {
+		if (spawn_process(exe, { "--worker", "127.0.0.1:" + std::to_string(port), "--threads", std::to_string(threads) })) {
+			expected++;
+		}
+		else {
+			std::cerr << "coordinator: cannot start " << exe << std::endl;
+		}
+	}
+
+	// every worker gets the scene as it connects, rendering starts once all are ready
+	std::vector<net_socket> workers;
+	std::vector<std::thread> loading;
+	std::mutex workers_mutex;
+	for (int i = 0; i < expected; i++) {
+
+		// a worker that exits before it connects would leave accept waiting for ever
+		if (!net_wait(listener, wait_seconds * 1000)) {
+			std::cerr << "coordinator: " << expected - i << " workers did not connect within " << wait_seconds << " s" << std::endl;
+			break;
+		}
+		net_socket w = accept(listener, nullptr, nullptr);
+		if (w == NET_INVALID) break;
+		int yes = 1;
+		setsockopt(w, IPPROTO_TCP, TCP_NODELAY, (const char*)&yes, sizeof(yes));
+		loading.emplace_back([&, w]() {
+			uint32_t type;
+			std::vector<char> payload;
+			if (net_send(w, NET_SCENE, scene_bytes.data(), scene_bytes.size()) && net_recv(w, type, payload) && type == NET_READY) {
+				std::lock_guard<std::mutex> lock(workers_mutex);
+				workers.push_back(w);
+			}
+			else {
+				net_close(w);
+			}
+		});
+	}
+	for (std::thread& t : loading) t.join();
+	net_close(listener);
+	if (workers.empty()) {
+		std::cerr << "coordinator: no workers" << std::endl;
+		return false;
+	}
+	auto ready = std::chrono::steady_clock::now();
+
+	struct tile { int32_t x0, y0, x1, y1; };
+	std::vector<tile> tiles;
+	for (int y = 0; y < desc.height; y += tile_size) {
+		for (int x = 0; x < desc.width; x += tile_size) {
+			tiles.push_back({ x, y, std::min(x + tile_size, desc.width), std::min(y + tile_size, desc.height) });
+		}
+	}
+	scene image(desc.width, desc.height, desc.spp, desc.look_from, desc.look_at, nullptr);
+	std::mutex tiles_mutex;
+	std::condition_variable tiles_changed;
+	size_t next = 0;
+	std::vector<tile> returned;		// tiles of workers that failed
+	int in_flight = 0;				// sent and not back yet, any of them may still be returned
+	int done = 0;
+	std::atomic<long long> rays(0);
+
+	// a worker with nothing to take waits while others still have tiles out, one of those failing
+	// gives its tile back
+	auto serve = [&](net_socket w) {
+		std::vector<char> payload;
+		for (;;) {
+
+			tile t;
+			{
+				std::unique_lock<std::mutex> lock(tiles_mutex);
+				tiles_changed.wait(lock, [&]() { return !returned.empty() || next < tiles.size() || in_flight == 0; });
+				if (!returned.empty()) {
+					t = returned.back();
+					returned.pop_back();
+				}
+				else if (next < tiles.size()) {
+					t = tiles[next++];
+				}
+				else {
+					break;
+				}
+				in_flight++;
+			}
+			uint32_t type;
+			size_t n = size_t(t.x1 - t.x0) * (t.y1 - t.y0);
+			if (!net_send(w, NET_TILE, &t, sizeof(t)) || !net_recv(w, type, payload) || type != NET_PIXELS
+				|| payload.size() != sizeof(t) + sizeof(int64_t) + n * 3 * sizeof(float) || memcmp(payload.data(), &t, sizeof(t)) != 0) {
+				{
+					std::lock_guard<std::mutex> lock(tiles_mutex);
+					returned.push_back(t);
+					in_flight--;
+				}
+				tiles_changed.notify_all();
+				std::cerr << "coordinator: lost a worker" << std::endl;
+				net_close(w);
+				return;
+			}
+			int64_t tile_rays;
+			memcpy(&tile_rays, payload.data() + sizeof(t), sizeof(tile_rays));
+			const float *rgb = (const float*)(payload.data() + sizeof(t) + sizeof(tile_rays));
+			{
+				std::lock_guard<std::mutex> lock(tiles_mutex);
+				for (int y = t.y0; y < t.y1; y++) {
+					for (int x = t.x0; x < t.x1; x++, rgb += 3) {
+						image.set_pixel(x, y, vec3(rgb[0], rgb[1], rgb[2]));
+					}
+				}
+				rays += tile_rays;
+				done++;
+				in_flight--;
+			}
+			tiles_changed.notify_all();
+		}
+		net_send(w, NET_DONE, nullptr, 0);
+		net_close(w);
+	};
+	std::vector<std::thread> serving;
+	for (net_socket w : workers) {
+		serving.emplace_back(serve, w);
+	}
+	for (std::thread& t : serving) t.join();
+	auto end = std::chrono::steady_clock::now();
+
+	if (done != int(tiles.size())) {
+		std::cerr << "coordinator: " << tiles.size() - done << " tiles were not rendered" << std::endl;
+		return false;
+	}
+	image.save(name);
+	if (stats) {
+		stats->seconds = std::chrono::duration<double>(end - ready).count();
+		stats->setup_seconds = std::chrono::duration<double>(ready - start).count();
+		stats->rays = rays;
+		stats->tiles = int(tiles.size());
+		stats->workers = int(workers.size());
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,365 @@
+#pragma once
+#ifndef DYNAMIC_BVHH
+#define DYNAMIC_BVHH
+
+#include "hitable.h"
+#include "perf_counters.h"
+#include <queue>
+#include <vector>
+
+// Node of a dynamic_bvh, a leaf holds one item. Nodes are indices into a pool so ids stay valid
+// while others are added and removed.
+struct dynamic_node {
+
+	aabb box;
+	int parent;
+	int left, right;	// -1 for leaves
+	hitable *item;		// leaves only, nullptr for a free node
+	bool leaf() const { return left < 0; }
+};
+
+// BVH that takes items one at a time. insert places an item next to the node where it adds the
+// least surface area (branch and bound over the tree), then refits the path to the root and
+// rotates nodes on it where that shrinks them. remove and update cost about as much as an
+// insert, so editing a scene never needs a full build.
+class dynamic_bvh : public hitable {
+
+public:
+	dynamic_bvh() : root(-1), free_list(-1), n_items(0) {}
+	// the node pool grows on the heap, so an arena has to run the destructor
+	static void* operator new(size_t size) { return arena::allocate(size, arena::HITABLE, [](void *p) { static_cast<dynamic_bvh*>(p)->~dynamic_bvh(); }); }
+
+	int insert(hitable *h);			// returns the id of the item
+	void remove(int id);
+	void update(int id);			// after the item moved or changed its size
+
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const;
+	virtual bool bounding_box(float t0, float t1, aabb& b) const {
+		if (root < 0) return false;
+		b = nodes[root].box;
+		return true;
+	}
+
+	float sah_cost() const;
+	int size() const { return n_items; }
+
+	std::vector<dynamic_node> nodes;
+	int root;
+	int free_list;	// chained through parent
+	int n_items;
+
+private:
+	int allocate();
+	void release(int i);
+	int best_sibling(const aabb& b) const;
+	void insert_leaf(int leaf);
+	void remove_leaf(int leaf);
+	void refit_up(int i);
+	void rotate(int i);
+
+	template<typename Leaf>
+	bool walk(int start, const ray& r, const vec3& inv_dir, float tmin, float& tmax, bool any, Leaf& leaf) const;
+};
+
+int dynamic_bvh::allocate() {
+
+	if (free_list < 0) {
+		nodes.push_back(dynamic_node());
+		return int(nodes.size()) - 1;
+	}
+	int i = free_list;
+	free_list = nodes[i].parent;
+	return i;
+}
+
+void dynamic_bvh::release(int i) {
+
+	nodes[i].item = nullptr;
+	nodes[i].left = nodes[i].right = -1;
+	nodes[i].parent = free_list;
+	free_list = i;
+}
+
+int dynamic_bvh::insert(hitable *h) {
+
+	int leaf = allocate();
+	dynamic_node& n = nodes[leaf];
+	h->bounding_box(0, 1, n.box);
+	n.item = h;
+	n.left = n.right = -1;
+	n.parent = -1;
+	insert_leaf(leaf);
+	n_items++;
+	return leaf;
+}
+
+void dynamic_bvh::remove(int id) {
+
+	remove_leaf(id);
+	release(id);
+	n_items--;
+}
+
+void dynamic_bvh::update(int id) {
+
+	aabb b;
+	nodes[id].item->bounding_box(0, 1, b);
+	remove_leaf(id);
+	nodes[id].box = b;
+	insert_leaf(id);
+}
+
+// The node the new box should become a sibling of. Choosing s costs the area of s joined with the
+// box plus what every ancestor of s grows by, which only rises going down, so a subtree is skipped
+// once the growth on its path plus the box's own area cannot beat the best cost found.
+int dynamic_bvh::best_sibling(const aabb& b) const {
+
+	struct candidate {
+		float inherited;
+		int node;
+		bool operator<(const candidate& o) const { return inherited > o.inherited; }
+	};
+	float area = b.area();
+	int best = root;
+	float best_cost = surrounding_box(nodes[root].box, b).area();
+	std::priority_queue<candidate> queue;
+	queue.push({ 0, root });
+	while (!queue.empty()) {
+
+		candidate c = queue.top();
+		queue.pop();
+		if (c.inherited + area >= best_cost) break;
+		const dynamic_node& n = nodes[c.node];
+		float joined = surrounding_box(n.box, b).area();
+		float cost = joined + c.inherited;
+		if (cost < best_cost) {
+			best_cost = cost;
+			best = c.node;
+		}
+		if (n.leaf()) continue;
+		float inherited = c.inherited + joined - n.box.area();
+		if (inherited + area < best_cost) {
+			queue.push({ inherited, n.left });
+			queue.push({ inherited, n.right });
+		}
+	}
+	return best;
+}
+
+void dynamic_bvh::insert_leaf(int leaf) {
+
+	if (root < 0) {
+		root = leaf;
+		nodes[leaf].parent = -1;
+		return;
+	}
+	int sibling = best_sibling(nodes[leaf].box);
+	int old_parent = nodes[sibling].parent;
+	int parent = allocate();
+	dynamic_node& p = nodes[parent];
+	p.item = nullptr;
+	p.parent = old_parent;
+	p.left = sibling;
+	p.right = leaf;
+	p.box = surrounding_box(nodes[sibling].box, nodes[leaf].box);
+	if (old_parent < 0) {
+		root = parent;
+	}
+	else if (nodes[old_parent].left == sibling) {
+		nodes[old_parent].left = parent;
+	}
+	else {
+		nodes[old_parent].right = parent;
+	}
+	nodes[sibling].parent = parent;
+	nodes[leaf].parent = parent;
+	refit_up(old_parent);
+}
+
+// Takes the leaf out and puts its sibling in the place of their parent
+void dynamic_bvh::remove_leaf(int leaf) {
+
+	if (leaf == root) {
+		root = -1;
+		return;
+	}
+	int parent = nodes[leaf].parent;
+	int grand = nodes[parent].parent;
+	int sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+	nodes[sibling].parent = grand;
+	if (grand < 0) {
+		root = sibling;
+	}
+	else {
+		if (nodes[grand].left == parent) nodes[grand].left = sibling;
+		else nodes[grand].right = sibling;
+	}
+	release(parent);
+	nodes[leaf].parent = -1;
+	refit_up(grand);
+}
+
+void dynamic_bvh::refit_up(int i) {
+
+	while (i >= 0) {
+		dynamic_node& n = nodes[i];
+		n.box = surrounding_box(nodes[n.left].box, nodes[n.right].box);
+		rotate(i);
+		i = n.parent;
+	}
+}
+
+// Swaps a child of i with a grandchild under its other child when that shrinks the node the
+// grandchild leaves, the best of the four swaps is taken. i's own box stays the same.
+void dynamic_bvh::rotate(int i) {
+
+	dynamic_node& n = nodes[i];
+	int best_child = -1, best_grand = -1;
+	float best_gain = 0;
+	for (int side = 0; side < 2; side++) {
+
+		int child = side ? n.right : n.left;
+		int other = side ? n.left : n.right;
+		if (nodes[other].leaf()) continue;
+		const dynamic_node& o = nodes[other];
+		float area = o.box.area();
+		// child takes the place of o.left, so o becomes o.right joined with child, and the other way
+		float gain_left = area - surrounding_box(nodes[child].box, nodes[o.right].box).area();
+		float gain_right = area - surrounding_box(nodes[child].box, nodes[o.left].box).area();
+		if (gain_left > best_gain) {
+			best_gain = gain_left;
+			best_child = child;
+			best_grand = o.left;
+		}
+		if (gain_right > best_gain) {
+			best_gain = gain_right;
+			best_child = child;
+			best_grand = o.right;
+		}
+	}
+	if (best_child < 0) return;
+
+	int other = n.left == best_child ? n.right : n.left;
+	dynamic_node& o = nodes[other];
+	if (n.left == best_child) n.left = best_grand;
+	else n.right = best_grand;
+	if (o.left == best_grand) o.left = best_child;
+	else o.right = best_child;
+	nodes[best_grand].parent = i;
+	nodes[best_child].parent = other;
+	o.box = surrounding_box(nodes[o.left].box, nodes[o.right].box);
+}
+
+// Entry distance of the ray into a box, false when it misses it within tmin to tmax
+inline bool dynamic_enter(const aabb& b, const vec3& origin, const vec3& inv_dir, float tmin, float tmax, float& t) {
+
+	STAT(STAT_BOX_TESTS);
+	for (int i = 0; i < 3; i++) {
+
+		float t0 = (b._min[i] - origin[i]) * inv_dir[i];
+		float t1 = (b._max[i] - origin[i]) * inv_dir[i];
+		if (inv_dir[i] < 0.0f) {
+			std::swap(t0, t1);
+		}
+		tmin = t0 > tmin ? t0 : tmin;
+		tmax = t1 < tmax ? t1 : tmax;
+		if (tmax <= tmin) {
+			return false;
+		}
+	}
+	t = tmin;
+	return true;
+}
+
+// Children nearer along the ray first, far ones are dropped once a hit is closer than them. The
+// rotations keep the tree shallow, but a long run of sorted inserts can still make a deep one, a
+// subtree that does not fit on the stack is walked by a call of its own.
+template<typename Leaf>
+bool dynamic_bvh::walk(int start, const ray& r, const vec3& inv_dir, float tmin, float& tmax, bool any, Leaf& leaf) const {
+
+	struct entry { int node; float t; };
+	const int capacity = 64;
+	entry stack[capacity];
+	int top = 0;
+	float t;
+	if (!dynamic_enter(nodes[start].box, r.origin(), inv_dir, tmin, tmax, t)) return false;
+	stack[top++] = { start, t };
+	bool hit = false;
+	while (top > 0) {
+
+		entry e = stack[--top];
+		if (e.t >= tmax) continue;
+		const dynamic_node& n = nodes[e.node];
+		STAT(STAT_BVH_NODES);
+		if (n.leaf()) {
+			if (leaf(n.item, tmax)) {
+				hit = true;
+				if (any) return true;
+			}
+			continue;
+		}
+		float tl, tr;
+		bool l = dynamic_enter(nodes[n.left].box, r.origin(), inv_dir, tmin, tmax, tl);
+		bool rr = dynamic_enter(nodes[n.right].box, r.origin(), inv_dir, tmin, tmax, tr);
+		if (l && rr) {
+			entry near_child = tl < tr ? entry{ n.left, tl } : entry{ n.right, tr };
+			entry far_child = tl < tr ? entry{ n.right, tr } : entry{ n.left, tl };
+			if (top + 2 > capacity) {
+				if (walk(far_child.node, r, inv_dir, tmin, tmax, any, leaf)) {
+					hit = true;
+					if (any) return true;
+				}
+			}
+			else {
+				stack[top++] = far_child;
+			}
+			stack[top++] = near_child;
+		}
+		else if (l) {
+			stack[top++] = { n.left, tl };
+		}
+		else if (rr) {
+			stack[top++] = { n.right, tr };
+		}
+	}
+	return hit;
+}
+
+bool dynamic_bvh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+
+	if (root < 0) return false;
+	vec3 inv_dir(1.0f / r.direction()[0], 1.0f / r.direction()[1], 1.0f / r.direction()[2]);
+	auto leaf = [&](hitable *item, float& tmax) {
+		if (!item->hit(r, t_min, tmax, rec)) return false;
+		tmax = rec.t;
+		return true;
+	};
+	return walk(root, r, inv_dir, t_min, t_max, false, leaf);
+}
+
+bool dynamic_bvh::occluded(const ray& r, float t_min, float t_max) const {
+
+	if (root < 0) return false;
+	vec3 inv_dir(1.0f / r.direction()[0], 1.0f / r.direction()[1], 1.0f / r.direction()[2]);
+	auto leaf = [&](hitable *item, float& tmax) {
+		return item->occluded(r, t_min, tmax);
+	};
+	return walk(root, r, inv_dir, t_min, t_max, true, leaf);
+}
+
+// Same measure as flat_bvh::sah_cost, so the two can be compared on the same items
+float dynamic_bvh::sah_cost() const {
+
+	if (root < 0) return 0;
+	float top = nodes[root].box.area();
+	if (top <= 0) return 0;
+	float cost = 0;
+	for (const dynamic_node& n : nodes) {
+		if (n.leaf() && !n.item) continue;
+		cost += n.box.area() / top;
+	}
+	return cost;
+}
+
+#endif
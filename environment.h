@@ -0,0 +1,183 @@
+#pragma once
+#ifndef ENVIRONMENTH
+#define ENVIRONMENTH
+
+#include "vec3.h"
+#include "stb_image.h"
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// A piecewise constant density on [0, 1) with one bin per function value
+struct distribution_1d {
+
+	distribution_1d(const float *f, int n) : func(f, f + n), cdf(n + 1) {
+
+		// summed in double so the last bins of a long row still add something
+		double sum = 0;
+		cdf[0] = 0;
+		for (int i = 0; i < n; i++) {
+			sum += double(func[i]) / n;
+			cdf[i + 1] = float(sum);
+		}
+		func_int = float(sum);
+		for (int i = 1; i <= n; i++) {
+			cdf[i] = func_int > 0 ? float(cdf[i] / func_int) : float(i) / n;
+		}
+		cdf[n] = 1;
+	}
+
+	int count() const { return int(func.size()); }
+
+	// A point distributed like func from u in [0, 1), with its density and bin
+	float sample(float u, float& pdf, int& offset) const {
+
+		offset = int(std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin()) - 1;
+		offset = std::max(0, std::min(offset, count() - 1));
+		float du = u - cdf[offset];
+		if (cdf[offset + 1] > cdf[offset]) du /= cdf[offset + 1] - cdf[offset];
+		pdf = func_int > 0 ? func[offset] / func_int : 1;
+		return std::min((offset + du) / count(), 0.99999994f);
+	}
+
+	std::vector<float> func, cdf;
+	float func_int;		// integral of func over [0, 1)
+};
+
+// A density on [0, 1)^2 over a grid of nu x nv values, row by row: v is picked from the marginal
+// over the rows, u from the row's own distribution
+struct distribution_2d {
+
+	distribution_2d(const float *f, int nu, int nv) {
+
+		std::vector<float> rows(nv);
+		conditional.reserve(nv);
+		for (int v = 0; v < nv; v++) {
+			conditional.push_back(distribution_1d(f + size_t(v) * nu, nu));
+			rows[v] = conditional[v].func_int;
+		}
+		marginal = new distribution_1d(rows.data(), nv);
+	}
+	~distribution_2d() { delete marginal; }
+
+	void sample(float u0, float u1, float& u, float& v, float& pdf) const {
+
+		float pdfs[2];
+		int row, column;
+		v = marginal->sample(u1, pdfs[1], row);
+		u = conditional[row].sample(u0, pdfs[0], column);
+		pdf = pdfs[0] * pdfs[1];
+	}
+
+	float pdf(float u, float v) const {
+
+		if (!(marginal->func_int > 0)) return 0;
+		int nu = conditional[0].count(), nv = marginal->count();
+		int iu = std::max(0, std::min(int(u * nu), nu - 1));
+		int iv = std::max(0, std::min(int(v * nv), nv - 1));
+		return conditional[iv].func[iu] / marginal->func_int;
+	}
+
+	std::vector<distribution_1d> conditional;
+	distribution_1d *marginal;
+};
+
+// Light from every direction out of a latitude-longitude map, the top row straight up and u
+// running around the y axis like the sphere textures. Rays that leave the scene look it up.
+// When sampled, diffuse surfaces also pick directions from a distribution of the map's
+// luminance times sin(theta), the solid angle of each row, so a sun a few pixels wide is found
+// by the direct samples rather than by chance.
+class environment_light {
+public:
+
+	// rgb is width x height pixels of three linear floats, top row first, copied
+	environment_light(const float *rgb, int _width, int _height, float _scale = 1) : pixels(rgb, rgb + size_t(_width) * _height * 3), width(_width), height(_height), scale(_scale), sampled(true) {
+
+		std::vector<float> weights(size_t(width) * height);
+		for (int j = 0; j < height; j++) {
+			float sin_theta = sinf(float(M_PI) * (j + 0.5f) / height);
+			for (int i = 0; i < width; i++) {
+				const float *p = &pixels[3 * (size_t(j) * width + i)];
+				weights[size_t(j) * width + i] = (0.2126f * p[0] + 0.7152f * p[1] + 0.0722f * p[2]) * sin_theta;
+			}
+		}
+		distribution = new distribution_2d(weights.data(), width, height);
+		sampled = distribution->marginal->func_int > 0;
+	}
+	~environment_light() { delete distribution; }
+
+	// A map in any format stbi_loadf reads, .hdr keeps its range. nullptr if it cannot be read.
+	static environment_light* load(const std::string& path, float scale = 1) {
+
+		int w, h, n;
+		float *rgb = stbi_loadf(path.c_str(), &w, &h, &n, 3);
+		if (!rgb) {
+			std::cerr << path << ": cannot load environment map" << std::endl;
+			return nullptr;
+		}
+		environment_light *e = new environment_light(rgb, w, h, scale);
+		stbi_image_free(rgb);
+		return e;
+	}
+
+	// Map coordinates of a unit direction
+	static void direction_uv(const vec3& d, float& u, float& v) {
+
+		u = 1 - (atan2f(d.z(), d.x()) + float(M_PI)) / (2 * float(M_PI));
+		v = acosf(ffmax(-1.0f, ffmin(1.0f, d.y()))) / float(M_PI);
+	}
+
+	vec3 radiance(const vec3& dir) const {
+
+		float u, v;
+		direction_uv(unit_vector(dir), u, v);
+		return lookup(u, v);
+	}
+
+	// A unit direction toward the map with its radiance and pdf per solid angle, 0 for none
+	vec3 sample(float u0, float u1, vec3& dir, float& pdf) const {
+
+		float u, v, map_pdf;
+		distribution->sample(u0, u1, u, v, map_pdf);
+		float theta = v * float(M_PI), phi = float(M_PI) - 2 * float(M_PI) * u;
+		float sin_theta = sinf(theta);
+		dir = vec3(sin_theta * cosf(phi), cosf(theta), sin_theta * sinf(phi));
+		pdf = sin_theta > 0 ? map_pdf / (2 * float(M_PI) * float(M_PI) * sin_theta) : 0;
+		return lookup(u, v);
+	}
+
+	// Density sample gives dir, per solid angle
+	float pdf(const vec3& dir) const {
+
+		vec3 d = unit_vector(dir);
+		float u, v;
+		direction_uv(d, u, v);
+		float sin_theta = sqrtf(ffmax(0.0f, 1 - d.y() * d.y()));
+		return sin_theta > 0 ? distribution->pdf(u, v) / (2 * float(M_PI) * float(M_PI) * sin_theta) : 0;
+	}
+
+	std::vector<float> pixels;
+	int width, height;
+	float scale;
+	bool sampled;	// diffuse surfaces sample the map, else only rays leaving the scene see it
+	distribution_2d *distribution;
+
+private:
+
+	vec3 lookup(float u, float v) const {
+
+		int i = std::max(0, std::min(int(u * width), width - 1));
+		int j = std::max(0, std::min(int(v * height), height - 1));
+		const float *p = &pixels[3 * (size_t(j) * width + i)];
+		return scale * vec3(p[0], p[1], p[2]);
+	}
+};
+
+// Weight of a sample from a strategy with density a against one with density b (Veach's power
+// heuristic with exponent 2)
+inline float power_heuristic(float a, float b) {
+	return a * a / (a * a + b * b);
+}
+
+#endif
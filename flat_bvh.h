@@ -0,0 +1,318 @@
+#pragma once
+#ifndef FLAT_BVHH
+#define FLAT_BVHH
+
+#include "hitable.h"
+#include "triangle.h"
+#include "perf_counters.h"
+#include "trace.h"
+#include "simd_kernels.h"
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+// BVH node of a flat tree, nodes are stored depth first so an inner node's first child follows it
+// and offset points at the second. Plain data without pointers, a tree can be used straight from a
+// mapped file (see bvh_cache.h).
+struct flat_node {
+
+	float bmin[3];
+	int32_t offset;		// second child, or first item of a leaf
+	float bmax[3];
+	int32_t count;		// items of a leaf, -1 - split axis for inner nodes
+
+	bool leaf() const { return count > 0; }
+	int axis() const { return -1 - count; }
+
+	// Both slabs of all three axes at once. Lane 3 of the loads holds offset and count, the ray's
+	// NaN there makes vmax and vmin keep tmin and tmax in it.
+	bool hit(const vec4f& origin, const vec4f& inv_dir, __m128 negative, float tmin, float tmax) const {
+
+		STAT(STAT_BOX_TESTS);
+		vec4f lo = vec4f::load(bmin), hi = vec4f::load(bmax);
+		vec4f t0 = (vselect(negative, hi, lo) - origin) * inv_dir;
+		vec4f t1 = (vselect(negative, lo, hi) - origin) * inv_dir;
+		return hmin(vmin(t1, vec4f(tmax))) > hmax(vmax(t0, vec4f(tmin)));
+	}
+};
+
+const int FLAT_LEAF_SIZE = 2;
+// Mesh leaves hold more triangles, simd().nearest_triangle tests them together
+const int MESH_LEAF_SIZE = 8;
+
+// Median split on the longest axis like bhv_node, items sorted by their box minimum
+int flat_build(const aabb *boxes, int32_t *order, int first, int n, int leaf_size, std::vector<flat_node>& nodes) {
+
+	int index = int(nodes.size());
+	nodes.push_back(flat_node());
+	aabb bounds = boxes[order[first]];
+	for (int i = first + 1; i < first + n; i++) {
+		bounds = surrounding_box(bounds, boxes[order[i]]);
+	}
+	for (int k = 0; k < 3; k++) {
+		nodes[index].bmin[k] = bounds.min()[k];
+		nodes[index].bmax[k] = bounds.max()[k];
+	}
+	if (n <= leaf_size) {
+		nodes[index].offset = first;
+		nodes[index].count = n;
+		return index;
+	}
+
+	int axis = bounds.longest_axis();
+	int half = n / 2;
+	std::nth_element(order + first, order + first + half, order + first + n, [&](int32_t a, int32_t b) {
+		return boxes[a].min()[axis] < boxes[b].min()[axis];
+	});
+	flat_build(boxes, order, first, half, leaf_size, nodes);
+	int second = flat_build(boxes, order, first + half, n - half, leaf_size, nodes);
+	nodes[index].offset = second;
+	nodes[index].count = -1 - axis;
+	return index;
+}
+
+// Tree over n boxes, leaves refer to order[offset .. offset + count) which holds box indices
+void build_flat_bvh(const aabb *boxes, int n, std::vector<flat_node>& nodes, std::vector<int32_t>& order, int leaf_size = FLAT_LEAF_SIZE) {
+
+	PERF_SCOPE("bvh build");
+	TRACE_SCOPE_OUTERMOST("bvh build");
+	order.resize(n);
+	for (int i = 0; i < n; i++) {
+		order[i] = i;
+	}
+	nodes.clear();
+	nodes.reserve(2 * size_t(n) / leaf_size + 1);
+	flat_build(boxes, order.data(), 0, n, leaf_size, nodes);
+}
+
+// Visits the leaves whose boxes the ray enters, nearer child first. leaf(first, count, tmax) tests
+// the leaf's items and returns whether one was hit, lowering tmax to it. any stops at the first hit.
+template<typename Leaf>
+bool flat_walk(const flat_node *nodes, const ray& r, float tmin, float tmax, bool any, Leaf leaf) {
+
+	vec3 inv_dir(1.0f / r.direction()[0], 1.0f / r.direction()[1], 1.0f / r.direction()[2]);
+	vec4f origin(r.origin()), inv(inv_dir, std::numeric_limits<float>::quiet_NaN());
+	__m128 negative = _mm_cmplt_ps(inv.v, _mm_setzero_ps());
+	int stack[64];
+	int top = 0;
+	int node = 0;
+	bool hit = false;
+	for (;;) {
+
+		const flat_node& n = nodes[node];
+		STAT(STAT_BVH_NODES);
+		if (n.hit(origin, inv, negative, tmin, tmax)) {
+
+			if (!n.leaf()) {
+				if (inv_dir[n.axis()] < 0.0f) {
+					stack[top++] = node + 1;
+					node = n.offset;
+				}
+				else {
+					stack[top++] = n.offset;
+					node = node + 1;
+				}
+				continue;
+			}
+			if (leaf(n.offset, n.count, tmax)) {
+				hit = true;
+				if (any) {
+					return true;
+				}
+			}
+		}
+		if (top == 0) {
+			return hit;
+		}
+		node = stack[--top];
+	}
+}
+
+// BVH over a list of hitables, the tree and the order only index into the list. The tree may be
+// read-only (a mapped cache), refit and rebuild copy it first, into the arena open at the time.
+class flat_bvh : public hitable {
+
+public:
+	flat_bvh(const flat_node *_nodes, int _n_nodes, const int32_t *_order, hitable **_list, int _n_items)
+		: nodes(_nodes), n_nodes(_n_nodes), order(_order), list(_list), n_items(_n_items), own_nodes(nullptr), own_order(nullptr) {}
+
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const;
+	virtual bool bounding_box(float t0, float t1, aabb& b) const {
+		b = aabb(vec3(nodes[0].bmin[0], nodes[0].bmin[1], nodes[0].bmin[2]), vec3(nodes[0].bmax[0], nodes[0].bmax[1], nodes[0].bmax[2]));
+		return true;
+	}
+
+	void writable();
+	void refit();
+	void rebuild();
+	float sah_cost() const;
+
+	const flat_node *nodes;
+	int n_nodes;
+	const int32_t *order;
+	hitable **list;
+	int n_items;
+	flat_node *own_nodes;	// room for 2 * n_items - 1 nodes, as many as a tree over them can have
+	int32_t *own_order;
+};
+
+bool flat_bvh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+
+	return flat_walk(nodes, r, t_min, t_max, false, [&](int first, int count, float& tmax) {
+		bool hit = false;
+		for (int i = first; i < first + count; i++) {
+			if (list[order[i]]->hit(r, t_min, tmax, rec)) {
+				tmax = rec.t;
+				hit = true;
+			}
+		}
+		return hit;
+	});
+}
+
+bool flat_bvh::occluded(const ray& r, float t_min, float t_max) const {
+
+	return flat_walk(nodes, r, t_min, t_max, true, [&](int first, int count, float& tmax) {
+		for (int i = first; i < first + count; i++) {
+			if (list[order[i]]->occluded(r, t_min, tmax)) return true;
+		}
+		return false;
+	});
+}
+
+// Copies the tree and the order to storage of its own, once, so rebuilds reuse it
+void flat_bvh::writable() {
+
+	if (own_nodes) return;
+	own_nodes = arena_array<flat_node>(std::max(2 * n_items - 1, n_nodes));
+	own_order = arena_array<int32_t>(n_items);
+	std::copy(nodes, nodes + n_nodes, own_nodes);
+	std::copy(order, order + (n_nodes ? n_items : 0), own_order);
+	nodes = own_nodes;
+	order = own_order;
+}
+
+// Recomputes every node's box from the items' current boxes, keeping the tree. Children come
+// after their parent, so one backwards pass goes bottom-up.
+void flat_bvh::refit() {
+
+	writable();
+	flat_node *n = own_nodes;
+	for (int i = n_nodes - 1; i >= 0; i--) {
+
+		aabb b;
+		if (n[i].leaf()) {
+			list[order[n[i].offset]]->bounding_box(0, 1, b);
+			for (int k = n[i].offset + 1; k < n[i].offset + n[i].count; k++) {
+				aabb item;
+				list[order[k]]->bounding_box(0, 1, item);
+				b = surrounding_box(b, item);
+			}
+		}
+		else {
+			const flat_node& l = n[i + 1];
+			const flat_node& r = n[n[i].offset];
+			b = surrounding_box(aabb(vec3(l.bmin[0], l.bmin[1], l.bmin[2]), vec3(l.bmax[0], l.bmax[1], l.bmax[2])),
+				aabb(vec3(r.bmin[0], r.bmin[1], r.bmin[2]), vec3(r.bmax[0], r.bmax[1], r.bmax[2])));
+		}
+		for (int k = 0; k < 3; k++) {
+			n[i].bmin[k] = b.min()[k];
+			n[i].bmax[k] = b.max()[k];
+		}
+	}
+}
+
+// A new tree over the items where they are now
+void flat_bvh::rebuild() {
+
+	std::vector<aabb> boxes(n_items);
+	for (int i = 0; i < n_items; i++) {
+		list[i]->bounding_box(0, 1, boxes[i]);
+	}
+	std::vector<flat_node> built;
+	std::vector<int32_t> built_order;
+	build_flat_bvh(boxes.data(), n_items, built, built_order);
+	writable();
+	std::copy(built.begin(), built.end(), own_nodes);
+	std::copy(built_order.begin(), built_order.end(), own_order);
+	n_nodes = int(built.size());
+}
+
+// Surface area heuristic of the tree relative to its root, a node costs one traversal step and a
+// leaf one test per item. Refitting moving items grows it, the ratio to the cost right after a
+// build tells when a rebuild pays.
+float flat_bvh::sah_cost() const {
+
+	auto area = [](const flat_node& n) {
+		float a = n.bmax[0] - n.bmin[0], b = n.bmax[1] - n.bmin[1], c = n.bmax[2] - n.bmin[2];
+		return 2 * (a * b + b * c + c * a);
+	};
+	float root = area(nodes[0]);
+	if (root <= 0) return 0;
+	float cost = 0;
+	for (int i = 0; i < n_nodes; i++) {
+		cost += area(nodes[i]) / root * (nodes[i].leaf() ? nodes[i].count : 1);
+	}
+	return cost;
+}
+
+// Triangles stored as three vertices each in leaf order, so leaves index them directly and no
+// triangle objects exist. hit keeps the triangle index in rec.index, the barycentrics are
+// recomputed for the closest hit only.
+class triangle_mesh : public hitable {
+
+public:
+	triangle_mesh(const flat_node *_nodes, const vec3 *_vertices, material *m) : nodes(_nodes), vertices(_vertices), mat_ptr(m) {}
+
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const;
+	virtual void compute_surface_interaction(const ray& r, hit_record& rec) const;
+	virtual bool bounding_box(float t0, float t1, aabb& b) const {
+		b = aabb(vec3(nodes[0].bmin[0], nodes[0].bmin[1], nodes[0].bmin[2]), vec3(nodes[0].bmax[0], nodes[0].bmax[1], nodes[0].bmax[2]));
+		return true;
+	}
+
+	const flat_node *nodes;
+	const vec3 *vertices;
+	material *mat_ptr;
+};
+
+bool triangle_mesh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+
+	nearest_triangle_fn nearest = simd().nearest_triangle;
+	bool hit = flat_walk(nodes, r, t_min, t_max, false, [&](int first, int count, float& tmax) {
+		int i = nearest(vertices + 3 * size_t(first), count, r, t_min, tmax);
+		if (i < 0) return false;
+		rec.t = tmax;
+		rec.index = first + i;
+		return true;
+	});
+	if (hit) {
+		rec.obj = this;
+	}
+	return hit;
+}
+
+bool triangle_mesh::occluded(const ray& r, float t_min, float t_max) const {
+
+	nearest_triangle_fn nearest = simd().nearest_triangle;
+	return flat_walk(nodes, r, t_min, t_max, true, [&](int first, int count, float& tmax) {
+		return nearest(vertices + 3 * size_t(first), count, r, t_min, tmax) >= 0;
+	});
+}
+
+void triangle_mesh::compute_surface_interaction(const ray& r, hit_record& rec) const {
+
+	const vec3 *v = vertices + 3 * size_t(rec.index);
+	float t, u = 0, w = 0;
+	triangle::intersect(v[0], v[1], v[2], r, -FLT_MAX, FLT_MAX, t, u, w);
+	rec.u = u;
+	rec.v = w;
+	rec.p = r.point_at_parameter(rec.t);
+	rec.mat_ptr = mat_ptr;
+	rec.normal = unit_vector(cross(v[1] - v[0], v[2] - v[0]));
+}
+
+#endif
@@ -0,0 +1,345 @@
+#pragma once
+#ifndef GRID_MEDIUMH
+#define GRID_MEDIUMH
+
+#include "hitable.h"
+#include "material.h"
+#include "perlin.h"
+#include <vector>
+
+// Voxel densities of a heterogeneous medium, voxel() returns 0 outside the grid
+class density_grid {
+public:
+	virtual float voxel(int x, int y, int z) const = 0;
+	virtual size_t memory() const = 0;
+
+	// Trilinear lookup at grid coordinates g, voxel centers sit at integer + 0.5
+	float sample(const vec3& g) const {
+
+		float gx = g.x() - 0.5f;
+		float gy = g.y() - 0.5f;
+		float gz = g.z() - 0.5f;
+		int x0 = int(floor(gx));
+		int y0 = int(floor(gy));
+		int z0 = int(floor(gz));
+		float fx = gx - x0;
+		float fy = gy - y0;
+		float fz = gz - z0;
+		float accum = 0;
+		for (int i = 0; i < 2; i++) {
+			for (int j = 0; j < 2; j++) {
+				for (int k = 0; k < 2; k++) {
+					accum += (i ? fx : 1 - fx) * (j ? fy : 1 - fy) * (k ? fz : 1 - fz) * voxel(x0 + i, y0 + j, z0 + k);
+				}
+			}
+		}
+		return accum;
+	}
+
+	int nx, ny, nz;
+};
+
+class dense_grid : public density_grid {
+public:
+	// zeroed voxels in the current arena, or in data when given
+	dense_grid(int _nx, int _ny, int _nz, float *_data = nullptr) {
+		nx = _nx;
+		ny = _ny;
+		nz = _nz;
+		data = _data ? _data : arena_array<float>(size_t(nx) * ny * nz);
+	}
+
+	virtual float voxel(int x, int y, int z) const {
+		if (x < 0 || y < 0 || z < 0 || x >= nx || y >= ny || z >= nz) return 0;
+		return data[(size_t(z) * ny + y) * nx + x];
+	}
+	virtual size_t memory() const {
+		return size_t(nx) * ny * nz * sizeof(float);
+	}
+	float& at(int x, int y, int z) {
+		return data[(size_t(z) * ny + y) * nx + x];
+	}
+
+	float *data;
+};
+
+// Only stores the BRICK^3 blocks of a dense grid that contain any density
+class sparse_grid : public density_grid {
+public:
+	static const int BRICK = 8;
+
+	sparse_grid(const dense_grid& g) {
+
+		nx = g.nx;
+		ny = g.ny;
+		nz = g.nz;
+		bx = (nx + BRICK - 1) / BRICK;
+		by = (ny + BRICK - 1) / BRICK;
+		bz = (nz + BRICK - 1) / BRICK;
+		bricks = arena_array<int>(bx * by * bz);
+		n_bricks = 0;
+		for (int i = 0; i < bx * by * bz; i++) {
+			bricks[i] = brick_empty(g, i % bx, (i / bx) % by, i / (bx * by)) ? -1 : n_bricks++;
+		}
+		data = arena_array<float>(size_t(n_bricks) * BRICK * BRICK * BRICK);
+		for (int i = 0; i < bx * by * bz; i++) {
+
+			if (bricks[i] < 0) continue;
+			float *dst = data + size_t(bricks[i]) * BRICK * BRICK * BRICK;
+			int ox = (i % bx) * BRICK, oy = ((i / bx) % by) * BRICK, oz = (i / (bx * by)) * BRICK;
+			for (int z = 0; z < BRICK; z++)
+				for (int y = 0; y < BRICK; y++)
+					for (int x = 0; x < BRICK; x++)
+						*dst++ = g.voxel(ox + x, oy + y, oz + z);
+		}
+	}
+
+	virtual float voxel(int x, int y, int z) const {
+		if (x < 0 || y < 0 || z < 0 || x >= nx || y >= ny || z >= nz) return 0;
+		int b = bricks[((z / BRICK) * by + y / BRICK) * bx + x / BRICK];
+		if (b < 0) return 0;
+		return data[size_t(b) * BRICK * BRICK * BRICK + ((z % BRICK) * BRICK + y % BRICK) * BRICK + x % BRICK];
+	}
+	virtual size_t memory() const {
+		return size_t(bx) * by * bz * sizeof(int) + size_t(n_bricks) * BRICK * BRICK * BRICK * sizeof(float);
+	}
+
+	static bool brick_empty(const dense_grid& g, int cx, int cy, int cz) {
+		for (int z = cz * BRICK; z < (cz + 1) * BRICK; z++)
+			for (int y = cy * BRICK; y < (cy + 1) * BRICK; y++)
+				for (int x = cx * BRICK; x < (cx + 1) * BRICK; x++)
+					if (g.voxel(x, y, z) > 0) return false;
+		return true;
+	}
+
+	int bx, by, bz;
+	int n_bricks;
+	int *bricks;
+	float *data;
+};
+
+// Grid medium inside an axis aligned box. Free flights are sampled with delta tracking
+// against a coarse majorant grid that is walked with a 3D DDA, so empty cells cost nothing.
+class grid_medium : public hitable {
+public:
+	grid_medium(density_grid *g, const aabb& _bounds, float _scale, texture *a, int majorant_cell = 8);
+
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const {
+		float t;
+		return sample_distance(r, t_min, t_max, t);
+	}
+	virtual bool bounding_box(float t0, float t1, aabb& box) const {
+		box = bounds;
+		return true;
+	}
+
+	bool sample_distance(const ray& r, float t_min, float t_max, float& t) const;
+	float transmittance(const ray& r, float t_min, float t_max) const;
+	float density(const vec3& p) const {
+		return scale * grid->sample((p - bounds.min()) * voxel_scale);
+	}
+
+	template<typename Callable>
+	bool traverse(const ray& r, float t_min, float t_max, Callable func) const;
+
+	density_grid *grid;
+	aabb bounds;
+	float scale;
+	material *phase_function;
+	vec3 voxel_scale;	// world -> voxel coordinates
+	vec3 cell_size;		// world size of one majorant cell
+	int mx, my, mz;
+	float *majorant;
+};
+
+grid_medium::grid_medium(density_grid *g, const aabb& _bounds, float _scale, texture *a, int majorant_cell) : grid(g), bounds(_bounds), scale(_scale) {
+
+	phase_function = new isotropic(a);
+	vec3 extent = bounds.max() - bounds.min();
+	voxel_scale = vec3(g->nx, g->ny, g->nz) / extent;
+	mx = (g->nx + majorant_cell - 1) / majorant_cell;
+	my = (g->ny + majorant_cell - 1) / majorant_cell;
+	mz = (g->nz + majorant_cell - 1) / majorant_cell;
+	cell_size = vec3(majorant_cell, majorant_cell, majorant_cell) / voxel_scale;
+	majorant = arena_array<float>(mx * my * mz);
+	for (int z = 0; z < mz; z++) {
+		for (int y = 0; y < my; y++) {
+			for (int x = 0; x < mx; x++) {
+
+				// one voxel of padding, trilinear lookups reach into the neighbours
+				float m = 0;
+				for (int k = z * majorant_cell - 1; k <= (z + 1) * majorant_cell; k++)
+					for (int j = y * majorant_cell - 1; j <= (y + 1) * majorant_cell; j++)
+						for (int i = x * majorant_cell - 1; i <= (x + 1) * majorant_cell; i++)
+							m = ffmax(m, g->voxel(i, j, k));
+				majorant[(z * my + y) * mx + x] = m * scale;
+			}
+		}
+	}
+}
+
+// Walks the majorant cells the ray overlaps inside the bounds, calling func(majorant, t0, t1)
+// front to back until it returns true
+template<typename Callable>
+bool grid_medium::traverse(const ray& r, float t_min, float t_max, Callable func) const {
+
+	vec3 o = r.origin();
+	vec3 d = r.direction();
+	for (int a = 0; a < 3; a++) {
+
+		float invD = 1.0f / d[a];
+		float t0 = (bounds.min()[a] - o[a]) * invD;
+		float t1 = (bounds.max()[a] - o[a]) * invD;
+		if (invD < 0.0f) {
+			std::swap(t0, t1);
+		}
+		t_min = ffmax(t0, t_min);
+		t_max = ffmin(t1, t_max);
+		if (t_max <= t_min) {
+			return false;
+		}
+	}
+
+	int res[3] = { mx, my, mz };
+	int cell[3], step[3];
+	float next[3], delta[3];
+	vec3 entry = (r.point_at_parameter(t_min) - bounds.min()) / cell_size;
+	for (int a = 0; a < 3; a++) {
+
+		cell[a] = std::min(std::max(int(entry[a]), 0), res[a] - 1);
+		if (d[a] > 0) {
+			step[a] = 1;
+			next[a] = (bounds.min()[a] + (cell[a] + 1) * cell_size[a] - o[a]) / d[a];
+			delta[a] = cell_size[a] / d[a];
+		}
+		else if (d[a] < 0) {
+			step[a] = -1;
+			next[a] = (bounds.min()[a] + cell[a] * cell_size[a] - o[a]) / d[a];
+			delta[a] = -cell_size[a] / d[a];
+		}
+		else {
+			step[a] = 0;
+			next[a] = FLT_MAX;
+			delta[a] = FLT_MAX;
+		}
+	}
+
+	float t = t_min;
+	while (true) {
+
+		int a = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+		float t_exit = ffmin(next[a], t_max);
+		float m = majorant[(cell[2] * my + cell[1]) * mx + cell[0]];
+		if (m > 0 && func(m, t, t_exit)) {
+			return true;
+		}
+		if (t_exit >= t_max) {
+			return false;
+		}
+		t = t_exit;
+		cell[a] += step[a];
+		next[a] += delta[a];
+		if (cell[a] < 0 || cell[a] >= res[a]) {
+			return false;
+		}
+	}
+}
+
+// Delta tracking, t is only written when a real collision happens inside (t_min, t_max)
+bool grid_medium::sample_distance(const ray& r, float t_min, float t_max, float& t) const {
+
+	STAT(STAT_MEDIUM_TESTS);
+	float len = r.direction().length();
+	return traverse(r, t_min, t_max, [&](float m, float t0, float t1) {
+
+		// free flights are memoryless, so each cell restarts at its entry
+		float s = t0;
+		while (true) {
+			s -= math_log(1 - random_float()) / (m * len);
+			if (s >= t1) {
+				return false;
+			}
+			if (random_float() * m < density(r.point_at_parameter(s))) {
+				t = s;
+				return true;
+			}
+		}
+	});
+}
+
+// Ratio tracking estimate of the transmittance along (t_min, t_max)
+float grid_medium::transmittance(const ray& r, float t_min, float t_max) const {
+
+	float len = r.direction().length();
+	float tr = 1;
+	traverse(r, t_min, t_max, [&](float m, float t0, float t1) {
+
+		float s = t0;
+		while (true) {
+			s -= math_log(1 - random_float()) / (m * len);
+			if (s >= t1) {
+				return false;
+			}
+			tr *= 1 - density(r.point_at_parameter(s)) / m;
+		}
+	});
+	return tr;
+}
+
+bool grid_medium::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+
+	if (sample_distance(r, t_min, t_max, rec.t)) {
+		STAT(STAT_VOLUME_HITS);
+		rec.p = r.point_at_parameter(rec.t);
+		rec.normal = vec3(1, 0, 0);  // arbitrary
+		rec.u = 0;
+		rec.v = 0;
+		rec.mat_ptr = phase_function;
+		rec.obj = nullptr;
+		return true;
+	}
+	return false;
+}
+
+// Procedural smoke plume, turbulent density that thins out with height and radius
+void fill_smoke_grid(dense_grid& g) {
+
+	perlin noise;
+	int n = g.nx;
+	for (int z = 0; z < n; z++) {
+		for (int y = 0; y < n; y++) {
+			for (int x = 0; x < n; x++) {
+
+				vec3 p = (vec3(x, y, z) + vec3(0.5, 0.5, 0.5)) / float(n);
+				float h = p.y();
+				float rx = p.x() - 0.5f - 0.1f * sin(6 * h);
+				float rz = p.z() - 0.5f;
+				float radius = 0.1f + 0.25f * h;
+				float falloff = 1 - sqrt(rx * rx + rz * rz) / radius;
+				if (falloff <= 0 || h > 0.95f) continue;
+				float d = falloff * (1 - h) * noise.turb(p * 6, 5) * 2;
+				g.at(x, y, z) = d > 0.05f ? d : 0;
+			}
+		}
+	}
+}
+
+// The plume on an n^3 grid in the current arena
+dense_grid* make_smoke_grid(int n) {
+
+	dense_grid *g = arena_new<dense_grid>(n, n, n);
+	fill_smoke_grid(*g);
+	return g;
+}
+
+// The plume's bricks in the current arena, the dense grid it is made from is freed again
+sparse_grid* make_sparse_smoke_grid(int n) {
+
+	std::vector<float> voxels(size_t(n) * n * n);
+	dense_grid dense(n, n, n, voxels.data());
+	fill_smoke_grid(dense);
+	return arena_new<sparse_grid>(dense);
+}
+
+#endif
@@ -0,0 +1,243 @@
+#pragma once
+#ifndef HDR_OUTPUTH
+#define HDR_OUTPUTH
+
+#include <condition_variable>
+#include <iostream>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+// Float layers of a render, top row first. beauty is the linear mean radiance before gamma and
+// clamping, albedo, normal and depth are those of the first hit averaged over the samples that
+// hit something (depth is FLT_MAX where none did), variance is that of the pixel mean per channel.
+struct image_layers {
+
+	image_layers(int w, int h) : width(w), height(h), beauty(size_t(w) * h * 3), albedo(size_t(w) * h * 3), normal(size_t(w) * h * 3),
+		depth(size_t(w) * h), samples(size_t(w) * h), variance(size_t(w) * h * 3) {}
+
+	int width, height;
+	std::vector<float> beauty, albedo, normal, depth, samples, variance;
+};
+
+// Portable float map, rows bottom first as the format wants. channels is 1 or 3.
+bool write_pfm(const std::string& path, int w, int h, int channels, const float *data) {
+
+	FILE *f = fopen(path.c_str(), "wb");
+	if (!f) return false;
+	// a negative scale says little endian
+	fprintf(f, "%s\n%d %d\n-1.0\n", channels == 3 ? "PF" : "Pf", w, h);
+	for (int y = h - 1; y >= 0; y--) {
+		fwrite(data + size_t(y) * w * channels, sizeof(float), size_t(w) * channels, f);
+	}
+	bool ok = ferror(f) == 0;
+	fclose(f);
+	return ok;
+}
+
+struct exr_channel {
+	std::string name;
+	const float *data;	// one value per pixel, top row first
+	int stride;			// floats from one pixel to the next
+	int offset;			// of this channel in a pixel
+};
+
+// OpenEXR scanline file, uncompressed, 32 bit float channels. Layers follow the usual
+// "layer.channel" naming, so compositing tools show albedo.R and so on grouped.
+bool write_exr(const std::string& path, int w, int h, std::vector<exr_channel> channels) {
+
+	FILE *f = fopen(path.c_str(), "wb");
+	if (!f) return false;
+	std::sort(channels.begin(), channels.end(), [](const exr_channel& a, const exr_channel& b) { return a.name < b.name; });
+
+	std::vector<char> header;
+	auto put = [&](const void *p, size_t n) { header.insert(header.end(), (const char*)p, (const char*)p + n); };
+	auto put_i32 = [&](int32_t v) { put(&v, 4); };
+	auto put_str = [&](const std::string& s) { put(s.c_str(), s.size() + 1); };
+	auto attribute = [&](const std::string& name, const std::string& type, int32_t size) {
+		put_str(name);
+		put_str(type);
+		put_i32(size);
+	};
+	const uint8_t magic[8] = { 0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0 };
+	put(magic, 8);
+
+	int32_t list_size = 1;
+	for (const exr_channel& c : channels) list_size += int32_t(c.name.size()) + 1 + 16;
+	attribute("channels", "chlist", list_size);
+	for (const exr_channel& c : channels) {
+		put_str(c.name);
+		put_i32(2);				// float
+		put_i32(0);				// pLinear and reserved
+		put_i32(1);				// x and y sampling
+		put_i32(1);
+	}
+	header.push_back(0);
+	attribute("compression", "compression", 1);
+	header.push_back(0);
+	int32_t window[4] = { 0, 0, w - 1, h - 1 };
+	attribute("dataWindow", "box2i", 16);
+	put(window, 16);
+	attribute("displayWindow", "box2i", 16);
+	put(window, 16);
+	attribute("lineOrder", "lineOrder", 1);
+	header.push_back(0);
+	float aspect = 1, center[2] = { 0, 0 };
+	attribute("pixelAspectRatio", "float", 4);
+	put(&aspect, 4);
+	attribute("screenWindowCenter", "v2f", 8);
+	put(center, 8);
+	attribute("screenWindowWidth", "float", 4);
+	put(&aspect, 4);
+	header.push_back(0);
+
+	// one line per block, the offset table comes right after the header
+	size_t line_bytes = size_t(w) * 4 * channels.size();
+	uint64_t at = header.size() + size_t(h) * 8;
+	std::vector<uint64_t> offsets(h);
+	for (int y = 0; y < h; y++) {
+		offsets[y] = at;
+		at += 8 + line_bytes;
+	}
+	fwrite(header.data(), 1, header.size(), f);
+	fwrite(offsets.data(), 8, offsets.size(), f);
+
+	std::vector<float> line(size_t(w) * channels.size());
+	for (int y = 0; y < h; y++) {
+		int32_t block[2] = { y, int32_t(line_bytes) };
+		fwrite(block, 4, 2, f);
+		for (size_t c = 0; c < channels.size(); c++) {
+			const exr_channel& ch = channels[c];
+			for (int x = 0; x < w; x++) {
+				line[c * w + x] = ch.data[(size_t(y) * w + x) * ch.stride + ch.offset];
+			}
+		}
+		fwrite(line.data(), 4, line.size(), f);
+	}
+	bool ok = ferror(f) == 0;
+	fclose(f);
+	return ok;
+}
+
+// formats is a comma separated list of exr (every layer in one file), pfm (a file per layer) and
+// hdr (the beauty layer as Radiance RGBE). Files go to _ImgOutput/name.*, false when one of them
+// could not be written.
+bool write_layers(const image_layers& l, const std::string& name, const std::string& formats) {
+
+	std::string base = "_ImgOutput/" + name;
+	int w = l.width, h = l.height;
+	bool ok = true;
+	auto written = [&](bool done, const std::string& path) {
+		if (!done) std::cerr << path << ": cannot write" << std::endl;
+		ok = ok && done;
+		return done;
+	};
+	if (formats.find("exr") != std::string::npos) {
+		std::vector<exr_channel> channels;
+		const char *rgb[3] = { "R", "G", "B" };
+		for (int k = 0; k < 3; k++) {
+			channels.push_back({ rgb[k], l.beauty.data(), 3, k });
+			channels.push_back({ std::string("albedo.") + rgb[k], l.albedo.data(), 3, k });
+			channels.push_back({ std::string("variance.") + rgb[k], l.variance.data(), 3, k });
+		}
+		const char *xyz[3] = { "X", "Y", "Z" };
+		for (int k = 0; k < 3; k++) {
+			channels.push_back({ std::string("normal.") + xyz[k], l.normal.data(), 3, k });
+		}
+		channels.push_back({ "depth.Z", l.depth.data(), 1, 0 });
+		channels.push_back({ "samples.Y", l.samples.data(), 1, 0 });
+		if (written(write_exr(base + ".exr", w, h, channels), base + ".exr")) {
+			std::cout << "Wrote EXR: " << name << ".exr" << std::endl;
+		}
+	}
+	if (formats.find("pfm") != std::string::npos) {
+		struct { const char *suffix; int channels; const float *data; } pfms[] = {
+			{ "", 3, l.beauty.data() }, { "_albedo", 3, l.albedo.data() }, { "_normal", 3, l.normal.data() },
+			{ "_depth", 1, l.depth.data() }, { "_samples", 1, l.samples.data() }, { "_variance", 3, l.variance.data() }
+		};
+		bool all = true;
+		for (const auto& p : pfms) {
+			std::string path = base + p.suffix + ".pfm";
+			all = written(write_pfm(path, w, h, p.channels, p.data), path) && all;
+		}
+		if (all) {
+			std::cout << "Wrote PFM: " << name << ".pfm and layers" << std::endl;
+		}
+	}
+	if (formats.find("hdr") != std::string::npos) {
+		if (written(stbi_write_hdr((base + ".hdr").c_str(), w, h, 3, l.beauty.data()) != 0, base + ".hdr")) {
+			std::cout << "Wrote HDR: " << name << ".hdr" << std::endl;
+		}
+	}
+	return ok;
+}
+
+// One thread that runs jobs in order, so files are encoded and written while the next render
+// runs. wait returns once every job handed in so far is done.
+class background_writer {
+
+public:
+	background_writer() : pending(0), stopping(false), worker([this]() { run(); }) {}
+	~background_writer() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		worker.join();
+	}
+
+	void submit(std::function<void()> job) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push(job);
+			pending++;
+		}
+		wake.notify_all();
+	}
+
+	void wait() {
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this]() { return pending == 0; });
+	}
+
+	static background_writer& shared() {
+		static background_writer writer;
+		return writer;
+	}
+
+private:
+	void run() {
+		for (;;) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+				if (jobs.empty()) return;
+				job = jobs.front();
+				jobs.pop();
+			}
+			job();
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				pending--;
+			}
+			done.notify_all();
+		}
+	}
+
+	std::mutex mutex;
+	std::condition_variable wake, done;
+	std::queue<std::function<void()> > jobs;
+	int pending;
+	bool stopping;
+	std::thread worker;
+};
+
+#endif
@@ -0,0 +1,227 @@
+#pragma once
+#ifndef HEIGHTFIELDH
+#define HEIGHTFIELDH
+
+#include "hitable.h"
+#include "box.h"
+
+// Grid of nx * nz axis aligned columns standing on y0, cell (i, j) spans
+// [x0 + i * cell, x0 + (i + 1) * cell] x [y0, height(i, j)] x [z0 + j * cell, z0 + (j + 1) * cell].
+// Rays walk the cells with a 2D DDA, a coarse grid of per-tile maximum heights lets them
+// skip whole tiles they pass over.
+class heightfield : public hitable {
+public:
+	heightfield(float _x0, float _z0, float _cell, int _nx, int _nz, float _y0, float *_heights, material *m, int _tile = 16);
+
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const {
+		float t;
+		int face;
+		return intersect(r, t_min, t_max, t, face);
+	}
+	virtual void compute_surface_interaction(const ray& r, hit_record& rec) const;
+	virtual bool bounding_box(float t0, float t1, aabb& box) const {
+		box = aabb(vec3(x0, y0, z0), vec3(x0 + nx * cell, max_height, z0 + nz * cell));
+		return true;
+	}
+
+	float height(int i, int j) const { return heights[size_t(j) * nx + i]; }
+
+	bool intersect(const ray& r, float t_min, float t_max, float& t, int& face) const;
+
+	template<typename Callable>
+	bool walk(const ray& r, float t_start, float t_end, int enter_axis, int exit_axis, int i0, int j0, int ni, int nj, float size, Callable func) const;
+
+	float x0, z0, cell, y0;
+	int nx, nz;
+	float *heights;
+	material *mat_ptr;
+	int tile, tiles_x, tiles_z;
+	float *tile_max;
+	float max_height;
+};
+
+heightfield::heightfield(float _x0, float _z0, float _cell, int _nx, int _nz, float _y0, float *_heights, material *m, int _tile) : x0(_x0), z0(_z0), cell(_cell), y0(_y0), nx(_nx), nz(_nz), heights(_heights), mat_ptr(m), tile(_tile) {
+
+	tiles_x = (nx + tile - 1) / tile;
+	tiles_z = (nz + tile - 1) / tile;
+	tile_max = arena_array<float>(size_t(tiles_x) * tiles_z);
+	max_height = y0;
+	for (int tj = 0; tj < tiles_z; tj++) {
+		for (int ti = 0; ti < tiles_x; ti++) {
+
+			float m = y0;
+			for (int j = tj * tile; j < std::min((tj + 1) * tile, nz); j++)
+				for (int i = ti * tile; i < std::min((ti + 1) * tile, nx); i++)
+					m = ffmax(m, height(i, j));
+			tile_max[size_t(tj) * tiles_x + ti] = m;
+			max_height = ffmax(max_height, m);
+		}
+	}
+}
+
+// 2D DDA over the ni * nj cells of edge length size whose first cell is fine cell (i0, j0).
+// Calls func(i, j, t_enter, t_exit, enter_axis, exit_axis) front to back until it returns true.
+template<typename Callable>
+bool heightfield::walk(const ray& r, float t_start, float t_end, int enter_axis, int exit_axis, int i0, int j0, int ni, int nj, float size, Callable func) const {
+
+	float o[2] = { r.origin().x(), r.origin().z() };
+	float d[2] = { r.direction().x(), r.direction().z() };
+	float base[2] = { x0 + i0 * cell, z0 + j0 * cell };
+	int res[2] = { ni, nj };
+	vec3 p = r.point_at_parameter(t_start);
+	float entry[2] = { p.x(), p.z() };
+	int c[2], step[2];
+	float next[2], delta[2];
+	for (int a = 0; a < 2; a++) {
+
+		c[a] = std::min(std::max(int(floor((entry[a] - base[a]) / size)), 0), res[a] - 1);
+		if (d[a] > 0) {
+			step[a] = 1;
+			next[a] = (base[a] + (c[a] + 1) * size - o[a]) / d[a];
+			delta[a] = size / d[a];
+		}
+		else if (d[a] < 0) {
+			step[a] = -1;
+			next[a] = (base[a] + c[a] * size - o[a]) / d[a];
+			delta[a] = -size / d[a];
+		}
+		else {
+			step[a] = 0;
+			next[a] = FLT_MAX;
+			delta[a] = FLT_MAX;
+		}
+	}
+
+	float t = t_start;
+	while (true) {
+
+		int a = next[0] < next[1] ? 0 : 1;
+		bool last = next[a] >= t_end;
+		float t_exit = last ? t_end : next[a];
+		if (func(i0 + c[0], j0 + c[1], t, t_exit, enter_axis, last ? exit_axis : a * 2)) {
+			return true;
+		}
+		if (last) {
+			return false;
+		}
+		t = t_exit;
+		enter_axis = a * 2;
+		c[a] += step[a];
+		next[a] += delta[a];
+		if (c[a] < 0 || c[a] >= res[a]) {
+			return false;
+		}
+	}
+}
+
+// Closest column surface inside (t_min, t_max), face is numbered like box faces
+bool heightfield::intersect(const ray& r, float t_min, float t_max, float& t, int& face) const {
+
+	STAT(STAT_HEIGHTFIELD_TESTS);
+	aabb bounds;
+	bounding_box(0, 1, bounds);
+	box outer(bounds.min(), bounds.max(), mat_ptr);
+	float t_near, t_far;
+	int near_axis, far_axis;
+	if (!outer.slab(r, t_near, t_far, near_axis, far_axis) || t_far <= t_min || t_near >= t_max) {
+		return false;
+	}
+
+	float oy = r.origin().y();
+	float dy = r.direction().y();
+	bool found = false;
+	auto column = [&](int i, int j, float te, float tx, int enter_axis, int exit_axis) {
+
+		STAT(STAT_HEIGHTFIELD_CELLS);
+		if (te >= t_max) {
+			return true;
+		}
+		// column i, j is the cell interval clipped by the y slab [y0, height]
+		float ta = -FLT_MAX, tb = FLT_MAX;
+		float h = height(i, j);
+		if (dy != 0) {
+			ta = (y0 - oy) / dy;
+			tb = (h - oy) / dy;
+			if (dy < 0) {
+				std::swap(ta, tb);
+			}
+		}
+		else if (oy < y0 || oy > h) {
+			return false;
+		}
+		int na = enter_axis, fa = exit_axis;
+		if (ta >= te) {
+			te = ta;
+			na = 1;
+		}
+		if (tb <= tx) {
+			tx = tb;
+			fa = 1;
+		}
+		if (te > tx) {
+			return false;
+		}
+		if (te > t_min && te < t_max) {
+			t = te;
+			face = na * 2 + (r.direction()[na] < 0 ? 1 : 0);
+			found = true;
+			return true;
+		}
+		if (tx > t_min && tx < t_max) {
+			t = tx;
+			face = fa * 2 + (r.direction()[fa] > 0 ? 1 : 0);
+			found = true;
+			return true;
+		}
+		return false;
+	};
+
+	float tile_size = tile * cell;
+	walk(r, t_near, t_far, near_axis, far_axis, 0, 0, tiles_x, tiles_z, tile_size, [&](int ti, int tj, float te, float tx, int enter_axis, int exit_axis) {
+
+		int i0 = ti * tile, j0 = tj * tile;
+		if (ffmin(oy + te * dy, oy + tx * dy) > tile_max[size_t(tj) * tiles_x + ti]) {
+			return te >= t_max;
+		}
+		return walk(r, te, tx, enter_axis, exit_axis, i0, j0, std::min(tile, nx - i0), std::min(tile, nz - j0), cell, column);
+	});
+	return found;
+}
+
+bool heightfield::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+
+	float t;
+	int face;
+	if (intersect(r, t_min, t_max, t, face)) {
+
+		// the face waits in rec.u, the column is recovered from the hit point
+		rec.t = t;
+		rec.u = float(face);
+		rec.obj = this;
+		return true;
+	}
+	return false;
+}
+
+void heightfield::compute_surface_interaction(const ray& r, hit_record& rec) const {
+
+	int face = int(rec.u);
+	vec3 p = r.point_at_parameter(rec.t);
+	float fx = (p.x() - x0) / cell;
+	float fz = (p.z() - z0) / cell;
+	int i = int(floor(fx));
+	int j = int(floor(fz));
+	// on a side wall the column is the one whose face it is
+	if (face == 0) i = int(floor(fx + 0.5f));
+	if (face == 1) i = int(floor(fx + 0.5f)) - 1;
+	if (face == 4) j = int(floor(fz + 0.5f));
+	if (face == 5) j = int(floor(fz + 0.5f)) - 1;
+	i = std::min(std::max(i, 0), nx - 1);
+	j = std::min(std::max(j, 0), nz - 1);
+	vec3 pmin(x0 + i * cell, y0, z0 + j * cell);
+	vec3 pmax(pmin.x() + cell, height(i, j), pmin.z() + cell);
+	box_surface_interaction(pmin, pmax, mat_ptr, face, r, rec);
+}
+
+#endif
@@ -3,8 +3,10 @@
 #define M_PI           3.14159265358979323846 
 
 #include "aabb.h"
+#include "arena.h"
 
 class material;
+class hitable;
 
 struct hit_record {
 
@@ -14,19 +16,59 @@ struct hit_record {
 	vec3 p;
 	vec3 normal;
 	material *mat_ptr;
+	const hitable *obj;
+	int index;		// which part of obj was hit, for compute_surface_interaction
 };
 
 class hitable {
 public:
+	virtual ~hitable() {}
+	// in the arena of an open arena_scope, see arena.h
+	static void* operator new(size_t size) { return arena::allocate(size, arena::HITABLE); }
+	static void operator delete(void *p) { arena::deallocate(p); }
+
+	// Intersection only sets rec.t, rec.obj and whatever parametric coordinates
+	// the primitive needs later (rec.u, rec.v). rec is left untouched on a miss.
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const = 0;
+	// Any-hit query for shadow and visibility rays, returns on the first intersection found
+	virtual bool occluded(const ray& r, float t_min, float t_max) const = 0;
+	// Entry and exit distance of the whole line through a closed surface, t0 <= t1.
+	// The fallback pays for two closest-hit queries, convex shapes override it in closed form.
+	virtual bool hit_interval(const ray& r, float& t0, float& t1) const {
+		hit_record rec1, rec2;
+		if (hit(r, -FLT_MAX, FLT_MAX, rec1) && hit(r, rec1.t + 0.0001, FLT_MAX, rec2)) {
+			t0 = rec1.t;
+			t1 = rec2.t;
+			return true;
+		}
+		return false;
+	}
+	// Fills p, normal, u, v and mat_ptr for a hit found by hit(), once per closest hit
+	virtual void compute_surface_interaction(const ray& r, hit_record& rec) const {}
 	virtual bool bounding_box(float t0, float t1, aabb& b) const = 0;
 };
 
+// Finishes a record returned by hit(), r has to be the ray that was passed to hit()
+inline void complete_hit(const ray& r, hit_record& rec) {
+
+	if (rec.obj) {
+		rec.obj->compute_surface_interaction(r, rec);
+		rec.obj = nullptr;
+	}
+}
+
 class translate : public hitable {
 public:
 	
 	translate(hitable* p, const vec3& _offset) : ptr(p), offset(_offset) {}
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const {
+		return ptr->occluded(ray(r.origin() - offset, r.direction(), r.time()), t_min, t_max);
+	}
+	virtual bool hit_interval(const ray& r, float& t0, float& t1) const {
+		return ptr->hit_interval(ray(r.origin() - offset, r.direction(), r.time()), t0, t1);
+	}
+	virtual void compute_surface_interaction(const ray& r, hit_record& rec) const;
 	virtual bool bounding_box(float t0, float t1, aabb& box) const;
 	hitable * ptr;
 	vec3 offset;
@@ -36,15 +78,27 @@ bool translate::hit(const ray& r, float t_min, float t_max, hit_record& rec) con
 	ray moved_ray(r.origin() - offset, r.direction(), r.time());
 	if (ptr->hit(moved_ray, t_min, t_max, rec)) {
 		
-		rec.p += offset;
+		// a direct child still has to be shaded, defer it through this wrapper
+		if (rec.obj == ptr) {
+			rec.obj = this;
+		}
+		else {
+			complete_hit(moved_ray, rec);
+			rec.p += offset;
+		}
 		return true;
 	}
 	else {
 		return false;
 	}
 }
+void translate::compute_surface_interaction(const ray& r, hit_record& rec) const {
+	ray moved_ray(r.origin() - offset, r.direction(), r.time());
+	ptr->compute_surface_interaction(moved_ray, rec);
+	rec.p += offset;
+}
 bool translate::bounding_box(float t0, float t1, aabb& box) const {
-	if (ptr - bounding_box(t0, t1, box)) {
+	if (ptr->bounding_box(t0, t1, box)) {
 
 		box = aabb(box.min() + offset, box.max() + offset);
 		return true;
@@ -59,9 +113,18 @@ class rotate_y : public hitable {
 public:
 	rotate_y(hitable *p, float angle);
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const {
+		return ptr->occluded(rotate_ray(r), t_min, t_max);
+	}
+	virtual bool hit_interval(const ray& r, float& t0, float& t1) const {
+		return ptr->hit_interval(rotate_ray(r), t0, t1);
+	}
+	virtual void compute_surface_interaction(const ray& r, hit_record& rec) const;
 	virtual bool bounding_box(float t0, float t1, aabb& box) const {
 		box = bbox; return hasbox;
 	}
+	ray rotate_ray(const ray& r) const;
+	void rotate_back(hit_record& rec) const;
 	hitable *ptr;
 	float sin_theta;
 	float cos_theta;
@@ -98,27 +161,46 @@ rotate_y::rotate_y(hitable *p, float angle) : ptr(p) {
 	bbox = aabb(min, max);
 }
 
-bool rotate_y::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+ray rotate_y::rotate_ray(const ray& r) const {
 	vec3 origin = r.origin();
 	vec3 direction = r.direction();
 	origin[0] = cos_theta * r.origin()[0] - sin_theta * r.origin()[2];
 	origin[2] = sin_theta * r.origin()[0] + cos_theta * r.origin()[2];
 	direction[0] = cos_theta * r.direction()[0] - sin_theta * r.direction()[2];
 	direction[2] = sin_theta * r.direction()[0] + cos_theta * r.direction()[2];
-	ray rotated_r(origin, direction, r.time());
+	return ray(origin, direction, r.time());
+}
+
+void rotate_y::rotate_back(hit_record& rec) const {
+	vec3 p = rec.p;
+	vec3 normal = rec.normal;
+	p[0] = cos_theta * rec.p[0] + sin_theta * rec.p[2];
+	p[2] = -sin_theta * rec.p[0] + cos_theta * rec.p[2];
+	normal[0] = cos_theta * rec.normal[0] + sin_theta * rec.normal[2];
+	normal[2] = -sin_theta * rec.normal[0] + cos_theta * rec.normal[2];
+	rec.p = p;
+	rec.normal = normal;
+}
+
+bool rotate_y::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+	ray rotated_r = rotate_ray(r);
 	if (ptr->hit(rotated_r, t_min, t_max, rec)) {
-		vec3 p = rec.p;
-		vec3 normal = rec.normal;
-		p[0] = cos_theta * rec.p[0] + sin_theta * rec.p[2];
-		p[2] = -sin_theta * rec.p[0] + cos_theta * rec.p[2];
-		normal[0] = cos_theta * rec.normal[0] + sin_theta * rec.normal[2];
-		normal[2] = -sin_theta * rec.normal[0] + cos_theta * rec.normal[2];
-		rec.p = p;
-		rec.normal = normal;
+		if (rec.obj == ptr) {
+			rec.obj = this;
+		}
+		else {
+			complete_hit(rotated_r, rec);
+			rotate_back(rec);
+		}
 		return true;
 	}
 	else
 		return false;
 }
 
+void rotate_y::compute_surface_interaction(const ray& r, hit_record& rec) const {
+	ptr->compute_surface_interaction(rotate_ray(r), rec);
+	rotate_back(rec);
+}
+
 #endif
\ No newline at end of file
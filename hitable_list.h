@@ -9,6 +9,7 @@ public:
 	hitable_list() {}
 	hitable_list(hitable **l, int n) { list = l; list_size = n; }
 	virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float tmin, float tmax) const;
 	virtual bool bounding_box(float t0, float t1, aabb& b)  const;
 	hitable **list;
 	int list_size;
@@ -16,21 +17,30 @@ public:
 
 bool hitable_list::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
 
-	hit_record temp_rec;
 	bool hit_anything = false;
-	double closest_so_far = t_max;
+	float closest_so_far = t_max;
 	for (int i = 0; i < list_size; i++) {
 
-		if (list[i]->hit(r, t_min, closest_so_far, temp_rec)) {
+		// a miss leaves rec alone, so no temporary record is needed
+		if (list[i]->hit(r, t_min, closest_so_far, rec)) {
 
 			hit_anything = true;
-			closest_so_far = temp_rec.t;
-			rec = temp_rec;
+			closest_so_far = rec.t;
 		}
 	}
 	return hit_anything;
 }
 
+bool hitable_list::occluded(const ray& r, float t_min, float t_max) const {
+
+	for (int i = 0; i < list_size; i++) {
+		if (list[i]->occluded(r, t_min, t_max)) {
+			return true;
+		}
+	}
+	return false;
+}
+
 bool hitable_list::bounding_box(float t0, float t1, aabb& b) const {
 
 	if (list_size < 1) return false;
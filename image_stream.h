@@ -0,0 +1,437 @@
+#pragma once
+#ifndef IMAGE_STREAMH
+#define IMAGE_STREAMH
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "ThreadPool.h"
+
+// Deflate of data handed in piece by piece. Every piece becomes one fixed Huffman block, with
+// matches only inside the piece, followed by an empty stored block, so the output of a piece
+// always ends on a byte and memory stays bounded by the piece however long the stream gets.
+class deflate_stream {
+
+public:
+	deflate_stream() : adler(1) {}
+
+	// zlib header, before the first piece
+	static void header(std::vector<uint8_t>& out) {
+		out.push_back(0x78);	// deflate, 32K window
+		out.push_back(0x5e);
+	}
+	void compress(const uint8_t *data, size_t n, std::vector<uint8_t>& out);
+	// last, empty block and the checksum of everything compressed
+	void finish(std::vector<uint8_t>& out);
+
+	static uint32_t adler32(uint32_t adler, const uint8_t *data, size_t n);
+	// checksum of a followed by b, from their checksums and the length of b
+	static uint32_t adler32_combine(uint32_t a, uint32_t b, size_t length_b);
+
+	uint32_t adler;
+
+private:
+	enum { WINDOW = 32768, HASH_BITS = 15, CHAIN = 16 };
+
+	struct bit_writer {
+		bit_writer(std::vector<uint8_t>& _out) : out(_out), bits(0), count(0) {}
+		void put(uint32_t code, int n) {
+			bits |= uint64_t(code) << count;
+			count += n;
+			while (count >= 8) {
+				out.push_back(uint8_t(bits));
+				bits >>= 8;
+				count -= 8;
+			}
+		}
+		// Huffman codes go in most significant bit first
+		void put_reversed(uint32_t code, int n) {
+			uint32_t r = 0;
+			for (int i = 0; i < n; i++) r = (r << 1) | ((code >> i) & 1);
+			put(r, n);
+		}
+		void align() {
+			if (count) put(0, 8 - count);
+		}
+		std::vector<uint8_t>& out;
+		uint64_t bits;
+		int count;
+	};
+
+	static void symbol(bit_writer& w, int c) {
+		if (c <= 143) w.put_reversed(0x30 + c, 8);
+		else if (c <= 255) w.put_reversed(0x190 + c - 144, 9);
+		else if (c <= 279) w.put_reversed(c - 256, 7);
+		else w.put_reversed(0xc0 + c - 280, 8);
+	}
+	static uint32_t hash(const uint8_t *p) {
+		return ((uint32_t(p[0]) << 16 | uint32_t(p[1]) << 8 | p[2]) * 0x9E3779B1u) >> (32 - HASH_BITS);
+	}
+};
+
+uint32_t deflate_stream::adler32(uint32_t adler, const uint8_t *data, size_t n) {
+
+	uint32_t a = adler & 0xffff, b = adler >> 16;
+	while (n) {
+		// the largest run before b can overflow
+		size_t run = n < 5552 ? n : 5552;
+		for (size_t i = 0; i < run; i++) {
+			a += data[i];
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+		data += run;
+		n -= run;
+	}
+	return b << 16 | a;
+}
+
+uint32_t deflate_stream::adler32_combine(uint32_t a, uint32_t b, size_t length_b) {
+
+	const uint32_t base = 65521;
+	uint32_t rem = uint32_t(length_b % base);
+	uint32_t sum1 = a & 0xffff;
+	uint32_t sum2 = uint32_t((uint64_t(rem) * sum1) % base);
+	sum1 += (b & 0xffff) + base - 1;
+	sum2 += (a >> 16) + (b >> 16) + base - rem;
+	if (sum1 >= base) sum1 -= base;
+	if (sum1 >= base) sum1 -= base;
+	if (sum2 >= base * 2) sum2 -= base * 2;
+	if (sum2 >= base) sum2 -= base;
+	return sum2 << 16 | sum1;
+}
+
+void deflate_stream::compress(const uint8_t *data, size_t n, std::vector<uint8_t>& out) {
+
+	static const uint16_t length_base[] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258,259 };
+	static const uint8_t length_extra[] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+	static const uint16_t dist_base[] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577,32769 };
+	static const uint8_t dist_extra[] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+
+	adler = adler32(adler, data, n);
+	bit_writer w(out);
+	w.put(0, 1);	// not the last block
+	w.put(1, 2);	// fixed Huffman
+
+	std::vector<int64_t> head(size_t(1) << HASH_BITS, -1), prev(WINDOW, -1);
+	// longest earlier match of the bytes at i, searching CHAIN candidates back
+	auto longest = [&](size_t i, size_t& distance) {
+		size_t best = 0, limit = n - i < 258 ? n - i : 258;
+		int64_t candidate = head[hash(data + i)];
+		for (int c = 0; c < CHAIN && candidate >= 0 && int64_t(i) - candidate < WINDOW; c++) {
+			const uint8_t *a = data + candidate, *b = data + i;
+			size_t len = 0;
+			while (len < limit && a[len] == b[len]) len++;
+			if (len > best) {
+				best = len;
+				distance = i - size_t(candidate);
+				if (len == limit) break;
+			}
+			int64_t next = prev[candidate & (WINDOW - 1)];
+			if (next >= candidate) break;
+			candidate = next;
+		}
+		return best;
+	};
+
+	size_t i = 0;
+	while (i + 3 <= n) {
+
+		size_t distance = 0;
+		size_t best = longest(i, distance);
+		uint32_t h = hash(data + i);
+		prev[i & (WINDOW - 1)] = head[h];
+		head[h] = int64_t(i);
+
+		// a longer match one byte on wins, this byte goes out as a literal
+		if (best >= 3 && i + 4 <= n) {
+			size_t next_distance;
+			if (longest(i + 1, next_distance) > best) best = 0;
+		}
+		if (best >= 3) {
+			int j = 0;
+			while (best >= length_base[j + 1]) j++;
+			symbol(w, 257 + j);
+			if (length_extra[j]) w.put(uint32_t(best - length_base[j]), length_extra[j]);
+			j = 0;
+			while (distance >= dist_base[j + 1]) j++;
+			w.put_reversed(j, 5);
+			if (dist_extra[j]) w.put(uint32_t(distance - dist_base[j]), dist_extra[j]);
+			i += best;
+		}
+		else {
+			symbol(w, data[i]);
+			i++;
+		}
+	}
+	for (; i < n; i++) {
+		symbol(w, data[i]);
+	}
+	symbol(w, 256);
+
+	// empty stored block, which starts on a byte
+	w.put(0, 3);
+	w.align();
+	const uint8_t stored[4] = { 0, 0, 0xff, 0xff };
+	out.insert(out.end(), stored, stored + 4);
+}
+
+void deflate_stream::finish(std::vector<uint8_t>& out) {
+
+	bit_writer w(out);
+	w.put(1, 1);
+	w.put(1, 2);
+	symbol(w, 256);
+	w.align();
+	for (int shift = 24; shift >= 0; shift -= 8) {
+		out.push_back(uint8_t(adler >> shift));
+	}
+}
+
+// Image written band by band, top rows first, so only the band in flight is in memory
+class image_stream {
+
+public:
+	virtual ~image_stream() {}
+	// n rows of RGB bytes, the rows below the ones written before
+	virtual bool rows(const uint8_t *rgb, int n) = 0;
+	virtual bool close() = 0;
+};
+
+// One PNG chunk. The crc runs over the tag and the data, which stb's crc wants in one piece.
+bool png_chunk(FILE *f, const char *tag, const uint8_t *data, size_t n) {
+
+	std::vector<uint8_t> c(8 + n + 4);
+	uint32_t length = uint32_t(n);
+	for (int k = 0; k < 4; k++) {
+		c[k] = uint8_t(length >> (24 - 8 * k));
+		c[4 + k] = uint8_t(tag[k]);
+	}
+	if (n) memcpy(&c[8], data, n);
+	uint32_t crc = stbiw__crc32(&c[4], int(n + 4));
+	for (int k = 0; k < 4; k++) {
+		c[8 + n + k] = uint8_t(crc >> (24 - 8 * k));
+	}
+	return fwrite(c.data(), 1, c.size(), f) == c.size();
+}
+
+// Signature and IHDR of an 8 bit RGB image
+bool png_header(FILE *f, int w, int h) {
+
+	const uint8_t signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	fwrite(signature, 1, 8, f);
+	uint8_t ihdr[13] = { uint8_t(w >> 24), uint8_t(w >> 16), uint8_t(w >> 8), uint8_t(w), uint8_t(h >> 24), uint8_t(h >> 16), uint8_t(h >> 8), uint8_t(h),
+		8, 2, 0, 0, 0 };
+	return png_chunk(f, "IHDR", ihdr, 13);
+}
+
+// Filter type byte and filtered bytes of the row at pixels into out, picking the filter like
+// stb_image_write does. The row above is at pixels - stride unless first.
+void png_filter_row(uint8_t *pixels, size_t stride, int width, bool first, signed char *line, uint8_t *out) {
+
+	uint8_t *rows = first ? pixels : pixels - stride;
+	int y = first ? 0 : 1;
+	int best_filter = 0, best_estimate = 0x7fffffff;
+	for (int filter = 0; filter < 5; filter++) {
+		stbiw__encode_png_line(rows, int(stride), width, 2, y, 3, filter, line);
+		int estimate = 0;
+		for (size_t i = 0; i < stride; i++) estimate += abs(line[i]);
+		if (estimate < best_estimate) {
+			best_estimate = estimate;
+			best_filter = filter;
+		}
+	}
+	stbiw__encode_png_line(rows, int(stride), width, 2, y, 3, best_filter, line);
+	out[0] = uint8_t(best_filter);
+	memcpy(out + 1, line, stride);
+}
+
+// PNG with one IDAT chunk per band. Rows are filtered against the row above even across bands.
+class png_stream : public image_stream {
+
+public:
+	png_stream() : f(nullptr), width(0), height(0), written(0) {}
+	~png_stream() { if (f) fclose(f); }
+
+	bool open(const std::string& path, int w, int h);
+	bool rows(const uint8_t *rgb, int n);
+	bool close();
+
+private:
+	FILE *f;
+	int width, height, written;
+	std::vector<uint8_t> above, filtered, packed;
+	std::vector<signed char> line;
+	deflate_stream z;
+};
+
+bool png_stream::open(const std::string& path, int w, int h) {
+
+	f = fopen(path.c_str(), "wb");
+	if (!f) return false;
+	width = w;
+	height = h;
+	written = 0;
+	above.assign(size_t(w) * 3 * 2, 0);
+	line.resize(size_t(w) * 3);
+	packed.clear();
+	deflate_stream::header(packed);
+	return png_header(f, w, h);
+}
+
+bool png_stream::rows(const uint8_t *rgb, int n) {
+
+	size_t stride = size_t(width) * 3;
+	filtered.resize((stride + 1) * n);
+	for (int r = 0; r < n; r++) {
+
+		// the row above and this one next to each other, as the filter wants them
+		memcpy(&above[stride], rgb + r * stride, stride);
+		png_filter_row(&above[stride], stride, width, written + r == 0, line.data(), &filtered[r * (stride + 1)]);
+		memcpy(&above[0], &above[stride], stride);
+	}
+	written += n;
+	z.compress(filtered.data(), filtered.size(), packed);
+	bool ok = png_chunk(f, "IDAT", packed.data(), packed.size());
+	packed.clear();
+	return ok;
+}
+
+bool png_stream::close() {
+
+	if (!f) return false;
+	bool ok = written == height;
+	z.finish(packed);
+	ok = png_chunk(f, "IDAT", packed.data(), packed.size()) && ok;
+	ok = png_chunk(f, "IEND", nullptr, 0) && ok;
+	ok = fclose(f) == 0 && ok;
+	f = nullptr;
+	return ok;
+}
+
+// Whole image as a PNG, rows top first, with the rows filtered and stripes of them deflated on
+// ThreadPool threads. Every stripe ends on a byte (see deflate_stream), so the stripes simply
+// follow each other in one zlib stream, and their checksums combine into the stream's.
+bool write_png_striped(const std::string& path, int w, int h, const uint8_t *rgb, int stripes) {
+
+	size_t stride = size_t(w) * 3;
+	stripes = std::max(1, std::min(stripes, h));
+	std::vector<uint8_t> filtered((stride + 1) * h);
+	std::vector<std::vector<uint8_t> > packed(stripes);
+	std::vector<uint32_t> adler(stripes);
+	ThreadPool::ParallelFor(0, stripes, [&](int s) {
+
+		TRACE_SCOPE("png stripe");
+		int y0 = int(int64_t(h) * s / stripes), y1 = int(int64_t(h) * (s + 1) / stripes);
+		std::vector<signed char> line(stride);
+		for (int y = y0; y < y1; y++) {
+			png_filter_row((uint8_t*)rgb + y * stride, stride, w, y == 0, line.data(), &filtered[y * (stride + 1)]);
+		}
+		deflate_stream z;
+		z.compress(&filtered[y0 * (stride + 1)], size_t(y1 - y0) * (stride + 1), packed[s]);
+		adler[s] = z.adler;
+	});
+
+	FILE *f = fopen(path.c_str(), "wb");
+	if (!f) return false;
+	bool ok = png_header(f, w, h);
+	deflate_stream whole;
+	std::vector<uint8_t> ends;
+	deflate_stream::header(ends);
+	ok = png_chunk(f, "IDAT", ends.data(), ends.size()) && ok;
+	for (int s = 0; s < stripes; s++) {
+		int y0 = int(int64_t(h) * s / stripes), y1 = int(int64_t(h) * (s + 1) / stripes);
+		whole.adler = deflate_stream::adler32_combine(whole.adler, adler[s], size_t(y1 - y0) * (stride + 1));
+		ok = png_chunk(f, "IDAT", packed[s].data(), packed[s].size()) && ok;
+	}
+	ends.clear();
+	whole.finish(ends);
+	ok = png_chunk(f, "IDAT", ends.data(), ends.size()) && ok;
+	ok = png_chunk(f, "IEND", nullptr, 0) && ok;
+	ok = fclose(f) == 0 && ok;
+	return ok;
+}
+
+// Raw tiles: "RTTILE01", int32 width, height, tile size, then the tiles row by row from the
+// top left, each tile*tile*3 bytes of RGB with its rows top first. Tiles past the right or
+// bottom edge are padded with black, so tile (tx, ty) starts at 20 + (ty*tiles_x + tx)*tile*tile*3.
+// Bands must be tile rows high, the last one may be short.
+class tile_stream : public image_stream {
+
+public:
+	tile_stream() : f(nullptr), width(0), height(0), tile(0), written(0) {}
+	~tile_stream() { if (f) fclose(f); }
+
+	bool open(const std::string& path, int w, int h, int tile_size);
+	bool rows(const uint8_t *rgb, int n);
+	bool close();
+
+private:
+	FILE *f;
+	int width, height, tile, written;
+	std::vector<uint8_t> block;
+};
+
+bool tile_stream::open(const std::string& path, int w, int h, int tile_size) {
+
+	f = fopen(path.c_str(), "wb");
+	if (!f) return false;
+	width = w;
+	height = h;
+	tile = tile_size;
+	written = 0;
+	block.resize(size_t(tile) * tile * 3);
+	int32_t header[3] = { w, h, tile_size };
+	fwrite("RTTILE01", 1, 8, f);
+	return fwrite(header, sizeof(header), 1, f) == 1;
+}
+
+bool tile_stream::rows(const uint8_t *rgb, int n) {
+
+	if (n > tile || (n < tile && written + n != height)) return false;
+	size_t stride = size_t(width) * 3, tile_stride = size_t(tile) * 3;
+	bool ok = true;
+	for (int x0 = 0; x0 < width; x0 += tile) {
+
+		size_t bytes = size_t(std::min(tile, width - x0)) * 3;
+		std::fill(block.begin(), block.end(), uint8_t(0));
+		for (int r = 0; r < n; r++) {
+			memcpy(&block[r * tile_stride], rgb + r * stride + size_t(x0) * 3, bytes);
+		}
+		ok = fwrite(block.data(), 1, block.size(), f) == block.size() && ok;
+	}
+	written += n;
+	return ok;
+}
+
+bool tile_stream::close() {
+
+	if (!f) return false;
+	bool ok = written == height;
+	ok = fclose(f) == 0 && ok;
+	f = nullptr;
+	return ok;
+}
+
+// format is png or tiles, band the rows handed in at a time (the tile size for tiles)
+image_stream* open_image_stream(const std::string& path, const std::string& format, int w, int h, int band) {
+
+	if (format == "png") {
+		png_stream *s = new png_stream();
+		if (s->open(path, w, h)) return s;
+		delete s;
+	}
+	else if (format == "tiles") {
+		tile_stream *s = new tile_stream();
+		if (s->open(path, w, h, band)) return s;
+		delete s;
+	}
+	return nullptr;
+}
+
+#endif
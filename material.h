@@ -3,11 +3,13 @@
 struct hit_record;
 #include "hitable.h"
 #include "texture.h"
+#include "arena.h"
+#include "maths.h"
 
 float schlick(float cosine, float ref_idx) {
 	float r0 = (1 - ref_idx) / (1 + ref_idx);
 	r0 = r0 * r0;
-	return r0 + (1 - r0) + pow((1 - cosine), 5);
+	return r0 + (1 - r0) * (fast_math() ? fast_pow5(1 - cosine) : pow((1 - cosine), 5));
 }
 
 bool refract(const vec3& v, const vec3& n, float nint, vec3& refracted) {
@@ -32,10 +34,15 @@ vec3 reflect(const vec3& v, const vec3& n) {
 
 class material {
 public:
+	virtual ~material() {}
+	static void* operator new(size_t size) { return arena::allocate(size, arena::MATERIAL); }
+	static void operator delete(void *p) { arena::deallocate(p); }
 	virtual bool scatter(const ray& r_in, const hit_record rec, vec3& attenuattion, ray& scattered) const = 0;
 	virtual vec3 emitted(float u, float v, const vec3& p) const {
 		return vec3(0, 0, 0);
 	}
+	// The albedo of a lambertian surface, which the scene may light directly, nullptr for others
+	virtual const texture* diffuse_albedo() const { return nullptr; }
 };
 
 class lambertian : public material {
@@ -43,11 +50,13 @@ public:
 	lambertian(texture  *a) : albedo(a) {}
 	virtual bool scatter(const ray& r_in, const hit_record rec, vec3& attenuattion, ray& scattered) const {
 
+		STAT(STAT_SCATTER_LAMBERTIAN);
 		vec3 target = rec.p + rec.normal + random_in_unit_sphere();
 		scattered = ray(rec.p, target - rec.p, r_in.time());
 		attenuattion = albedo->value(rec.u,rec.v,rec.p);
 		return true;
 	}
+	virtual const texture* diffuse_albedo() const { return albedo; }
 	texture *albedo;
 };
 
@@ -56,6 +65,7 @@ public:
 	metal(const vec3& a, float f) : albedo(a) { if (f < 1) fuzz = f; else fuzz = 1; }
 	virtual bool scatter(const ray& r_in, const hit_record rec, vec3& attenuattion, ray& scattered) const {
 	
+		STAT(STAT_SCATTER_METAL);
 		vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
 		scattered = ray(rec.p, reflected + fuzz * random_in_unit_sphere(), r_in.time());
 		attenuattion = albedo;
@@ -70,6 +80,7 @@ public:
 	dialectric(float ri) : ref_idx(ri) {}
 	virtual bool scatter(const ray& r_in, const hit_record rec, vec3& attenuattion, ray& scattered) const {
 	
+		STAT(STAT_SCATTER_DIALECTRIC);
 		vec3 outward_normal;
 		vec3 reflected = reflect(r_in.direction(), rec.normal);
 		float ni_over_nt;
@@ -96,7 +107,7 @@ public:
 		else {
 			reflect_prob = 1.0;
 		}
-		if (random_float() > reflect_prob) {
+		if (random_float() < reflect_prob) {
 			scattered = ray(rec.p, reflected, r_in.time());
 		}
 		else {
@@ -111,6 +122,7 @@ class diffuse_light : public material {
 public:
 	diffuse_light(texture *_tex) : emit(_tex) {}
 	virtual bool scatter(const ray& r_in, const hit_record rec, vec3& attenuattion, ray& scattered) const {
+		STAT(STAT_SCATTER_DIFFUSE_LIGHT);
 		return false;
 	}
 	virtual vec3 emitted(float u, float v, const vec3& p) const {
@@ -127,6 +139,7 @@ public:
 	isotropic(texture *a) : albedo(a) {}
 	virtual bool scatter(const ray& r_in, const hit_record rec, vec3& attenuattion, ray& scattered) const {
 
+		STAT(STAT_SCATTER_ISOTROPIC);
 		scattered = ray(rec.p, random_in_unit_sphere());
 		attenuattion = albedo->value(rec.u, rec.v, rec.p);
 		return true;
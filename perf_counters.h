@@ -0,0 +1,281 @@
+#pragma once
+#ifndef PERF_COUNTERSH
+#define PERF_COUNTERSH
+
+// Hardware counters (cycles, instructions, cache and branch misses) per phase through
+// perf_event_open. Compiled out unless RAYTRACER_PERF is defined here or in the project,
+// phases report the counters as unavailable where the kernel or container refuses them.
+//#define RAYTRACER_PERF
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <iostream>
+#include <iomanip>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+enum perf_event_id {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_CACHE_REFS,
+	PERF_CACHE_MISSES,
+	PERF_BRANCHES,
+	PERF_BRANCH_MISSES,
+	PERF_EVENT_COUNT
+};
+
+struct perf_values {
+
+	double count[PERF_EVENT_COUNT];
+	bool valid[PERF_EVENT_COUNT];
+
+	perf_values() {
+		for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+			count[i] = 0;
+			valid[i] = false;
+		}
+	}
+
+	void add(const perf_values& o) {
+		for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+			count[i] += o.count[i];
+			valid[i] = valid[i] || o.valid[i];
+		}
+	}
+
+	double ratio(int a, int b) const {
+		return valid[a] && valid[b] && count[b] > 0 ? count[a] / count[b] : -1;
+	}
+};
+
+// One counter group on the calling thread. Events the hardware does not have are left out,
+// without a group leader the group is unavailable and error() says why.
+class perf_group {
+public:
+	perf_group();
+	~perf_group();
+
+	bool available() const { return leader >= 0; }
+	void start();
+	perf_values stop();
+
+	static std::string& error() {
+		static std::string reason;
+		return reason;
+	}
+
+	int fd[PERF_EVENT_COUNT];
+	uint64_t id[PERF_EVENT_COUNT];
+	int leader;
+};
+
+#ifdef __linux__
+
+perf_group::perf_group() : leader(-1) {
+
+	static const uint64_t config[PERF_EVENT_COUNT] = {
+		PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_REFERENCES,
+		PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES
+	};
+	for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = config[i];
+		attr.disabled = leader < 0 ? 1 : 0;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		fd[i] = int(syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0));
+		if (fd[i] < 0) {
+			if (error().empty()) {
+				error() = std::string("perf_event_open: ") + strerror(errno);
+			}
+			continue;
+		}
+		ioctl(fd[i], PERF_EVENT_IOC_ID, &id[i]);
+		if (leader < 0) {
+			leader = fd[i];
+		}
+	}
+}
+
+perf_group::~perf_group() {
+	for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+		if (fd[i] >= 0) close(fd[i]);
+	}
+}
+
+void perf_group::start() {
+	if (leader < 0) return;
+	ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+// Counts since start(), scaled up when the kernel had to multiplex the group
+perf_values perf_group::stop() {
+
+	perf_values v;
+	if (leader < 0) return v;
+	ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+	// nr, time enabled, time running, then a value and id per event
+	uint64_t buf[3 + 2 * PERF_EVENT_COUNT];
+	if (read(leader, buf, sizeof(buf)) < 0) return v;
+	double scale = buf[2] > 0 ? double(buf[1]) / double(buf[2]) : 0;
+	for (uint64_t k = 0; k < buf[0]; k++) {
+		for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+			if (fd[i] >= 0 && id[i] == buf[4 + 2 * k]) {
+				v.count[i] = double(buf[3 + 2 * k]) * scale;
+				v.valid[i] = scale > 0;
+			}
+		}
+	}
+	return v;
+}
+
+#else
+
+perf_group::perf_group() : leader(-1) {
+	for (int i = 0; i < PERF_EVENT_COUNT; i++) fd[i] = -1;
+	error() = "perf_event_open is only available on Linux";
+}
+perf_group::~perf_group() {}
+void perf_group::start() {}
+perf_values perf_group::stop() { return perf_values(); }
+
+#endif
+
+// Counter totals per named phase, in the order the phases first finished
+class perf_phases {
+public:
+
+	struct phase {
+		std::string name;
+		perf_values values;
+		int runs;
+	};
+
+	static void add(const std::string& name, const perf_values& v) {
+
+		std::lock_guard<std::mutex> lock(mutex());
+		for (phase& p : all()) {
+			if (p.name == name) {
+				p.values.add(v);
+				p.runs++;
+				return;
+			}
+		}
+		phase p;
+		p.name = name;
+		p.values = v;
+		p.runs = 1;
+		all().push_back(p);
+	}
+
+	static void report(std::ostream& out) {
+
+		out << "Hardware counters" << std::endl;
+		if (all().empty()) {
+			out << "  unavailable (" << (perf_group::error().empty() ? "no phase was measured" : perf_group::error()) << ")" << std::endl;
+			return;
+		}
+		// ratios of events the hardware does not have show as n/a
+		auto field = [&](double value, double scale, const char *unit) {
+			if (value < 0) out << std::setw(7) << "n/a";
+			else out << std::setw(6) << std::setprecision(2) << value * scale << unit;
+		};
+		std::ios::fmtflags flags = out.flags();
+		std::streamsize precision = out.precision();
+		out << std::fixed;
+		for (const phase& p : all()) {
+
+			const perf_values& v = p.values;
+			out << "  " << std::left << std::setw(22) << p.name << std::right << std::setprecision(0);
+			out << std::setw(16) << (v.valid[PERF_CYCLES] ? v.count[PERF_CYCLES] : 0) << " cycles  IPC ";
+			field(v.ratio(PERF_INSTRUCTIONS, PERF_CYCLES), 1, " ");
+			out << "  cache miss ";
+			field(v.ratio(PERF_CACHE_MISSES, PERF_CACHE_REFS), 100, "%");
+			out << "  branch miss ";
+			field(v.ratio(PERF_BRANCH_MISSES, PERF_BRANCHES), 100, "%");
+			out << std::endl;
+		}
+		out << "  (inner phases are included in the outer ones)" << std::endl;
+		out.flags(flags);
+		out.precision(precision);
+	}
+
+	static std::vector<phase>& all() {
+		static std::vector<phase> phases;
+		return phases;
+	}
+	static std::mutex& mutex() {
+		static std::mutex m;
+		return m;
+	}
+};
+
+// Counts the enclosing block into phase name, a null name counts nothing. A phase already open on
+// this thread (a recursive build) is only counted by its outermost scope. A slice of a ParallelFor
+// (0 and on) also adds a line per slice, the same slice of every call to one line.
+class perf_scope {
+public:
+	perf_scope(const char *_name, int _slice = -1) : name(_name), slice(_slice), group(nullptr) {
+
+		if (!name) return;
+		for (const char *open : active()) {
+			if (strcmp(open, name) == 0) return;
+		}
+		active().push_back(name);
+		group = new perf_group();
+		group->start();
+	}
+
+	~perf_scope() {
+
+		if (!group) return;
+		perf_values v = group->stop();
+		delete group;
+		active().pop_back();
+		if (v.valid[PERF_CYCLES] || v.valid[PERF_INSTRUCTIONS]) {
+			perf_phases::add(name, v);
+			if (slice >= 0) {
+				perf_phases::add(std::string(name) + " [slice " + std::to_string(slice) + "]", v);
+			}
+		}
+	}
+
+	static std::vector<const char*>& active() {
+		thread_local std::vector<const char*> open;
+		return open;
+	}
+
+	const char *name;
+	int slice;
+	perf_group *group;
+};
+
+#ifdef RAYTRACER_PERF
+#define PERF_CONCAT2(a, b) a##b
+#define PERF_CONCAT(a, b) PERF_CONCAT2(a, b)
+#define PERF_SCOPE(name) perf_scope PERF_CONCAT(perf_scope_, __LINE__)(name)
+#define PERF_THREAD_SCOPE(name, slice) perf_scope PERF_CONCAT(perf_scope_, __LINE__)(name, int(slice))
+#define PERF_REPORT(out) perf_phases::report(out)
+#else
+#define PERF_SCOPE(name) ((void)0)
+#define PERF_THREAD_SCOPE(name, slice) ((void)(name), (void)(slice))
+#define PERF_REPORT(out) ((void)0)
+#endif
+
+#endif
@@ -6,23 +6,59 @@
 #include "camera.h"
 #include "ThreadPool.h"
 #include <string>
+#include <atomic>
+#include <mutex>
+#include <chrono>
 #include "hitable_list.h"
 #include "aarect.h"
 #include "sphere.h"
 #include "triangle.h"
 #include "material.h"
 #include "constant_medium.h"
+#include "grid_medium.h"
 #include "bhv_node.h"
 #include "box.h"
+#include "heightfield.h"
+#include "perf_counters.h"
+#include "trace.h"
 #include "ThreadPool.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #define STBI_MSC_SECURE_CRT
 #include "stb_image_write.h"
+#include "hdr_output.h"
+#include "image_stream.h"
 
+#include "environment.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+// Filled by scene::render when asked for, rays counts every ray traced including bounces
+struct render_stats {
+
+	double seconds;
+	long long rays;
+	long long paths;
+	unsigned threads;
+};
+
+thread_local static long long s_RayCount = 0;
+
+// What a camera ray found first, for the albedo, normal and depth layers
+struct first_hit {
+
+	vec3 albedo, normal;
+	float depth;
+	bool hit;
+};
+
+// Pixels x0 to x1 and y0 to y1 (exclusive), rows counted from the bottom as render_tile takes them
+struct pixel_rect {
+
+	int x0, y0, x1, y1;
+	long long area() const { return x1 > x0 && y1 > y0 ? (long long)(x1 - x0) * (y1 - y0) : 0; }
+};
+
 class scene {
 private:
 
@@ -30,22 +66,70 @@ private:
 	vec3 look_from, look_at;
 	float focus_dist, aperture, vfov;
 	camera *cam;
-	vec3 **colors;
+	mutable vec3 **colors;	// made by the first render, render_streamed does without
 	hitable *world;
-
-	bool save(std::string name) const;
-	vec3 trace(const ray& r, int depth) const;
+	bool progress;
+	std::string float_formats;
+	arena *memory;	// the world's objects when it was built in an arena, released with the scene
+	environment_light *env;	// nullptr for the built in sky
+	pixel_rect window;		// what render renders, the whole image unless cropped
+
+	bool save_heatmap(std::string name, const float *cost) const;
+	uint8_t* image_bytes() const;
+	vec3 trace(const ray& r, int depth, first_hit *first = nullptr, float scatter_pdf = 0) const;
+	vec3 diffuse_environment(const ray& r, const hit_record& rec, int depth) const;
+	vec3 sample(int x, int y, int s, first_hit *first = nullptr) const;
+	vec3 pixel(int x, int y) const;
+	vec3 pixel_layers(int x, int y, image_layers& layers) const;
 
 public:
 
-	scene() {}
+	scene() : cam(nullptr), colors(nullptr), memory(nullptr), env(nullptr), window{ 0, 0, 0, 0 } {}
 	scene(int _width, int _height, int _samples, vec3 _lookfrom, vec3 _lookat, hitable *_world, int _maxdepth = 50, float _focusdist = 10.0, float _aperture = 0.0, float _vfov = 40) : nx(_width), ny(_height), ns(_samples), look_from(_lookfrom), look_at(_lookat), world(_world), max_depth(_maxdepth), focus_dist(_focusdist), aperture(_aperture), vfov(_vfov) {
 
 		this->cam = new camera(look_from, look_at, vec3(0, 1, 0), vfov, float(nx) / float(ny), aperture, focus_dist, 0, 1);
-		this->colors = new vec3*[nx * ny];
+		this->colors = nullptr;
+		this->progress = true;
+		this->memory = nullptr;
+		this->env = nullptr;
+		this->window = { 0, 0, nx, ny };
 	}
-
-	bool render(std::string name = "output") const;
+	~scene() {
+		if (colors) {
+			for (size_t i = 0; i < size_t(nx) * ny; i++) delete colors[i];
+			delete[] colors;
+		}
+		delete cam;
+		delete memory;
+		delete env;
+	}
+	// the scene owns its camera, colors, arena and environment
+	scene(const scene&) = delete;
+	scene& operator=(const scene&) = delete;
+
+	bool render(std::string name = "output", render_stats *stats = nullptr) const;
+	bool render_streamed(std::string name, const std::string& format, int band, render_stats *stats = nullptr) const;
+	long long render_tile(int x0, int y0, int x1, int y1, vec3 *out) const;
+	vec3 radiance(int x, int y, int first, int last) const;
+	void set_pixel(int x, int y, const vec3& c);
+	bool save(std::string name) const;
+	void quiet() { progress = false; }
+	// also write float layers after every render, see write_layers
+	void float_output(const std::string& formats) { float_formats = formats; }
+	int width() const { return nx; }
+	int height() const { return ny; }
+	int samples() const { return ns; }
+	// the scene frees a, the arena its world was built in, when it goes
+	void own(arena *a) { memory = a; }
+	const arena* objects() const { return memory; }
+	// lights the scene with e instead of the sky gradient, the scene frees it
+	void environment(environment_light *e) { delete env; env = e; }
+	const environment_light* environment() const { return env; }
+	void look(vec3 from, vec3 at);
+	// render renders only the pixels of r, the others keep the colors of the last render or are black
+	void crop(const pixel_rect& r);
+	const pixel_rect& crop_window() const { return window; }
+	std::vector<pixel_rect> tiles_seeing(const aabb& box, int tile) const;
 	
 	
 	static hitable* earth(vec3 pos);
@@ -55,71 +139,427 @@ public:
 	static hitable* random_scene();
 	static hitable* cornell_box();
 	static hitable* cornell_box_smoke();
+	static hitable* cornell_box_grid_smoke();
 	static hitable* final_scene();
 
 };
 
-vec3 scene::trace(const ray& r, int depth) const {
+// Moves the camera, the next render sees from there
+void scene::look(vec3 from, vec3 at) {
+
+	look_from = from;
+	look_at = at;
+	delete cam;
+	cam = new camera(look_from, look_at, vec3(0, 1, 0), vfov, float(nx) / float(ny), aperture, focus_dist, 0, 1);
+}
+
+void scene::crop(const pixel_rect& r) {
+
+	window = { std::max(r.x0, 0), std::max(r.y0, 0), std::min(r.x1, nx), std::min(r.y1, ny) };
+	if (window.area() == 0) window = { 0, 0, 0, 0 };
+}
+
+// The tiles of a grid of tile x tile pixels from the bottom left corner, clipped to the image,
+// with a pixel whose camera rays may hit something inside box. Corners behind the lens give every
+// tile. Only direct views are found: shadows, reflections and light the box casts elsewhere are
+// not, the caller widens box or takes every tile when those matter.
+std::vector<pixel_rect> scene::tiles_seeing(const aabb& box, int tile) const {
+
+	// a box in front of the lens projects inside the hull of its corners, the spread of the lens
+	// is largest at the nearest or the farthest corner
+	float s0 = FLT_MAX, t0 = FLT_MAX, s1 = -FLT_MAX, t1 = -FLT_MAX;
+	bool everywhere = false;
+	for (int c = 0; c < 8; c++) {
+		vec3 p((c & 1 ? box.max() : box.min()).x(), (c & 2 ? box.max() : box.min()).y(), (c & 4 ? box.max() : box.min()).z());
+		float s, t, spread_s, spread_t;
+		if (!cam->project(p, s, t, spread_s, spread_t)) {
+			everywhere = true;
+			break;
+		}
+		s0 = ffmin(s0, s - spread_s);
+		s1 = ffmax(s1, s + spread_s);
+		t0 = ffmin(t0, t - spread_t);
+		t1 = ffmax(t1, t + spread_t);
+	}
+	// pixel x takes rays from s = x / nx to (x + 1) / nx
+	int x0 = 0, y0 = 0, x1 = nx - 1, y1 = ny - 1;
+	if (!everywhere) {
+		if (s1 < 0 || t1 < 0 || s0 >= 1 || t0 >= 1) return {};
+		x0 = std::max(0, int(floorf(s0 * nx)));
+		y0 = std::max(0, int(floorf(t0 * ny)));
+		x1 = std::min(nx - 1, int(floorf(s1 * nx)));
+		y1 = std::min(ny - 1, int(floorf(t1 * ny)));
+	}
+	std::vector<pixel_rect> tiles;
+	for (int ty = y0 / tile; ty <= y1 / tile; ty++) {
+		for (int tx = x0 / tile; tx <= x1 / tile; tx++) {
+			tiles.push_back({ tx * tile, ty * tile, std::min((tx + 1) * tile, nx), std::min((ty + 1) * tile, ny) });
+		}
+	}
+	return tiles;
+}
+
+// Light along r. scatter_pdf is the density a diffuse bounce chose r with, with a sampled
+// environment a miss is then weighted against the direct samples that could have found it.
+vec3 scene::trace(const ray& r, int depth, first_hit *first, float scatter_pdf) const {
 
 	hit_record rec;
+	s_RayCount++;
+	STAT_DEPTH(depth);
 	if (world->hit(r, 0.001, FLT_MAX, rec)) {
 
+		complete_hit(r, rec);
 		ray scattered;
 		vec3 attenuation;
 		vec3 emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+		const texture *diffuse = env ? rec.mat_ptr->diffuse_albedo() : nullptr;
+		if (depth < max_depth && diffuse) {
+			vec3 albedo = diffuse->value(rec.u, rec.v, rec.p);
+			if (first) {
+				*first = { albedo, rec.normal, rec.t * r.direction().length(), true };
+			}
+			return emitted + albedo * diffuse_environment(r, rec, depth);
+		}
 		if (depth < max_depth && rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
+			if (first) {
+				*first = { attenuation, rec.normal, rec.t * r.direction().length(), true };
+			}
 			return emitted + attenuation * trace(scattered, depth + 1);
 		}
 		else {
+			if (first) {
+				*first = { emitted, rec.normal, rec.t * r.direction().length(), true };
+			}
 			return emitted;
 		}
 	}
+	else if (env) {
+
+		vec3 sky = env->radiance(r.direction());
+		if (scatter_pdf > 0 && env->sampled) {
+			sky *= power_heuristic(scatter_pdf, env->pdf(r.direction()));
+		}
+		if (first) {
+			*first = { sky, vec3(0, 0, 0), FLT_MAX, false };
+		}
+		return sky;
+	}
 	else {
 
 		// sky
 		vec3 unitDir = r.direction();
 		float t = 0.5f*(unitDir.y() + 1.0f);
-		return ((1.0f - t)*vec3(1.0f, 1.0f, 1.0f) + t * vec3(0.5f, 0.7f, 1.0f)) * 0.3f;
+		vec3 sky = ((1.0f - t)*vec3(1.0f, 1.0f, 1.0f) + t * vec3(0.5f, 0.7f, 1.0f)) * 0.3f;
+		if (first) {
+			*first = { sky, vec3(0, 0, 0), FLT_MAX, false };
+		}
+		return sky;
 
 		//return vec3(0, 0, 0);
 	}
 }
 
-bool scene::render(std::string name) const {
+// Light a lambertian surface reflects at rec, before its albedo: one sample toward the environment
+// and one cosine distributed bounce, each weighted by the power heuristic against the density the
+// other strategy has for its direction. Without sampling the bounce alone. Both are exact
+// Lambertian, unlike the scatter of the material, so the two converge to the same image.
+vec3 scene::diffuse_environment(const ray& r, const hit_record& rec, int depth) const {
+
+	vec3 n = dot(rec.normal, r.direction()) > 0 ? -rec.normal : rec.normal;
+	vec3 light(0, 0, 0);
+	vec3 dir(0, 0, 0);
+	float light_pdf = 0;
+	vec3 sky = env->sampled ? env->sample(random_float(), random_float(), dir, light_pdf) : vec3(0, 0, 0);
+	float cosine = dot(n, dir);
+	if (light_pdf > 0 && cosine > 0) {
+		s_RayCount++;
+		if (!world->occluded(ray(rec.p, dir, r.time()), 0.001f, FLT_MAX)) {
+			float bounce_pdf = cosine / float(M_PI);
+			light += sky * (bounce_pdf / light_pdf * power_heuristic(light_pdf, bounce_pdf));
+		}
+	}
 
-	int c = 0;
-	ThreadPool::ParallelFor(0, ny, [&](int y) {
+	// a point on the unit sphere around the tip of the normal is cosine distributed
+	dir = unit_vector(n + unit_vector(random_in_unit_sphere()));
+	float bounce_pdf = dot(n, dir) / float(M_PI);
+	if (!(bounce_pdf > 0)) return light;
+	return light + trace(ray(rec.p, dir, r.time()), depth + 1, nullptr, bounce_pdf);
+}
 
-		//std::cout << "Processing Line: " << y << "\n";
-		for (int x = 0; x < nx; x++) {
+// Seed of one sample of one pixel, mixed so neighbouring pixels and samples start far apart
+inline uint32_t sample_seed(uint32_t pixel, uint32_t sample) {
+
+	uint32_t h = pixel * 0x9E3779B1u ^ (sample + 1) * 0x85EBCA77u;
+	h ^= h >> 16;
+	h *= 0x7FEB352Du;
+	h ^= h >> 15;
+	h *= 0x846CA68Bu;
+	h ^= h >> 16;
+	return h ? h : 1;
+}
 
-			vec3 col(0, 0, 0);
-			for (int s = 0; s < ns; s++) {
+// Linear radiance of sample s of a pixel. Every sample has its own fixed seed, so the image
+// depends neither on the thread count nor on how the pixels and samples are split up between
+// tiles, passes and processes.
+vec3 scene::sample(int x, int y, int s, first_hit *first) const {
 
-				float u = float(x + random_float()) / float(nx);
-				float v = float(y + random_float()) / float(ny);
-				ray r = cam->get_ray(u, v);
-				//vec3 p = r.point_at_parameter(2.0);
-				col += trace(r, 0);
-			}
+	s_RndState = sample_seed(uint32_t(x) + uint32_t(y) * uint32_t(nx), uint32_t(s));
+	float u = float(x + random_float()) / float(nx);
+	float v = float(y + random_float()) / float(ny);
+	ray r = cam->get_ray(u, v);
+	return trace(r, 0, first);
+}
+
+// Sum of the linear radiance of samples first to last (exclusive) of a pixel
+vec3 scene::radiance(int x, int y, int first, int last) const {
+
+	vec3 col(0, 0, 0);
+	for (int s = first; s < last; s++) {
+		col += sample(x, y, s);
+	}
+	return col;
+}
+
+// Final color of a pixel from ns samples
+vec3 scene::pixel(int x, int y) const {
+
+	vec3 col = radiance(x, y, 0, ns) / float(ns);
+	col = vec3(sqrt(col[0]), sqrt(col[1]), sqrt(col[2]));
+	col.Clamp01();
+	return col;
+}
+
+// Pixels x0 to x1 and y0 to y1 (exclusive) into out row by row, the same colors render gives
+// them. Returns the rays traced.
+long long scene::render_tile(int x0, int y0, int x1, int y1, vec3 *out) const {
+
+	std::atomic<long long> rays(0);
+	ThreadPool::ParallelFor(y0, y1, [&](int y) {
+
+		long long rays_before = s_RayCount;
+		for (int x = x0; x < x1; x++) {
+			out[(y - y0) * (x1 - x0) + x - x0] = pixel(x, y);
+		}
+		rays += s_RayCount - rays_before;
+	}, "render");
+	return rays;
+}
+
+// pixel, also filling the float layers. The samples are the same, so the colors are too.
+vec3 scene::pixel_layers(int x, int y, image_layers& layers) const {
+
+	vec3 sum(0, 0, 0), squares(0, 0, 0), albedo(0, 0, 0), normal(0, 0, 0);
+	double depth = 0;
+	int hits = 0;
+	for (int s = 0; s < ns; s++) {
+
+		first_hit first;
+		vec3 c = sample(x, y, s, &first);
+		sum += c;
+		squares += c * c;
+		albedo += first.albedo;
+		if (first.hit) {
+			normal += first.normal;
+			depth += first.depth;
+			hits++;
+		}
+	}
+
+	size_t i = size_t(x) + size_t(ny - 1 - y) * nx;
+	vec3 mean = sum / float(ns);
+	// variance of the mean, from the unbiased variance of the samples
+	vec3 variance = ns > 1 ? (squares - float(ns) * mean * mean) / float(ns - 1) / float(ns) : vec3(0, 0, 0);
+	for (int k = 0; k < 3; k++) {
+		layers.beauty[3 * i + k] = mean[k];
+		layers.albedo[3 * i + k] = albedo[k] / ns;
+		layers.normal[3 * i + k] = hits ? normal[k] / hits : 0;
+		layers.variance[3 * i + k] = ffmax(variance[k], 0.0f);
+	}
+	layers.depth[i] = hits ? float(depth / hits) : FLT_MAX;
+	layers.samples[i] = float(ns);
 
-			col /= float(ns);
-			vec3 *c = new vec3(sqrt(col[0]), sqrt(col[1]), sqrt(col[2]));
-			c->Clamp01();
+	vec3 col = vec3(sqrt(mean[0]), sqrt(mean[1]), sqrt(mean[2]));
+	col.Clamp01();
+	return col;
+}
+
+void scene::set_pixel(int x, int y, const vec3& c) {
+
+	if (!colors) colors = new vec3*[size_t(nx) * ny]();
+	delete colors[x + y * nx];
+	colors[x + y * nx] = new vec3(c);
+}
+
+// Renders every pixel of the crop window and writes _ImgOutput/name.png on the background writer,
+// so the next frame renders while this one is encoded. background_writer::shared().wait() for the file.
+bool scene::render(std::string name, render_stats *stats) const {
+
+	int c = 0;
+	std::atomic<long long> rays(0);
+#ifdef RAYTRACER_STATS
+	render_counters totals;
+	std::mutex totals_mutex;
+	float *cost = new float[nx * ny]();
+#endif
+	if (!colors) colors = new vec3*[size_t(nx) * ny]();
+	for (size_t i = 0; i < size_t(nx) * ny; i++) {
+		if (!colors[i]) colors[i] = new vec3(0, 0, 0);
+	}
+	image_layers *layers = float_formats.empty() ? nullptr : new image_layers(nx, ny);
+	auto start = std::chrono::steady_clock::now();
+	ThreadPool::ParallelFor(window.y0, window.y1, [&](int y) {
+
+		long long rays_before = s_RayCount;
+		TRACE_SCOPE_ARG("row", "y", y);
+#ifdef RAYTRACER_STATS
+		s_Counters.clear();
+#endif
+
+		//std::cout << "Processing Line: " << y << "\n";
+		for (int x = window.x0; x < window.x1; x++) {
+
+#ifdef RAYTRACER_STATS
+			long long cost_before = s_Counters.cost();
+#endif
+			vec3 *c = new vec3(layers ? pixel_layers(x, y, *layers) : pixel(x, y));
+			delete colors[x + y * nx];
 			colors[x + y * nx] = c;
+#ifdef RAYTRACER_STATS
+			cost[x + y * nx] = float(s_Counters.cost() - cost_before) / ns;
+#endif
 			
 		}
-		c++;
-		std::cout << "Process: " << c++ << "/" << ny * 2 << "\n";
-	});
+		rays += s_RayCount - rays_before;
+#ifdef RAYTRACER_STATS
+		{
+			std::lock_guard<std::mutex> lock(totals_mutex);
+			totals.merge(s_Counters);
+		}
+#endif
+		if (progress) {
+			c++;
+			std::cout << "Process: " << c++ << "/" << (window.y1 - window.y0) * 2 << "\n";
+		}
+	}, "render");
+	if (stats) {
+		stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		stats->rays = rays;
+		stats->paths = window.area() * ns;
+		stats->threads = ThreadPool::Threads();
+	}
+
+	{
+		PERF_SCOPE("image save");
+		TRACE_SCOPE("image save");
+		// encoded while the caller renders on, one frame at a time so frames do not pile up
+		uint8_t *bytes = image_bytes();
+		int w = nx, h = ny;
+		background_writer::shared().wait();
+		background_writer::shared().submit([bytes, w, h, name]() {
+			PERF_SCOPE("png encode");
+			TRACE_SCOPE("png encode");
+			if (write_png_striped("_ImgOutput/" + name + ".png", w, h, bytes, int(ThreadPool::Threads()))) {
+				std::cout << "Wrote PNG: " << name << ".png" << std::endl;
+			}
+			delete[] bytes;
+		});
+	}
+	if (layers) {
+		// encoded and written while the caller goes on, background_writer::shared().wait() for the files
+		std::string formats = float_formats;
+		background_writer::shared().submit([layers, name, formats]() {
+			TRACE_SCOPE("float layers save");
+			write_layers(*layers, name, formats);
+			delete layers;
+		});
+	}
+#ifdef RAYTRACER_STATS
+	totals.report(std::cout, window.area() * ns);
+	{
+		TRACE_SCOPE("heatmap save");
+		save_heatmap(name, cost);
+	}
+	delete[] cost;
+#endif
+	return true;
+}
 
-	save(name);
+// render for images too large to hold: bands of rows are rendered from the top and handed to
+// an image_stream (format png or tiles) on the background writer while the next band renders,
+// so memory is two bands whatever the image size. The colors are the ones render gives.
+bool scene::render_streamed(std::string name, const std::string& format, int band, render_stats *stats) const {
+
+	std::string path = "_ImgOutput/" + name + (format == "tiles" ? ".tiles" : ".png");
+	image_stream *out = open_image_stream(path, format, nx, ny, band);
+	if (!out) {
+		std::cerr << path << ": cannot write " << format << std::endl;
+		return false;
+	}
+	std::atomic<long long> rays(0);
+	std::atomic<bool> ok(true);
+	std::vector<uint8_t> bands[2] = { std::vector<uint8_t>(size_t(nx) * band * 3), std::vector<uint8_t>(size_t(nx) * band * 3) };
+	auto start = std::chrono::steady_clock::now();
+	for (int top = 0, b = 0; top < ny; top += band, b ^= 1) {
+
+		int n = std::min(band, ny - top);
+		uint8_t *bytes = bands[b].data();
+		ThreadPool::ParallelFor(top, top + n, [&](int row) {
+
+			long long rays_before = s_RayCount;
+			TRACE_SCOPE_ARG("row", "y", row);
+			int y = ny - 1 - row;
+			uint8_t *line = bytes + size_t(row - top) * nx * 3;
+			for (int x = 0; x < nx; x++) {
+
+				vec3 col = pixel(x, y);
+				line[x * 3 + 0] = uint8_t(int(255.99  * col[0]));
+				line[x * 3 + 1] = uint8_t(int(255.99  * col[1]));
+				line[x * 3 + 2] = uint8_t(int(255.99  * col[2]));
+			}
+			rays += s_RayCount - rays_before;
+		}, "render");
+		// the band before is written by now, so the writer may take this one
+		background_writer::shared().wait();
+		background_writer::shared().submit([out, bytes, n, &ok]() {
+			TRACE_SCOPE("band save");
+			if (!out->rows(bytes, n)) ok = false;
+		});
+		if (progress) {
+			std::cout << "Rows: " << top + n << "/" << ny << "\n";
+		}
+	}
+	background_writer::shared().wait();
+	bool closed = out->close();
+	delete out;
+	if (stats) {
+		stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		stats->rays = rays;
+		stats->paths = (long long)nx * ny * ns;
+		stats->threads = ThreadPool::Threads();
+	}
+	if (!ok || !closed) {
+		std::cerr << path << ": write failed" << std::endl;
+		return false;
+	}
+	std::cout << "Wrote " << (format == "tiles" ? "tiles: " + name + ".tiles" : "PNG: " + name + ".png") << std::endl;
 	return true;
 }
 
 bool scene::save(std::string name) const {
 
-	uint8_t *bytes = new uint8_t[nx * ny * 3];
+	uint8_t *bytes = image_bytes();
+	bool ok = write_png_striped("_ImgOutput/" + name + ".png", nx, ny, bytes, int(ThreadPool::Threads()));
+	if (ok) {
+		std::cout << "Wrote PNG: " << name << ".png" << std::endl;
+	}
+	delete[] bytes;
+	return ok;
+}
+
+// The image as RGB bytes, top row first
+uint8_t* scene::image_bytes() const {
+
+	uint8_t *bytes = new uint8_t[size_t(nx) * ny * 3];
 	for (int y = ny - 1; y >= 0; y--) {
 
 		for (int x = 0; x < nx; x++) {
@@ -134,11 +574,35 @@ bool scene::save(std::string name) const {
 			bytes[((x + y * nx) * 3 + 2)] = uint8_t(ib);
 		}
 	}
-	std::cout << "Wrote PNG: " << name << ".png" << std::endl;
-	std::string path = "_ImgOutput/" + name + ".png";
-	stbi_write_png(path.c_str(), nx, ny, 3, bytes, 0);
+	return bytes;
+}
+
+// False color picture of the traversal cost per sample, blue is cheap and red is expensive.
+// The scale tops out at the 99th percentile so a few outliers do not wash it out.
+bool scene::save_heatmap(std::string name, const float *cost) const {
+
+	std::vector<float> sorted(cost, cost + nx * ny);
+	std::nth_element(sorted.begin(), sorted.begin() + (nx * ny * 99) / 100, sorted.end());
+	float top = ffmax(sorted[(nx * ny * 99) / 100], 1.0f);
+
+	static const vec3 ramp[5] = { vec3(0, 0, 0.5f), vec3(0, 0.6f, 1), vec3(0.2f, 0.9f, 0.2f), vec3(1, 0.9f, 0), vec3(1, 0, 0) };
+	uint8_t *bytes = new uint8_t[nx * ny * 3];
+	for (int y = ny - 1; y >= 0; y--) {
+
+		for (int x = 0; x < nx; x++) {
 
-	delete(colors);
+			float f = ffmin(cost[x + (ny - y - 1) * nx] / top, 1.0f) * 4;
+			int i = std::min(int(f), 3);
+			vec3 col = ramp[i] + (f - i) * (ramp[i + 1] - ramp[i]);
+			for (int k = 0; k < 3; k++) {
+				bytes[(x + y * nx) * 3 + k] = uint8_t(255.99f * col[k]);
+			}
+		}
+	}
+	std::cout << "Wrote heatmap: " << name << "_cost.png (red = " << top << " tests per sample)" << std::endl;
+	std::string path = "_ImgOutput/" + name + "_cost.png";
+	stbi_write_png(path.c_str(), nx, ny, 3, bytes, 0);
+	delete[] bytes;
 	return true;
 }
 
@@ -157,7 +621,7 @@ hitable* scene::earth(vec3 pos) {
 hitable* scene::simple_light_scene() {
 
 	texture *pertext = new noise_texture(4);
-	hitable **list = new hitable*[4];
+	hitable **list = arena_array<hitable*>(4);
 	list[0] = new sphere(vec3(0, -1000, 0), 1000, new lambertian(pertext));
 	list[1] = new sphere(vec3(0, 2, 0), 2, new lambertian(pertext));
 	list[2] = new sphere(vec3(0, 6, 0), 2, new diffuse_light(new constant_texture(vec3(4, 4, 4))));
@@ -173,7 +637,7 @@ hitable* scene::triangle_test() {
 
 	texture *blue = new constant_texture(vec3(0, 1, 0));
 
-	hitable **list = new hitable*[4];
+	hitable **list = arena_array<hitable*>(4);
 	list[0] = new sphere(vec3(0, -1000, 0), 1000, new lambertian(checker));
 	list[1] = new triangle(vec3(0, 0, 0), vec3(1, 0, 20), vec3(1, 1, 0), new lambertian(blue));
 	list[2] = new sphere(vec3(0, 6, 0), 2, new diffuse_light(new constant_texture(vec3(4, 4, 4))));
@@ -189,7 +653,7 @@ hitable* scene::triangle_random() {
 
 	texture *blue = new constant_texture(vec3(0, 1, 0));
 
-	hitable **list = new hitable*[21];
+	hitable **list = arena_array<hitable*>(21);
 	int l = 0;
 	list[l++] = new sphere(vec3(0, -1000, 0), 1000, new lambertian(checker));
 	//list[l++] = new sphere(vec3(0, 6, 0), 2, new diffuse_light(new constant_texture(vec3(4, 4, 4))));
@@ -210,7 +674,7 @@ hitable* scene::random_scene() {
 		new constant_texture(vec3(0.9, 0.9, 0.9)));
 	texture *perlinTex = new noise_texture(5);
 
-	hitable **list = new hitable*[n + 1];
+	hitable **list = arena_array<hitable*>(n + 1);
 	//list[0] = new sphere(vec3(0, -1000, 0), 1000, new lambertian(checker));
 	list[0] = new sphere(vec3(0, -1000, 0), 1000, new lambertian(checker));
 
@@ -257,7 +721,7 @@ hitable* scene::random_scene() {
 
 hitable* scene::cornell_box() {
 
-	hitable **list = new hitable*[8];
+	hitable **list = arena_array<hitable*>(8);
 	int i = 0;
 	material *red = new lambertian(new constant_texture(vec3(0.65, 0.05, 0.05)));
 	material *white = new lambertian(new constant_texture(vec3(0.73, 0.73, 0.73)));
@@ -276,7 +740,7 @@ hitable* scene::cornell_box() {
 
 hitable* scene::cornell_box_smoke() {
 
-	hitable **list = new hitable*[8];
+	hitable **list = arena_array<hitable*>(8);
 	int i = 0;
 	material *red = new lambertian(new constant_texture(vec3(0.65, 0.05, 0.05)));
 	material *white = new lambertian(new constant_texture(vec3(0.73, 0.73, 0.73)));
@@ -298,33 +762,47 @@ hitable* scene::cornell_box_smoke() {
 	return new hitable_list(list, i);
 }
 
+hitable* scene::cornell_box_grid_smoke() {
+
+	hitable **list = arena_array<hitable*>(7);
+	int i = 0;
+	material *red = new lambertian(new constant_texture(vec3(0.65, 0.05, 0.05)));
+	material *white = new lambertian(new constant_texture(vec3(0.73, 0.73, 0.73)));
+	material *green = new lambertian(new constant_texture(vec3(0.12, 0.45, 0.15)));
+	material *light = new diffuse_light(new constant_texture(vec3(15, 15, 15)));
+
+	list[i++] = new flip_normals(new yz_rect(0, 555, 0, 555, 555, green));
+	list[i++] = new yz_rect(0, 555, 0, 555, 0, red);
+	list[i++] = new xz_rect(213, 343, 227, 332, 554, light);
+	list[i++] = new flip_normals(new xz_rect(0, 555, 0, 555, 555, white));
+	list[i++] = new xz_rect(0, 555, 0, 555, 0, white);
+	list[i++] = new flip_normals(new xy_rect(0, 555, 0, 555, 555, white));
+
+	density_grid *smoke = make_sparse_smoke_grid(128);
+	list[i++] = new grid_medium(smoke, aabb(vec3(127, 0, 127), vec3(427, 500, 427)), 0.15, new constant_texture(vec3(0.9, 0.9, 0.9)));
+	return new hitable_list(list, i);
+}
+
 hitable* scene::final_scene() {
 
 	int nb = 20;
-	hitable **list = new hitable*[30];
-	hitable **boxlist = new hitable*[100000];
-	hitable **boxlist2 = new hitable*[100000];
+	hitable **list = arena_array<hitable*>(30);
+	float *heights = arena_array<float>(nb * nb);
 
 	material *white = new lambertian(new constant_texture(vec3(0.73, 0.73, 0.73)));
 	material *ground = new lambertian(new constant_texture(vec3(0.48, 0.83, 0.53)));
 
-	int b = 0;
+	// 20x20 boxes of random height, as a single heightfield
 	for (int i = 0; i < nb; i++) {
 
 		for (int j = 0; j < nb; j++) {
 
-			int w = 100;
-			int x0 = -1000 + i * w;
-			int z0 = -1000 + j * w;
-			int y0 = 0;
-			int x1 = x0 + w;
-			int z1 = z0 + w;
 			int y1 = 100 * (random_float() + 0.01);
-			boxlist[b++] = new box(vec3(x0, y0, z0), vec3(x1, y1, z1), ground);
+			heights[j * nb + i] = y1;
 		}
 	}
 	int l = 0;
-	list[l++] = new bhv_node(boxlist, b, 0, 1);
+	list[l++] = new heightfield(-1000, -1000, 100, nb, nb, 0, heights, ground);
 	material *light = new diffuse_light(new constant_texture(vec3(7, 7, 7)));
 	list[l++] = new xz_rect(123, 423, 147, 412, 554, light);
 	vec3 center(400, 400, 200);
@@ -343,6 +821,7 @@ hitable* scene::final_scene() {
 	texture *pertext = new noise_texture(0.1);
 	list[l++] = new sphere(vec3(220, 280, 300), 80, new lambertian(pertext));
 	int ns = 1000;
+	hitable **boxlist2 = arena_array<hitable*>(ns);
 	for (int j = 0; j < ns; j++) {
 		boxlist2[j] = new sphere(vec3(165 * random_float(), 165 * random_float(), 165 * random_float()), 10, white);
 	}
@@ -0,0 +1,1011 @@
+#pragma once
+#ifndef SCENE_FILEH
+#define SCENE_FILEH
+
+#include "scene.h"
+#include "bvh_cache.h"
+#include "animation.h"
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <set>
+
+// Scene description files. The text form (.scn) is one statement per line, # starts a comment:
+//
+//   seed 7
+//   camera from 278 278 -800 at 278 278 0 vfov 40 aperture 0 focus 10
+//   image width 400 height 400 spp 100 depth 10
+//   texture NAME constant R G B | checker EVEN ODD | noise SCALE | image PATH
+//   material NAME lambertian TEX | metal R G B FUZZ | dialectric IOR | light TEX | isotropic TEX
+//   sphere X Y Z RADIUS MAT
+//   moving_sphere X0 Y0 Z0 X1 Y1 Z1 T0 T1 RADIUS MAT
+//   triangle X0 Y0 Z0 X1 Y1 Z1 X2 Y2 Z2 MAT
+//   xy_rect X0 X1 Y0 Y1 K MAT (xz_rect, yz_rect alike)
+//   box X0 Y0 Z0 X1 Y1 Z1 MAT
+//   heightfield X0 Z0 CELL NX NZ Y0 MAT random LO HI | values H...
+//   mesh PATH MAT                                   Wavefront OBJ, v and f lines
+//   constant_medium OBJECT DENSITY TEX
+//   grid_medium smoke RES X0 Y0 Z0 X1 Y1 Z1 SCALE TEX
+//   use OBJECT
+//   group NAME ... end                              a BVH of the statements in between
+//   frames FIRST LAST                               animation frames rendered by default
+//   key OBJECT FRAME [rotate_y DEGREES] [translate X Y Z]
+//   camera_key FRAME from X Y Z at X Y Z
+//   environment PATH [SCALE] [unsampled]            lat-long map lighting the scene, see environment.h
+//
+// TEX arguments also take three numbers for an unnamed constant texture. Object statements take
+// trailing "flip", "rotate_y DEGREES" and "translate X Y Z", applied in the order written.
+// "def NAME statement" defines a named object without placing it, "use NAME" places it,
+// other objects are placed in the enclosing group or the world. Paths are relative to the file.
+// Keys move a named object (def or group) rigidly, rotated then translated from where its own
+// statement puts it, linear between keys and held outside them. Every use of it moves alike.
+// A moving object under a rotate_y or a medium keeps the bounds of the first frame there.
+//
+// The binary form holds the same records after parsing (meshes and random heights included),
+// so loading it is a few reads. The world is built with the slab boxes in box4 leaves, one flat
+// BVH per group and per mesh; given a bvh_cache the trees are taken from it or added to it.
+
+enum scene_texture_type { TEX_CONSTANT, TEX_CHECKER, TEX_NOISE, TEX_IMAGE };
+enum scene_material_type { MAT_LAMBERTIAN, MAT_METAL, MAT_DIALECTRIC, MAT_LIGHT, MAT_ISOTROPIC };
+enum scene_object_type {
+	OBJ_SPHERE, OBJ_MOVING_SPHERE, OBJ_TRIANGLE, OBJ_XY_RECT, OBJ_XZ_RECT, OBJ_YZ_RECT, OBJ_BOX,
+	OBJ_HEIGHTFIELD, OBJ_MESH, OBJ_CONSTANT_MEDIUM, OBJ_GRID_MEDIUM, OBJ_USE, OBJ_GROUP
+};
+enum scene_xform_type { XFORM_FLIP, XFORM_ROTATE_Y, XFORM_TRANSLATE };
+
+const int SCENE_WORLD = -1;		// parent of objects placed in the world
+const int SCENE_UNPLACED = -2;	// parent of def objects
+
+struct scene_desc {
+
+	struct texture_rec {
+		int type;
+		float p[3];
+		int a, b;		// checker textures
+		int path;		// image path, index into strings
+	};
+	struct material_rec {
+		int type;
+		float p[4];
+		int tex;
+	};
+	struct object_rec {
+		int type;
+		float p[12];
+		int mat;		// material, or texture for media
+		int ref;		// object used by use and constant_medium
+		int parent;		// group object, SCENE_WORLD or SCENE_UNPLACED
+		int first, count;	// triangles of a mesh, heights of a heightfield
+		int first_xform, n_xforms;
+	};
+	struct xform_rec {
+		int type;
+		float p[3];
+	};
+	struct key_rec {
+		int object;		// SCENE_WORLD for the camera
+		float frame;
+		float p[6];		// rotate_y degrees and translation, or camera from and at
+	};
+
+	vec3 look_from = vec3(278, 278, -800), look_at = vec3(278, 278, 0);
+	float vfov = 40, aperture = 0, focus_dist = 10;
+	int width = 400, height = 400, spp = 100, max_depth = 50;
+
+	std::vector<texture_rec> textures;
+	std::vector<material_rec> materials;
+	std::vector<object_rec> objects;
+	std::vector<xform_rec> xforms;
+	std::vector<vec3> vertices;		// three per mesh triangle
+	std::vector<float> heights;
+	std::vector<std::string> strings;
+	int first_frame = 0, last_frame = 0;
+	std::vector<key_rec> keys;
+	std::string environment;		// map path, empty for the sky gradient
+	float environment_scale = 1;
+	bool environment_sampled = true;
+
+	bool load(const std::string& path);
+	bool load_text(const std::string& path);
+	bool load_binary(const std::string& path);
+	bool save_binary(const std::string& path) const;
+	bool load_obj(const std::string& path, int& first, int& count);
+	bool check(const std::string& path) const;
+	int empty_object(int i, const std::vector<std::vector<int> >& members, std::vector<char>& state) const;
+
+	uint64_t hash() const;
+	uint64_t image_hash() const;
+	hitable* build_world(bvh_cache *cache = nullptr) const;
+	environment_light* make_environment() const;
+	scene* make_scene(bvh_cache *cache = nullptr) const;
+	animation* make_animation(bvh_cache *cache = nullptr) const;
+	bool animated() const { return !keys.empty() || last_frame != first_frame; }
+};
+
+// Reads a text or binary scene, binary files are recognized by their magic
+bool scene_desc::load(const std::string& path) {
+
+	char magic[8] = {};
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f) {
+		std::cerr << path << ": cannot open" << std::endl;
+		return false;
+	}
+	size_t n = fread(magic, 1, 8, f);
+	fclose(f);
+	if (n == 8 && (memcmp(magic, "RTSCNB01", 8) == 0 || memcmp(magic, "RTSCNB02", 8) == 0 || memcmp(magic, "RTSCNB03", 8) == 0)) {
+		return load_binary(path);
+	}
+	return load_text(path);
+}
+
+// Statement parser, one per line. Errors name the file and line and stop the load.
+class scene_parser {
+public:
+	scene_parser(scene_desc& _d, const std::string& _path) : d(_d), path(_path), line_no(0), ok(true) {
+		size_t slash = path.find_last_of("/\\");
+		dir = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+	}
+
+	bool fail(const std::string& msg) {
+		if (ok) std::cerr << path << ":" << line_no << ": " << msg << std::endl;
+		ok = false;
+		return false;
+	}
+
+	bool word(std::string& w) {
+		if (!(in >> w)) return fail("unexpected end of line");
+		return true;
+	}
+
+	bool number(float& f) {
+		std::string w;
+		if (!word(w)) return false;
+		char *end;
+		f = strtof(w.c_str(), &end);
+		if (*end) return fail("expected a number, got '" + w + "'");
+		return true;
+	}
+
+	bool numbers(float *f, int n) {
+		for (int i = 0; i < n; i++) {
+			if (!number(f[i])) return false;
+		}
+		return true;
+	}
+
+	bool lookup(const std::map<std::string, int>& names, const std::string& kind, int& index) {
+		std::string w;
+		if (!word(w)) return false;
+		auto it = names.find(w);
+		if (it == names.end()) return fail("unknown " + kind + " '" + w + "'");
+		index = it->second;
+		return true;
+	}
+
+	// A texture name or three numbers for an unnamed constant texture
+	bool texture_arg(int& index) {
+
+		std::streampos at = in.tellg();
+		std::string w;
+		if (!word(w)) return false;
+		auto it = texture_names.find(w);
+		if (it != texture_names.end()) {
+			index = it->second;
+			return true;
+		}
+		in.clear();
+		in.seekg(at);
+		scene_desc::texture_rec t = {};
+		t.type = TEX_CONSTANT;
+		if (!numbers(t.p, 3)) return fail("unknown texture '" + w + "'");
+		index = int(d.textures.size());
+		d.textures.push_back(t);
+		return true;
+	}
+
+	bool parse_texture() {
+
+		std::string name, type;
+		if (!word(name) || !word(type)) return false;
+		scene_desc::texture_rec t = {};
+		if (type == "constant") {
+			t.type = TEX_CONSTANT;
+			if (!numbers(t.p, 3)) return false;
+		}
+		else if (type == "checker") {
+			t.type = TEX_CHECKER;
+			if (!texture_arg(t.a) || !texture_arg(t.b)) return false;
+		}
+		else if (type == "noise") {
+			t.type = TEX_NOISE;
+			if (!number(t.p[0])) return false;
+		}
+		else if (type == "image") {
+			std::string file;
+			if (!word(file)) return false;
+			t.type = TEX_IMAGE;
+			t.path = int(d.strings.size());
+			d.strings.push_back(dir + file);
+		}
+		else {
+			return fail("unknown texture type '" + type + "'");
+		}
+		texture_names[name] = int(d.textures.size());
+		d.textures.push_back(t);
+		return true;
+	}
+
+	bool parse_material() {
+
+		std::string name, type;
+		if (!word(name) || !word(type)) return false;
+		scene_desc::material_rec m = {};
+		m.tex = -1;
+		if (type == "lambertian") {
+			m.type = MAT_LAMBERTIAN;
+			if (!texture_arg(m.tex)) return false;
+		}
+		else if (type == "metal") {
+			m.type = MAT_METAL;
+			if (!numbers(m.p, 4)) return false;
+		}
+		else if (type == "dialectric") {
+			m.type = MAT_DIALECTRIC;
+			if (!number(m.p[0])) return false;
+		}
+		else if (type == "light") {
+			m.type = MAT_LIGHT;
+			if (!texture_arg(m.tex)) return false;
+		}
+		else if (type == "isotropic") {
+			m.type = MAT_ISOTROPIC;
+			if (!texture_arg(m.tex)) return false;
+		}
+		else {
+			return fail("unknown material type '" + type + "'");
+		}
+		material_names[name] = int(d.materials.size());
+		d.materials.push_back(m);
+		return true;
+	}
+
+	// Object statements, name is empty unless the statement came with def
+	bool parse_object(const std::string& type, const std::string& name) {
+
+		scene_desc::object_rec o = {};
+		o.mat = o.ref = -1;
+		o.parent = !name.empty() ? SCENE_UNPLACED : groups.empty() ? SCENE_WORLD : groups.back();
+		static const struct { const char *word; int type; int n; } simple[] = {
+			{ "sphere", OBJ_SPHERE, 4 }, { "moving_sphere", OBJ_MOVING_SPHERE, 9 }, { "triangle", OBJ_TRIANGLE, 9 },
+			{ "xy_rect", OBJ_XY_RECT, 5 }, { "xz_rect", OBJ_XZ_RECT, 5 }, { "yz_rect", OBJ_YZ_RECT, 5 }, { "box", OBJ_BOX, 6 },
+		};
+		const auto *s = std::begin(simple);
+		while (s != std::end(simple) && type != s->word) s++;
+		if (s != std::end(simple)) {
+			o.type = s->type;
+			if (!numbers(o.p, s->n) || !lookup(material_names, "material", o.mat)) return false;
+		}
+		else if (type == "heightfield") {
+			o.type = OBJ_HEIGHTFIELD;
+			if (!numbers(o.p, 6) || !lookup(material_names, "material", o.mat)) return false;
+			int nx = int(o.p[3]), nz = int(o.p[4]);
+			if (nx < 1 || nz < 1) return fail("heightfield needs at least one cell");
+			std::string source;
+			if (!word(source)) return false;
+			o.first = int(d.heights.size());
+			o.count = nx * nz;
+			if (source == "random") {
+				float lo, hi;
+				if (!number(lo) || !number(hi)) return false;
+				for (int i = 0; i < o.count; i++) d.heights.push_back(lo + (hi - lo) * random_float());
+			}
+			else if (source == "values") {
+				for (int i = 0; i < o.count; i++) {
+					float h;
+					if (!number(h)) return false;
+					d.heights.push_back(h);
+				}
+			}
+			else {
+				return fail("heightfield heights are 'random LO HI' or 'values H...'");
+			}
+		}
+		else if (type == "mesh") {
+			o.type = OBJ_MESH;
+			std::string file;
+			if (!word(file) || !lookup(material_names, "material", o.mat)) return false;
+			if (!d.load_obj(dir + file, o.first, o.count)) return fail("cannot read mesh '" + file + "'");
+		}
+		else if (type == "constant_medium") {
+			o.type = OBJ_CONSTANT_MEDIUM;
+			if (!lookup(object_names, "object", o.ref) || !number(o.p[0]) || !texture_arg(o.mat)) return false;
+		}
+		else if (type == "grid_medium") {
+			o.type = OBJ_GRID_MEDIUM;
+			std::string kind;
+			if (!word(kind)) return false;
+			if (kind != "smoke") return fail("the only grid is 'smoke'");
+			if (!numbers(o.p, 8) || !texture_arg(o.mat)) return false;
+		}
+		else if (type == "use") {
+			o.type = OBJ_USE;
+			if (!lookup(object_names, "object", o.ref)) return false;
+		}
+		else {
+			return fail("unknown statement '" + type + "'");
+		}
+
+		if (!parse_xforms(o)) return false;
+		if (!name.empty()) object_names[name] = int(d.objects.size());
+		d.objects.push_back(o);
+		return true;
+	}
+
+	bool parse_xforms(scene_desc::object_rec& o) {
+
+		o.first_xform = int(d.xforms.size());
+		std::string w;
+		while (in >> w) {
+			scene_desc::xform_rec x = {};
+			if (w == "flip") {
+				x.type = XFORM_FLIP;
+			}
+			else if (w == "rotate_y") {
+				x.type = XFORM_ROTATE_Y;
+				if (!number(x.p[0])) return false;
+			}
+			else if (w == "translate") {
+				x.type = XFORM_TRANSLATE;
+				if (!numbers(x.p, 3)) return false;
+			}
+			else {
+				return fail("unexpected '" + w + "'");
+			}
+			d.xforms.push_back(x);
+		}
+		o.n_xforms = int(d.xforms.size()) - o.first_xform;
+		return true;
+	}
+
+	bool parse_line(const std::string& line) {
+
+		in.clear();
+		in.str(line.substr(0, line.find('#')));
+		std::string w;
+		if (!(in >> w)) return true;
+
+		if (w == "seed") {
+			float s;
+			if (!number(s)) return false;
+			s_RndState = uint32_t(s) ? uint32_t(s) : 1;
+		}
+		else if (w == "camera") {
+			while (in >> w) {
+				if (w == "from") { if (!numbers(&d.look_from[0], 3)) return false; }
+				else if (w == "at") { if (!numbers(&d.look_at[0], 3)) return false; }
+				else if (w == "vfov") { if (!number(d.vfov)) return false; }
+				else if (w == "aperture") { if (!number(d.aperture)) return false; }
+				else if (w == "focus") { if (!number(d.focus_dist)) return false; }
+				else return fail("unknown camera setting '" + w + "'");
+			}
+		}
+		else if (w == "image") {
+			while (in >> w) {
+				float v;
+				if (!number(v)) return false;
+				if (w == "width") d.width = int(v);
+				else if (w == "height") d.height = int(v);
+				else if (w == "spp") d.spp = int(v);
+				else if (w == "depth") d.max_depth = int(v);
+				else return fail("unknown image setting '" + w + "'");
+			}
+		}
+		else if (w == "texture") {
+			return parse_texture();
+		}
+		else if (w == "material") {
+			return parse_material();
+		}
+		else if (w == "group") {
+			std::string name;
+			if (!word(name)) return false;
+			scene_desc::object_rec o = {};
+			o.type = OBJ_GROUP;
+			o.mat = o.ref = -1;
+			o.parent = SCENE_UNPLACED;
+			object_names[name] = int(d.objects.size());
+			groups.push_back(int(d.objects.size()));
+			d.objects.push_back(o);
+		}
+		else if (w == "end") {
+			if (groups.empty()) return fail("end without group");
+			groups.pop_back();
+		}
+		else if (w == "def") {
+			std::string name, type;
+			if (!word(name) || !word(type)) return false;
+			return parse_object(type, name);
+		}
+		else if (w == "frames") {
+			float first, last;
+			if (!number(first) || !number(last)) return false;
+			if (last < first) return fail("frames run from the first to the last");
+			d.first_frame = int(first);
+			d.last_frame = int(last);
+		}
+		else if (w == "key") {
+			scene_desc::key_rec k = {};
+			if (!lookup(object_names, "object", k.object) || !number(k.frame)) return false;
+			while (in >> w) {
+				if (w == "rotate_y") { if (!number(k.p[0])) return false; }
+				else if (w == "translate") { if (!numbers(k.p + 1, 3)) return false; }
+				else return fail("keys take 'rotate_y' and 'translate', got '" + w + "'");
+			}
+			d.keys.push_back(k);
+		}
+		else if (w == "environment") {
+			std::string file;
+			if (!word(file)) return false;
+			d.environment = dir + file;
+			d.environment_scale = 1;
+			d.environment_sampled = true;
+			while (in >> w) {
+				if (w == "unsampled") d.environment_sampled = false;
+				else if (!(std::istringstream(w) >> d.environment_scale)) return fail("environments take a scale and 'unsampled', got '" + w + "'");
+			}
+		}
+		else if (w == "camera_key") {
+			scene_desc::key_rec k = {};
+			k.object = SCENE_WORLD;
+			if (!number(k.frame)) return false;
+			while (in >> w) {
+				if (w == "from") { if (!numbers(k.p, 3)) return false; }
+				else if (w == "at") { if (!numbers(k.p + 3, 3)) return false; }
+				else return fail("camera keys take 'from' and 'at', got '" + w + "'");
+			}
+			d.keys.push_back(k);
+		}
+		else {
+			return parse_object(w, "");
+		}
+		return ok;
+	}
+
+	scene_desc& d;
+	std::string path, dir;
+	int line_no;
+	bool ok;
+	std::istringstream in;
+	std::map<std::string, int> texture_names, material_names, object_names;
+	std::vector<int> groups;
+};
+
+bool scene_desc::load_text(const std::string& path) {
+
+	std::ifstream file(path);
+	if (!file) {
+		std::cerr << path << ": cannot open" << std::endl;
+		return false;
+	}
+	scene_parser parser(*this, path);
+	std::string line;
+	while (std::getline(file, line)) {
+		parser.line_no++;
+		if (!parser.parse_line(line)) return false;
+	}
+	if (!parser.groups.empty()) return parser.fail("group without end");
+	return check(path);
+}
+
+// Triangles of a Wavefront OBJ, polygons are split into fans. Only positions are used.
+bool scene_desc::load_obj(const std::string& path, int& first, int& count) {
+
+	std::ifstream file(path);
+	if (!file) return false;
+	std::vector<vec3> positions;
+	first = int(vertices.size() / 3);
+	std::string line;
+	while (std::getline(file, line)) {
+
+		std::istringstream in(line);
+		std::string w;
+		if (!(in >> w)) continue;
+		if (w == "v") {
+			vec3 p;
+			in >> p[0] >> p[1] >> p[2];
+			positions.push_back(p);
+		}
+		else if (w == "f") {
+			std::vector<int> face;
+			while (in >> w) {
+				// v, v/vt, v//vn or v/vt/vn, negative indices count from the end
+				int i = atoi(w.c_str());
+				face.push_back(i < 0 ? int(positions.size()) + i : i - 1);
+			}
+			for (size_t k = 2; k < face.size(); k++) {
+				int idx[3] = { face[0], face[k - 1], face[k] };
+				for (int j = 0; j < 3; j++) {
+					if (idx[j] < 0 || idx[j] >= int(positions.size())) return false;
+					vertices.push_back(positions[idx[j]]);
+				}
+			}
+		}
+	}
+	count = int(vertices.size() / 3) - first;
+	return true;
+}
+
+template<typename T>
+void write_vector(FILE *f, const std::vector<T>& v) {
+	uint32_t n = uint32_t(v.size());
+	fwrite(&n, sizeof(n), 1, f);
+	if (n) fwrite(v.data(), sizeof(T), n, f);
+}
+
+template<typename T>
+bool read_vector(FILE *f, std::vector<T>& v) {
+	uint32_t n;
+	if (fread(&n, sizeof(n), 1, f) != 1) return false;
+	v.resize(n);
+	return n == 0 || fread(v.data(), sizeof(T), n, f) == n;
+}
+
+bool scene_desc::save_binary(const std::string& path) const {
+
+	FILE *f = fopen(path.c_str(), "wb");
+	if (!f) {
+		std::cerr << path << ": cannot write" << std::endl;
+		return false;
+	}
+	fwrite("RTSCNB03", 1, 8, f);
+	float camera[9] = { look_from[0], look_from[1], look_from[2], look_at[0], look_at[1], look_at[2], vfov, aperture, focus_dist };
+	int32_t settings[4] = { width, height, spp, max_depth };
+	fwrite(camera, sizeof(camera), 1, f);
+	fwrite(settings, sizeof(settings), 1, f);
+	write_vector(f, textures);
+	write_vector(f, materials);
+	write_vector(f, objects);
+	write_vector(f, xforms);
+	write_vector(f, vertices);
+	write_vector(f, heights);
+	uint32_t n = uint32_t(strings.size());
+	fwrite(&n, sizeof(n), 1, f);
+	for (const std::string& s : strings) {
+		write_vector(f, std::vector<char>(s.begin(), s.end()));
+	}
+	int32_t frames[2] = { first_frame, last_frame };
+	fwrite(frames, sizeof(frames), 1, f);
+	write_vector(f, keys);
+	write_vector(f, std::vector<char>(environment.begin(), environment.end()));
+	float env[2] = { environment_scale, environment_sampled ? 1.0f : 0.0f };
+	fwrite(env, sizeof(env), 1, f);
+	fclose(f);
+	return true;
+}
+
+bool scene_desc::load_binary(const std::string& path) {
+
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f) return false;
+	char magic[8];
+	float camera[9];
+	int32_t settings[4];
+	uint32_t n = 0;
+	bool ok = fread(magic, 8, 1, f) == 1 && fread(camera, sizeof(camera), 1, f) == 1 && fread(settings, sizeof(settings), 1, f) == 1
+		&& read_vector(f, textures) && read_vector(f, materials) && read_vector(f, objects) && read_vector(f, xforms)
+		&& read_vector(f, vertices) && read_vector(f, heights) && fread(&n, sizeof(n), 1, f) == 1;
+	for (uint32_t i = 0; ok && i < n; i++) {
+		std::vector<char> s;
+		ok = read_vector(f, s);
+		strings.push_back(std::string(s.begin(), s.end()));
+	}
+	// version 1 files end here, without animation
+	int32_t frames[2] = { 0, 0 };
+	bool v3 = memcmp(magic, "RTSCNB03", 8) == 0;
+	if (ok && (v3 || memcmp(magic, "RTSCNB02", 8) == 0)) {
+		ok = fread(frames, sizeof(frames), 1, f) == 1 && read_vector(f, keys);
+	}
+	// and version 2 ones here, without an environment
+	float env[2] = { 1, 1 };
+	if (ok && v3) {
+		std::vector<char> s;
+		ok = read_vector(f, s) && fread(env, sizeof(env), 1, f) == 1;
+		environment.assign(s.begin(), s.end());
+	}
+	fclose(f);
+	if (!ok) {
+		std::cerr << path << ": truncated scene file" << std::endl;
+		return false;
+	}
+	look_from = vec3(camera[0], camera[1], camera[2]);
+	look_at = vec3(camera[3], camera[4], camera[5]);
+	vfov = camera[6];
+	aperture = camera[7];
+	focus_dist = camera[8];
+	width = settings[0];
+	height = settings[1];
+	spp = settings[2];
+	max_depth = settings[3];
+	first_frame = frames[0];
+	last_frame = frames[1];
+	environment_scale = env[0];
+	environment_sampled = env[1] != 0;
+	return check(path);
+}
+
+// 1 when object i builds to nothing (a mesh without triangles, a group of such objects or a use
+// or medium of one), 0 when it builds to something, -1 when it uses itself or an unknown object
+int scene_desc::empty_object(int i, const std::vector<std::vector<int> >& members, std::vector<char>& state) const {
+
+	if (i < 0 || i >= int(objects.size()) || state[i] == 1) return -1;
+	if (state[i]) return state[i] - 2;
+	state[i] = 1;
+	const object_rec& o = objects[i];
+	int empty = 0;
+	if (o.type == OBJ_MESH) empty = o.count == 0;
+	else if (o.type == OBJ_USE || o.type == OBJ_CONSTANT_MEDIUM) empty = empty_object(o.ref, members, state);
+	else if (o.type == OBJ_GROUP) {
+		empty = 1;
+		for (size_t k = 0; k < members[i].size() && empty >= 0; k++) {
+			empty = std::min(empty, empty_object(members[i][k], members, state));
+		}
+	}
+	if (empty >= 0) state[i] = char(empty + 2);
+	return empty;
+}
+
+// What every load checks before a scene is made from it. Every index must be in range, a checker
+// only uses textures before it, so textures cannot use themselves.
+bool scene_desc::check(const std::string& path) const {
+
+	if (width <= 0 || height <= 0 || spp <= 0) {
+		std::cerr << path << ": image width, height and spp must be positive" << std::endl;
+		return false;
+	}
+	auto bad = [&](const char *what, size_t i) {
+		std::cerr << path << ": " << what << " " << i << " refers to something that does not exist" << std::endl;
+		return false;
+	};
+	auto in = [](int64_t first, int64_t count, size_t size) { return first >= 0 && count >= 0 && first + count <= int64_t(size); };
+	for (size_t i = 0; i < textures.size(); i++) {
+		const texture_rec& t = textures[i];
+		if (t.type == TEX_CHECKER && !(in(t.a, 1, i) && in(t.b, 1, i))) return bad("texture", i);
+		if (t.type == TEX_IMAGE && !in(t.path, 1, strings.size())) return bad("texture", i);
+	}
+	for (size_t i = 0; i < materials.size(); i++) {
+		const material_rec& m = materials[i];
+		bool textured = m.type == MAT_LAMBERTIAN || m.type == MAT_LIGHT || m.type == MAT_ISOTROPIC;
+		if (textured && !in(m.tex, 1, textures.size())) return bad("material", i);
+	}
+	for (size_t i = 0; i < objects.size(); i++) {
+		const object_rec& o = objects[i];
+		bool ok = in(o.first_xform, o.n_xforms, xforms.size());
+		if (o.type == OBJ_CONSTANT_MEDIUM || o.type == OBJ_GRID_MEDIUM) ok = ok && in(o.mat, 1, textures.size());
+		else if (o.type != OBJ_USE && o.type != OBJ_GROUP) ok = ok && in(o.mat, 1, materials.size());
+		if (o.type == OBJ_MESH) ok = ok && in(3 * int64_t(o.first), 3 * int64_t(o.count), vertices.size());
+		if (o.type == OBJ_HEIGHTFIELD) {
+			int64_t nx = int64_t(o.p[3]), nz = int64_t(o.p[4]);
+			ok = ok && nx >= 1 && nz >= 1 && o.count == nx * nz && in(o.first, o.count, heights.size());
+		}
+		if (!ok) return bad("object", i);
+	}
+	for (size_t i = 0; i < keys.size(); i++) {
+		if (keys[i].object != SCENE_WORLD && !in(keys[i].object, 1, objects.size())) return bad("key", i);
+	}
+	std::vector<std::vector<int> > members(objects.size());
+	for (size_t i = 0; i < objects.size(); i++) {
+		int parent = objects[i].parent;
+		if (parent >= 0 && parent < int(objects.size())) members[parent].push_back(int(i));
+	}
+	std::vector<char> state(objects.size(), 0);
+	bool empty = true;
+	for (size_t i = 0; i < objects.size(); i++) {
+		int e = objects[i].parent < int(objects.size()) ? empty_object(int(i), members, state) : -1;
+		if (e < 0) {
+			std::cerr << path << ": an object uses itself or an object that does not exist" << std::endl;
+			return false;
+		}
+		if (objects[i].parent == SCENE_WORLD && !e) empty = false;
+	}
+	if (empty) {
+		std::cerr << path << ": nothing to render, the world is empty" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// Turns the records into hitables, every object is built once however often it is used
+class scene_builder {
+public:
+	scene_builder(const scene_desc& _d, bvh_cache *_cache) : d(_d), cache(_cache ? _cache : new bvh_cache()), tex(d.textures.size(), nullptr), built(d.objects.size(), nullptr) {
+
+		for (const scene_desc::key_rec& k : d.keys) {
+			if (k.object != SCENE_WORLD) motion[k.object].push_back({ k.frame, vec3(k.p[1], k.p[2], k.p[3]), k.p[0] });
+		}
+		for (auto& m : motion) {
+			std::stable_sort(m.second.begin(), m.second.end(), [](const motion_key& a, const motion_key& b) { return a.frame < b.frame; });
+		}
+
+		for (size_t i = 0; i < d.textures.size(); i++) {
+			tex[i] = make_texture(int(i));
+		}
+		for (const scene_desc::material_rec& m : d.materials) {
+			texture *t = m.tex >= 0 ? tex[m.tex] : nullptr;
+			switch (m.type) {
+			case MAT_LAMBERTIAN: mat.push_back(new lambertian(t)); break;
+			case MAT_METAL: mat.push_back(new metal(vec3(m.p[0], m.p[1], m.p[2]), m.p[3])); break;
+			case MAT_DIALECTRIC: mat.push_back(new dialectric(m.p[0])); break;
+			case MAT_LIGHT: mat.push_back(new diffuse_light(t)); break;
+			default: mat.push_back(new isotropic(t)); break;
+			}
+		}
+	}
+
+	texture* make_texture(int i) {
+
+		if (tex[i]) return tex[i];
+		const scene_desc::texture_rec& t = d.textures[i];
+		switch (t.type) {
+		case TEX_CHECKER: return new checker_texture(make_texture(t.a), make_texture(t.b));
+		case TEX_NOISE: return new noise_texture(t.p[0]);
+		case TEX_IMAGE: {
+			int nx, ny, nn;
+			unsigned char *data = stbi_load(d.strings[t.path].c_str(), &nx, &ny, &nn, 3);
+			if (!data) {
+				std::cerr << d.strings[t.path] << ": cannot load image, using magenta" << std::endl;
+				return new constant_texture(vec3(1, 0, 1));
+			}
+			return new image_texture(data, nx, ny);
+		}
+		default: return new constant_texture(vec3(t.p[0], t.p[1], t.p[2]));
+		}
+	}
+
+	hitable* object(int i) {
+
+		if (built[i]) return built[i];
+		const scene_desc::object_rec& o = d.objects[i];
+		const float *p = o.p;
+		material *m = o.mat >= 0 && o.type != OBJ_CONSTANT_MEDIUM && o.type != OBJ_GRID_MEDIUM ? mat[o.mat] : nullptr;
+		hitable *h = nullptr;
+		switch (o.type) {
+		case OBJ_SPHERE: h = new sphere(vec3(p[0], p[1], p[2]), p[3], m); break;
+		case OBJ_MOVING_SPHERE: h = new moving_sphere(vec3(p[0], p[1], p[2]), vec3(p[3], p[4], p[5]), p[6], p[7], p[8], m); break;
+		case OBJ_TRIANGLE: h = new triangle(vec3(p[0], p[1], p[2]), vec3(p[3], p[4], p[5]), vec3(p[6], p[7], p[8]), m); break;
+		case OBJ_XY_RECT: h = new xy_rect(p[0], p[1], p[2], p[3], p[4], m); break;
+		case OBJ_XZ_RECT: h = new xz_rect(p[0], p[1], p[2], p[3], p[4], m); break;
+		case OBJ_YZ_RECT: h = new yz_rect(p[0], p[1], p[2], p[3], p[4], m); break;
+		case OBJ_BOX: h = new box(vec3(p[0], p[1], p[2]), vec3(p[3], p[4], p[5]), m); break;
+		case OBJ_HEIGHTFIELD: {
+			// the world outlives the description
+			float *heights = arena_array<float>(o.count);
+			std::copy(d.heights.begin() + o.first, d.heights.begin() + o.first + o.count, heights);
+			h = new heightfield(p[0], p[1], p[2], int(p[3]), int(p[4]), p[5], heights, m);
+			break;
+		}
+		case OBJ_MESH: h = mesh(i, m); break;
+		case OBJ_CONSTANT_MEDIUM: {
+			hitable *boundary = object(o.ref);
+			if (boundary) h = new constant_medium(boundary, p[0], tex[o.mat]);
+			break;
+		}
+		case OBJ_GRID_MEDIUM: {
+			density_grid *smoke = make_sparse_smoke_grid(int(p[0]));
+			h = new grid_medium(smoke, aabb(vec3(p[1], p[2], p[3]), vec3(p[4], p[5], p[6])), p[7], tex[o.mat]);
+			break;
+		}
+		case OBJ_USE: h = object(o.ref); break;
+		case OBJ_GROUP: h = collect(i); break;
+		}
+		bool moves = h && moving.count(h) > 0;
+		if (o.type == OBJ_CONSTANT_MEDIUM && moving.count(object(o.ref))) {
+			std::cerr << "warning: a medium keeps the bounds its moving object has at the first frame" << std::endl;
+		}
+		for (int k = 0; h && k < o.n_xforms; k++) {
+			const scene_desc::xform_rec& x = d.xforms[o.first_xform + k];
+			if (x.type == XFORM_FLIP) h = new flip_normals(h);
+			else if (x.type == XFORM_ROTATE_Y) h = new rotate_y(h, x.p[0]);
+			else h = new translate(h, vec3(x.p[0], x.p[1], x.p[2]));
+			if (moves && x.type == XFORM_ROTATE_Y) {
+				std::cerr << "warning: rotate_y keeps the bounds its moving object has at the first frame" << std::endl;
+			}
+		}
+		auto k = motion.find(i);
+		if (h && k != motion.end()) {
+			keyed_instance *instance = new keyed_instance(h, k->second);
+			instances.push_back(instance);
+			inner_trees.push_back(int(trees.size()));
+			h = instance;
+			moves = true;
+		}
+		if (moves) moving.insert(h);
+		built[i] = h;
+		return h;
+	}
+
+	// BVH over the objects placed in parent, plain boxes share box4 leaves
+	hitable* collect(int parent) {
+
+		std::vector<box*> boxes;
+		std::vector<hitable*> list;
+		for (size_t i = 0; i < d.objects.size(); i++) {
+
+			const scene_desc::object_rec& o = d.objects[i];
+			if (o.parent != parent) continue;
+			hitable *h = object(int(i));
+			if (!h) continue;
+			if (o.type == OBJ_BOX && o.n_xforms == 0) boxes.push_back((box*)h);
+			else list.push_back(h);
+		}
+		if (!boxes.empty()) {
+			hitable **leaves = arena_array<hitable*>(boxes.size());
+			int n_leaves = box4::make_leaves(boxes.data(), int(boxes.size()), leaves);
+			list.insert(list.end(), leaves, leaves + n_leaves);
+		}
+		if (list.empty()) return nullptr;
+		if (list.size() == 1) return list[0];
+		hitable **l = arena_array<hitable*>(list.size());
+		std::copy(list.begin(), list.end(), l);
+
+		// the list comes out in the same order for the same scene, so a cached order still fits it
+		const bvh_entry *e = cache->find(parent);
+		if (!e || e->n_items != int(list.size())) {
+			std::vector<aabb> boxes(list.size());
+			for (size_t i = 0; i < list.size(); i++) {
+				list[i]->bounding_box(0, 1, boxes[i]);
+			}
+			std::vector<flat_node> nodes;
+			std::vector<int32_t> order;
+			build_flat_bvh(boxes.data(), int(boxes.size()), nodes, order);
+			e = cache->add(parent, nodes, order.data(), int(order.size()), sizeof(int32_t));
+		}
+		flat_bvh *tree = new flat_bvh(e->nodes, e->n_nodes, (const int32_t*)e->items, l, int(list.size()));
+		for (hitable *h : list) {
+			if (moving.count(h)) {
+				// after the trees of its items, so refitting in this order goes bottom-up
+				trees.push_back(tree);
+				moving.insert(tree);
+				break;
+			}
+		}
+		return tree;
+	}
+
+	// The triangles are stored in leaf order next to the tree
+	hitable* mesh(int i, material *m) {
+
+		const scene_desc::object_rec& o = d.objects[i];
+		if (o.count == 0) return nullptr;
+		const bvh_entry *e = cache->find(i);
+		if (!e || e->n_items != o.count) {
+			const vec3 *v = &d.vertices[3 * size_t(o.first)];
+			std::vector<aabb> boxes(o.count);
+			for (int k = 0; k < o.count; k++) {
+				triangle(v[3 * k], v[3 * k + 1], v[3 * k + 2], m).bounding_box(0, 1, boxes[k]);
+			}
+			std::vector<flat_node> nodes;
+			std::vector<int32_t> order;
+			build_flat_bvh(boxes.data(), o.count, nodes, order, MESH_LEAF_SIZE);
+			std::vector<vec3> sorted(3 * size_t(o.count));
+			for (int k = 0; k < o.count; k++) {
+				for (int j = 0; j < 3; j++) sorted[3 * k + j] = v[3 * order[k] + j];
+			}
+			e = cache->add(i, nodes, sorted.data(), o.count, 3 * sizeof(vec3));
+		}
+		return new triangle_mesh(e->nodes, (const vec3*)e->items, m);
+	}
+
+	const scene_desc& d;
+	bvh_cache *cache;
+	std::vector<texture*> tex;
+	std::vector<material*> mat;
+	std::vector<hitable*> built;
+	std::map<int, std::vector<motion_key> > motion;	// keys of each moving object by frame
+	std::vector<keyed_instance*> instances;
+	std::vector<int> inner_trees;					// per instance, the trees made before it
+	std::vector<flat_bvh*> trees;					// trees holding something that moves
+	std::set<const hitable*> moving;
+};
+
+// FNV-1a over every record that shapes the world, eight bytes a step so large meshes hash in a
+// few milliseconds. The camera and image settings are left out.
+uint64_t scene_desc::hash() const {
+
+	uint64_t h = 14695981039346656037ull;
+	auto add = [&](const void *p, size_t n) {
+		const unsigned char *b = (const unsigned char*)p;
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8) {
+			uint64_t w;
+			memcpy(&w, b + i, 8);
+			h = (h ^ w) * 1099511628211ull;
+		}
+		for (; i < n; i++) {
+			h = (h ^ b[i]) * 1099511628211ull;
+		}
+		h = (h ^ n) * 1099511628211ull;
+	};
+	add(&BVH_CACHE_VERSION, sizeof(BVH_CACHE_VERSION));
+	add(textures.data(), textures.size() * sizeof(texture_rec));
+	add(materials.data(), materials.size() * sizeof(material_rec));
+	add(objects.data(), objects.size() * sizeof(object_rec));
+	add(xforms.data(), xforms.size() * sizeof(xform_rec));
+	add(vertices.data(), vertices.size() * sizeof(vec3));
+	add(heights.data(), heights.size() * sizeof(float));
+	add(keys.data(), keys.size() * sizeof(key_rec));
+	for (const std::string& s : strings) {
+		add(s.c_str(), s.size() + 1);
+	}
+	return h;
+}
+
+// hash() and the camera, size and depth of the image and the environment, everything the samples
+// of a pixel depend on
+uint64_t scene_desc::image_hash() const {
+
+	float camera[9] = { look_from[0], look_from[1], look_from[2], look_at[0], look_at[1], look_at[2], vfov, aperture, focus_dist };
+	int32_t settings[3] = { width, height, max_depth };
+	uint64_t h = hash();
+	const unsigned char *b = (const unsigned char*)camera;
+	for (size_t i = 0; i < sizeof(camera); i++) h = (h ^ b[i]) * 1099511628211ull;
+	b = (const unsigned char*)settings;
+	for (size_t i = 0; i < sizeof(settings); i++) h = (h ^ b[i]) * 1099511628211ull;
+	if (!environment.empty()) {
+		float env[2] = { environment_scale, environment_sampled ? 1.0f : 0.0f };
+		for (char c : environment) h = (h ^ (unsigned char)c) * 1099511628211ull;
+		b = (const unsigned char*)env;
+		for (size_t i = 0; i < sizeof(env); i++) h = (h ^ b[i]) * 1099511628211ull;
+	}
+	return h;
+}
+
+hitable* scene_desc::build_world(bvh_cache *cache) const {
+	scene_builder b(*this, cache);
+	return b.collect(SCENE_WORLD);
+}
+
+// The environment map, nullptr for the sky gradient or when it cannot be loaded
+environment_light* scene_desc::make_environment() const {
+
+	if (environment.empty()) return nullptr;
+	environment_light *e = environment_light::load(environment, environment_scale);
+	if (e) e->sampled = e->sampled && environment_sampled;
+	return e;
+}
+
+// The world goes into an arena the scene owns, see arena.h
+scene* scene_desc::make_scene(bvh_cache *cache) const {
+
+	arena *memory = new arena();
+	hitable *world;
+	{
+		arena_scope scope(*memory);
+		world = build_world(cache);
+	}
+	scene *s = new scene(width, height, spp, look_from, look_at, world, max_depth, focus_dist, aperture, vfov);
+	s->own(memory);
+	s->environment(make_environment());
+	return s;
+}
+
+animation* scene_desc::make_animation(bvh_cache *cache) const {
+
+	arena *memory = new arena();
+	arena_scope scope(*memory);
+	scene_builder b(*this, cache);
+	hitable *world = b.collect(SCENE_WORLD);
+	std::vector<camera_key> cameras;
+	for (const key_rec& k : keys) {
+		if (k.object == SCENE_WORLD) cameras.push_back({ k.frame, vec3(k.p[0], k.p[1], k.p[2]), vec3(k.p[3], k.p[4], k.p[5]) });
+	}
+	std::stable_sort(cameras.begin(), cameras.end(), [](const camera_key& a, const camera_key& b) { return a.frame < b.frame; });
+	scene *s = new scene(width, height, spp, look_from, look_at, world, max_depth, focus_dist, aperture, vfov);
+	s->own(memory);
+	s->environment(make_environment());
+	return new animation(s, b.instances, b.inner_trees, b.trees, cameras);
+}
+
+#endif
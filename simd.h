@@ -0,0 +1,192 @@
+#pragma once
+#ifndef SIMDH
+#define SIMDH
+
+#include "vec3.h"
+#include <string>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+// Instruction sets the batch kernels are compiled for, SSE2 is the x64 baseline every build has
+enum simd_isa { SIMD_SCALAR, SIMD_SSE42, SIMD_AVX2, SIMD_AVX512, SIMD_ISAS };
+
+// A function marked with one of these may use that set whatever the compiler flags are, it must
+// only be called once simd_supported says the CPU has it. MSVC takes the intrinsics anywhere and
+// never fuses them, GCC would make FMAs of the AVX-512 code and round differently than vec3.h.
+#ifdef _MSC_VER
+#define SIMD_SSE42_TARGET
+#define SIMD_AVX2_TARGET
+#define SIMD_AVX512_TARGET
+#else
+#define SIMD_SSE42_TARGET __attribute__((target("sse4.2")))
+#define SIMD_AVX2_TARGET __attribute__((target("avx2")))
+#define SIMD_AVX512_TARGET __attribute__((target("avx512f"), optimize("fp-contract=off")))
+#endif
+
+inline const char* simd_name(simd_isa isa) {
+	static const char *names[SIMD_ISAS] = { "scalar", "sse4.2", "avx2", "avx512" };
+	return names[isa];
+}
+
+// The set a name means, SIMD_ISAS for none
+inline simd_isa simd_parse(const std::string& name) {
+	for (int i = 0; i < SIMD_ISAS; i++) {
+		if (name == simd_name(simd_isa(i))) return simd_isa(i);
+	}
+	return SIMD_ISAS;
+}
+
+inline void simd_cpuid(int leaf, int sub, unsigned regs[4]) {
+#ifdef _MSC_VER
+	__cpuidex((int*)regs, leaf, sub);
+#else
+	__cpuid_count(leaf, sub, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Register state the OS saves on a switch, AVX needs the ymm bits and AVX-512 the zmm ones too
+inline unsigned long long simd_xgetbv() {
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned lo, hi;
+	__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return (unsigned long long)hi << 32 | lo;
+#endif
+}
+
+// Widest set both the CPU and the OS support, asked once
+inline simd_isa simd_supported() {
+
+	static const simd_isa best = []() {
+		unsigned r[4];
+		simd_cpuid(0, 0, r);
+		unsigned max_leaf = r[0];
+		simd_cpuid(1, 0, r);
+		if (!(r[2] & (1u << 20))) return SIMD_SCALAR;
+		bool avx = (r[2] & (1u << 27)) && (r[2] & (1u << 28));
+		if (!avx || max_leaf < 7) return SIMD_SSE42;
+		unsigned long long xcr0 = simd_xgetbv();
+		if ((xcr0 & 0x6) != 0x6) return SIMD_SSE42;
+		simd_cpuid(7, 0, r);
+		if (!(r[1] & (1u << 5))) return SIMD_SSE42;
+		if (!(r[1] & (1u << 16)) || (xcr0 & 0xe6) != 0xe6) return SIMD_AVX2;
+		return SIMD_AVX512;
+	}();
+	return best;
+}
+
+// A vec3 padded to four lanes, the fourth is whatever the constructor put there
+struct vec4f {
+
+	vec4f() {}
+	vec4f(__m128 _v) : v(_v) {}
+	explicit vec4f(float f) : v(_mm_set1_ps(f)) {}
+	explicit vec4f(const vec3& a, float w = 0) : v(_mm_set_ps(w, a[2], a[1], a[0])) {}
+
+	// four floats from p, which need not be aligned
+	static vec4f load(const float *p) { return _mm_loadu_ps(p); }
+	vec3 xyz() const {
+		alignas(16) float f[4];
+		_mm_store_ps(f, v);
+		return vec3(f[0], f[1], f[2]);
+	}
+	float operator[](int i) const {
+		alignas(16) float f[4];
+		_mm_store_ps(f, v);
+		return f[i];
+	}
+
+	__m128 v;
+};
+
+inline vec4f operator+(const vec4f& a, const vec4f& b) { return _mm_add_ps(a.v, b.v); }
+inline vec4f operator-(const vec4f& a, const vec4f& b) { return _mm_sub_ps(a.v, b.v); }
+inline vec4f operator*(const vec4f& a, const vec4f& b) { return _mm_mul_ps(a.v, b.v); }
+inline vec4f operator/(const vec4f& a, const vec4f& b) { return _mm_div_ps(a.v, b.v); }
+
+// a > b ? a : b per lane like the scalar ffmax, so a NaN in a keeps b
+inline vec4f vmax(const vec4f& a, const vec4f& b) { return _mm_max_ps(a.v, b.v); }
+inline vec4f vmin(const vec4f& a, const vec4f& b) { return _mm_min_ps(a.v, b.v); }
+// a where mask is set, else b
+inline vec4f vselect(__m128 mask, const vec4f& a, const vec4f& b) { return _mm_or_ps(_mm_and_ps(mask, a.v), _mm_andnot_ps(mask, b.v)); }
+
+inline float hmax(const vec4f& a) {
+	__m128 m = _mm_max_ps(a.v, _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(1, 0, 3, 2)));
+	return _mm_cvtss_f32(_mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1))));
+}
+inline float hmin(const vec4f& a) {
+	__m128 m = _mm_min_ps(a.v, _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(1, 0, 3, 2)));
+	return _mm_cvtss_f32(_mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1))));
+}
+
+inline float dot3(const vec4f& a, const vec4f& b) {
+	alignas(16) float f[4];
+	_mm_store_ps(f, _mm_mul_ps(a.v, b.v));
+	return f[0] + f[1] + f[2];
+}
+inline vec4f cross3(const vec4f& a, const vec4f& b) {
+	__m128 a_yzx = _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 b_yzx = _mm_shuffle_ps(b.v, b.v, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 c = _mm_sub_ps(_mm_mul_ps(a.v, b_yzx), _mm_mul_ps(a_yzx, b.v));
+	return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+// Four vec3s as three registers of x, y and z. The arithmetic is done in the order vec3.h does
+// it, so every lane gives the scalar result bit for bit.
+struct vec3x4 {
+
+	vec3x4() {}
+	vec3x4(__m128 _x, __m128 _y, __m128 _z) : x(_x), y(_y), z(_z) {}
+	explicit vec3x4(const vec3& a) : x(_mm_set1_ps(a[0])), y(_mm_set1_ps(a[1])), z(_mm_set1_ps(a[2])) {}
+
+	__m128 x, y, z;
+};
+
+inline vec3x4 operator+(const vec3x4& a, const vec3x4& b) { return vec3x4(_mm_add_ps(a.x, b.x), _mm_add_ps(a.y, b.y), _mm_add_ps(a.z, b.z)); }
+inline vec3x4 operator-(const vec3x4& a, const vec3x4& b) { return vec3x4(_mm_sub_ps(a.x, b.x), _mm_sub_ps(a.y, b.y), _mm_sub_ps(a.z, b.z)); }
+inline vec3x4 operator*(__m128 t, const vec3x4& a) { return vec3x4(_mm_mul_ps(t, a.x), _mm_mul_ps(t, a.y), _mm_mul_ps(t, a.z)); }
+
+inline __m128 dot(const vec3x4& a, const vec3x4& b) {
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.x, b.x), _mm_mul_ps(a.y, b.y)), _mm_mul_ps(a.z, b.z));
+}
+inline vec3x4 cross(const vec3x4& a, const vec3x4& b) {
+	return vec3x4(_mm_sub_ps(_mm_mul_ps(a.y, b.z), _mm_mul_ps(a.z, b.y)),
+		_mm_xor_ps(_mm_set1_ps(-0.0f), _mm_sub_ps(_mm_mul_ps(a.x, b.z), _mm_mul_ps(a.z, b.x))),
+		_mm_sub_ps(_mm_mul_ps(a.x, b.y), _mm_mul_ps(a.y, b.x)));
+}
+
+// Eight vec3s for the AVX2 kernels, only usable from SIMD_AVX2_TARGET or wider functions
+struct vec3x8 {
+
+	vec3x8() {}
+	SIMD_AVX2_TARGET vec3x8(__m256 _x, __m256 _y, __m256 _z) : x(_x), y(_y), z(_z) {}
+	SIMD_AVX2_TARGET explicit vec3x8(const vec3& a) : x(_mm256_set1_ps(a[0])), y(_mm256_set1_ps(a[1])), z(_mm256_set1_ps(a[2])) {}
+
+	__m256 x, y, z;
+};
+
+SIMD_AVX2_TARGET inline vec3x8 operator+(const vec3x8& a, const vec3x8& b) {
+	return vec3x8(_mm256_add_ps(a.x, b.x), _mm256_add_ps(a.y, b.y), _mm256_add_ps(a.z, b.z));
+}
+SIMD_AVX2_TARGET inline vec3x8 operator-(const vec3x8& a, const vec3x8& b) {
+	return vec3x8(_mm256_sub_ps(a.x, b.x), _mm256_sub_ps(a.y, b.y), _mm256_sub_ps(a.z, b.z));
+}
+SIMD_AVX2_TARGET inline vec3x8 operator*(__m256 t, const vec3x8& a) {
+	return vec3x8(_mm256_mul_ps(t, a.x), _mm256_mul_ps(t, a.y), _mm256_mul_ps(t, a.z));
+}
+
+SIMD_AVX2_TARGET inline __m256 dot(const vec3x8& a, const vec3x8& b) {
+	return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a.x, b.x), _mm256_mul_ps(a.y, b.y)), _mm256_mul_ps(a.z, b.z));
+}
+SIMD_AVX2_TARGET inline vec3x8 cross(const vec3x8& a, const vec3x8& b) {
+	return vec3x8(_mm256_sub_ps(_mm256_mul_ps(a.y, b.z), _mm256_mul_ps(a.z, b.y)),
+		_mm256_xor_ps(_mm256_set1_ps(-0.0f), _mm256_sub_ps(_mm256_mul_ps(a.x, b.z), _mm256_mul_ps(a.z, b.x))),
+		_mm256_sub_ps(_mm256_mul_ps(a.x, b.y), _mm256_mul_ps(a.y, b.x)));
+}
+
+#endif
@@ -0,0 +1,207 @@
+#pragma once
+#ifndef SIMD_KERNELSH
+#define SIMD_KERNELSH
+
+#include "simd.h"
+#include "triangle.h"
+#include "stats.h"
+#include <algorithm>
+
+// Batch kernels built once per instruction set, simd() is the table picked at startup. Each
+// returns what the scalar code would, so the set in use never changes an image.
+
+// Moeller-Trumbore against count triangles stored as three vertices each. Returns the index of
+// the nearest hit inside (t_min, t_max) and lowers t_max to it, -1 when none is hit. Equal
+// distances go to the lower index like the scalar loop.
+typedef int (*nearest_triangle_fn)(const vec3 *v, int count, const ray& r, float t_min, float& t_max);
+
+int nearest_triangle_scalar(const vec3 *v, int count, const ray& r, float t_min, float& t_max) {
+
+	int hit = -1;
+	for (int i = 0; i < count; i++) {
+		float t, u, w;
+		if (triangle::intersect(v[3 * i], v[3 * i + 1], v[3 * i + 2], r, t_min, t_max, t, u, w)) {
+			t_max = t;
+			hit = i;
+		}
+	}
+	return hit;
+}
+
+// The lanes in mask in order, each taking t_max when nearer
+inline int nearest_lane(int mask, const float *t, int first, int hit, float& t_max) {
+	for (; mask; mask &= mask - 1) {
+		int i = 0;
+		while (!(mask & (1 << i))) i++;
+		if (t[i] < t_max) {
+			t_max = t[i];
+			hit = first + i;
+		}
+	}
+	return hit;
+}
+
+SIMD_SSE42_TARGET int nearest_triangle_sse42(const vec3 *v, int count, const ray& r, float t_min, float& t_max) {
+
+	STAT_N(STAT_TRIANGLE_TESTS, count);
+	vec3x4 o(r.origin()), d(r.direction());
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), eps = _mm_set1_ps(float(EPS)), neg_eps = _mm_set1_ps(-float(EPS));
+	const float *f = v[0].e;
+	int hit = -1;
+	for (int first = 0; first < count; first += 4) {
+
+		// lanes past the end repeat the first triangle and are masked off
+		int n = std::min(4, count - first);
+		alignas(16) float c[9][4];
+		for (int i = 0; i < 4; i++) {
+			for (int k = 0; k < 9; k++) c[k][i] = f[9 * size_t(first + (i < n ? i : 0)) + k];
+		}
+		vec3x4 v0(_mm_load_ps(c[0]), _mm_load_ps(c[1]), _mm_load_ps(c[2]));
+		vec3x4 e1 = vec3x4(_mm_load_ps(c[3]), _mm_load_ps(c[4]), _mm_load_ps(c[5])) - v0;
+		vec3x4 e2 = vec3x4(_mm_load_ps(c[6]), _mm_load_ps(c[7]), _mm_load_ps(c[8])) - v0;
+		vec3x4 h = cross(d, e2);
+		__m128 a = dot(e1, h);
+		__m128 miss = _mm_and_ps(_mm_cmpgt_ps(a, neg_eps), _mm_cmplt_ps(a, eps));
+		__m128 inv = _mm_div_ps(one, a);
+		vec3x4 s = o - v0;
+		__m128 bu = _mm_mul_ps(inv, dot(s, h));
+		miss = _mm_or_ps(miss, _mm_or_ps(_mm_cmplt_ps(bu, zero), _mm_cmpgt_ps(bu, one)));
+		vec3x4 q = cross(s, e1);
+		__m128 bv = _mm_mul_ps(inv, dot(d, q));
+		miss = _mm_or_ps(miss, _mm_or_ps(_mm_cmplt_ps(bv, zero), _mm_cmpgt_ps(_mm_add_ps(bu, bv), one)));
+		__m128 bt = _mm_mul_ps(inv, dot(e2, q));
+		__m128 inside = _mm_and_ps(_mm_cmplt_ps(bt, _mm_set1_ps(t_max)), _mm_cmpgt_ps(bt, _mm_set1_ps(t_min)));
+		int mask = _mm_movemask_ps(inside) & ~_mm_movemask_ps(miss) & ((1 << n) - 1);
+		if (mask) {
+			alignas(16) float t[4];
+			_mm_store_ps(t, bt);
+			hit = nearest_lane(mask, t, first, hit, t_max);
+		}
+	}
+	return hit;
+}
+
+SIMD_AVX2_TARGET int nearest_triangle_avx2(const vec3 *v, int count, const ray& r, float t_min, float& t_max) {
+
+	STAT_N(STAT_TRIANGLE_TESTS, count);
+	vec3x8 o(r.origin()), d(r.direction());
+	const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f), eps = _mm256_set1_ps(float(EPS)), neg_eps = _mm256_set1_ps(-float(EPS));
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const float *f = v[0].e;
+	int hit = -1;
+	for (int first = 0; first < count; first += 8) {
+
+		int n = std::min(8, count - first);
+		__m256i index = _mm256_mullo_epi32(_mm256_min_epi32(lanes, _mm256_set1_epi32(n - 1)), _mm256_set1_epi32(9));
+		const float *p = f + 9 * size_t(first);
+		vec3x8 v0(_mm256_i32gather_ps(p, index, 4), _mm256_i32gather_ps(p + 1, index, 4), _mm256_i32gather_ps(p + 2, index, 4));
+		vec3x8 e1 = vec3x8(_mm256_i32gather_ps(p + 3, index, 4), _mm256_i32gather_ps(p + 4, index, 4), _mm256_i32gather_ps(p + 5, index, 4)) - v0;
+		vec3x8 e2 = vec3x8(_mm256_i32gather_ps(p + 6, index, 4), _mm256_i32gather_ps(p + 7, index, 4), _mm256_i32gather_ps(p + 8, index, 4)) - v0;
+		vec3x8 h = cross(d, e2);
+		__m256 a = dot(e1, h);
+		__m256 miss = _mm256_and_ps(_mm256_cmp_ps(a, neg_eps, _CMP_GT_OQ), _mm256_cmp_ps(a, eps, _CMP_LT_OQ));
+		__m256 inv = _mm256_div_ps(one, a);
+		vec3x8 s = o - v0;
+		__m256 bu = _mm256_mul_ps(inv, dot(s, h));
+		miss = _mm256_or_ps(miss, _mm256_or_ps(_mm256_cmp_ps(bu, zero, _CMP_LT_OQ), _mm256_cmp_ps(bu, one, _CMP_GT_OQ)));
+		vec3x8 q = cross(s, e1);
+		__m256 bv = _mm256_mul_ps(inv, dot(d, q));
+		miss = _mm256_or_ps(miss, _mm256_or_ps(_mm256_cmp_ps(bv, zero, _CMP_LT_OQ), _mm256_cmp_ps(_mm256_add_ps(bu, bv), one, _CMP_GT_OQ)));
+		__m256 bt = _mm256_mul_ps(inv, dot(e2, q));
+		__m256 inside = _mm256_and_ps(_mm256_cmp_ps(bt, _mm256_set1_ps(t_max), _CMP_LT_OQ), _mm256_cmp_ps(bt, _mm256_set1_ps(t_min), _CMP_GT_OQ));
+		int mask = _mm256_movemask_ps(inside) & ~_mm256_movemask_ps(miss) & ((1 << n) - 1);
+		if (mask) {
+			alignas(32) float t[8];
+			_mm256_store_ps(t, bt);
+			hit = nearest_lane(mask, t, first, hit, t_max);
+		}
+	}
+	return hit;
+}
+
+// The AVX-512 kernel works on the registers directly, compares give bit masks
+SIMD_AVX512_TARGET inline __m512 negate512(__m512 x) {
+	return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(x), _mm512_set1_epi32(int(0x80000000u))));
+}
+
+SIMD_AVX512_TARGET int nearest_triangle_avx512(const vec3 *v, int count, const ray& r, float t_min, float& t_max) {
+
+	STAT_N(STAT_TRIANGLE_TESTS, count);
+	const __m512 ox = _mm512_set1_ps(r.origin()[0]), oy = _mm512_set1_ps(r.origin()[1]), oz = _mm512_set1_ps(r.origin()[2]);
+	const __m512 dx = _mm512_set1_ps(r.direction()[0]), dy = _mm512_set1_ps(r.direction()[1]), dz = _mm512_set1_ps(r.direction()[2]);
+	const __m512 zero = _mm512_setzero_ps(), one = _mm512_set1_ps(1.0f), eps = _mm512_set1_ps(float(EPS)), neg_eps = _mm512_set1_ps(-float(EPS));
+	const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	const float *f = v[0].e;
+	int hit = -1;
+	for (int first = 0; first < count; first += 16) {
+
+		int n = std::min(16, count - first);
+		__m512i index = _mm512_mullo_epi32(_mm512_min_epi32(lanes, _mm512_set1_epi32(n - 1)), _mm512_set1_epi32(9));
+		const float *p = f + 9 * size_t(first);
+		__m512 v0x = _mm512_i32gather_ps(index, p, 4), v0y = _mm512_i32gather_ps(index, p + 1, 4), v0z = _mm512_i32gather_ps(index, p + 2, 4);
+		__m512 e1x = _mm512_sub_ps(_mm512_i32gather_ps(index, p + 3, 4), v0x);
+		__m512 e1y = _mm512_sub_ps(_mm512_i32gather_ps(index, p + 4, 4), v0y);
+		__m512 e1z = _mm512_sub_ps(_mm512_i32gather_ps(index, p + 5, 4), v0z);
+		__m512 e2x = _mm512_sub_ps(_mm512_i32gather_ps(index, p + 6, 4), v0x);
+		__m512 e2y = _mm512_sub_ps(_mm512_i32gather_ps(index, p + 7, 4), v0y);
+		__m512 e2z = _mm512_sub_ps(_mm512_i32gather_ps(index, p + 8, 4), v0z);
+
+		__m512 hx = _mm512_sub_ps(_mm512_mul_ps(dy, e2z), _mm512_mul_ps(dz, e2y));
+		__m512 hy = negate512(_mm512_sub_ps(_mm512_mul_ps(dx, e2z), _mm512_mul_ps(dz, e2x)));
+		__m512 hz = _mm512_sub_ps(_mm512_mul_ps(dx, e2y), _mm512_mul_ps(dy, e2x));
+		__m512 a = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(e1x, hx), _mm512_mul_ps(e1y, hy)), _mm512_mul_ps(e1z, hz));
+		__mmask16 miss = _mm512_cmp_ps_mask(a, neg_eps, _CMP_GT_OQ) & _mm512_cmp_ps_mask(a, eps, _CMP_LT_OQ);
+		__m512 inv = _mm512_div_ps(one, a);
+
+		__m512 sx = _mm512_sub_ps(ox, v0x), sy = _mm512_sub_ps(oy, v0y), sz = _mm512_sub_ps(oz, v0z);
+		__m512 bu = _mm512_mul_ps(inv, _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(sx, hx), _mm512_mul_ps(sy, hy)), _mm512_mul_ps(sz, hz)));
+		miss |= _mm512_cmp_ps_mask(bu, zero, _CMP_LT_OQ) | _mm512_cmp_ps_mask(bu, one, _CMP_GT_OQ);
+		__m512 qx = _mm512_sub_ps(_mm512_mul_ps(sy, e1z), _mm512_mul_ps(sz, e1y));
+		__m512 qy = negate512(_mm512_sub_ps(_mm512_mul_ps(sx, e1z), _mm512_mul_ps(sz, e1x)));
+		__m512 qz = _mm512_sub_ps(_mm512_mul_ps(sx, e1y), _mm512_mul_ps(sy, e1x));
+		__m512 bv = _mm512_mul_ps(inv, _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, qx), _mm512_mul_ps(dy, qy)), _mm512_mul_ps(dz, qz)));
+		miss |= _mm512_cmp_ps_mask(bv, zero, _CMP_LT_OQ) | _mm512_cmp_ps_mask(_mm512_add_ps(bu, bv), one, _CMP_GT_OQ);
+		__m512 bt = _mm512_mul_ps(inv, _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(e2x, qx), _mm512_mul_ps(e2y, qy)), _mm512_mul_ps(e2z, qz)));
+		__mmask16 inside = _mm512_cmp_ps_mask(bt, _mm512_set1_ps(t_max), _CMP_LT_OQ) & _mm512_cmp_ps_mask(bt, _mm512_set1_ps(t_min), _CMP_GT_OQ);
+		int mask = int(inside & ~miss) & ((1 << n) - 1);
+		if (mask) {
+			alignas(64) float t[16];
+			_mm512_store_ps(t, bt);
+			hit = nearest_lane(mask, t, first, hit, t_max);
+		}
+	}
+	return hit;
+}
+
+struct simd_kernels {
+	simd_isa isa;
+	int width;		// lanes per step
+	nearest_triangle_fn nearest_triangle;
+};
+
+inline const simd_kernels& simd_kernels_for(simd_isa isa) {
+	static const simd_kernels table[SIMD_ISAS] = {
+		{ SIMD_SCALAR, 1, nearest_triangle_scalar },
+		{ SIMD_SSE42, 4, nearest_triangle_sse42 },
+		{ SIMD_AVX2, 8, nearest_triangle_avx2 },
+		{ SIMD_AVX512, 16, nearest_triangle_avx512 },
+	};
+	return table[isa];
+}
+
+inline const simd_kernels*& simd_active() {
+	static const simd_kernels *active = &simd_kernels_for(simd_supported());
+	return active;
+}
+
+// The kernels in use, the widest the CPU runs unless simd_select chose others
+inline const simd_kernels& simd() { return *simd_active(); }
+
+// Uses isa's kernels from now on, false when the CPU lacks it. Call before rendering starts.
+inline bool simd_select(simd_isa isa) {
+	if (isa >= SIMD_ISAS || isa > simd_supported()) return false;
+	simd_active() = &simd_kernels_for(isa);
+	return true;
+}
+
+#endif
@@ -1,23 +1,72 @@
 #ifndef SPHEREH
 #define SPHEREH
 #include "hitable.h"
+#include "maths.h"
 
 #define M_PI           3.14159265358979323846 
 
 void get_sphere_uv(const vec3& p, float& u, float& v) {
 
-	float phi = atan2(p.z(), p.x());
-	float theta = asin(p.y());
+	float phi = math_atan2(p.z(), p.x());
+	float theta = math_asin(p.y());
 	u = 1 - (phi + M_PI) / (2 * M_PI);
 	v = (theta + M_PI / 2) / M_PI;
 }
 
+// Nearest root of the ray/sphere quadratic inside (t_min, t_max), t is only written on a hit
+inline bool hit_sphere(const vec3& center, float radius, const ray& r, float t_min, float t_max, float& t) {
+
+	vec3 oc = r.origin() - center;
+	float a = dot(r.direction(), r.direction());
+	float b = dot(oc, r.direction());
+	float c = dot(oc, oc) - radius * radius;
+	float discriminant = b * b - a * c;
+	if (discriminant > 0) {
+
+		float root = sqrt(discriminant);
+		float temp = (-b - root) / a;
+		if (temp < t_max && temp > t_min) {
+			t = temp;
+			return true;
+		}
+		temp = (-b + root) / a;
+		if (temp < t_max && temp > t_min) {
+			t = temp;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Both roots of the ray/sphere quadratic
+inline bool sphere_interval(const vec3& center, float radius, const ray& r, float& t0, float& t1) {
+
+	vec3 oc = r.origin() - center;
+	float a = dot(r.direction(), r.direction());
+	float b = dot(oc, r.direction());
+	float c = dot(oc, oc) - radius * radius;
+	float discriminant = b * b - a * c;
+	if (discriminant > 0) {
+
+		float root = sqrt(discriminant);
+		t0 = (-b - root) / a;
+		t1 = (-b + root) / a;
+		return true;
+	}
+	return false;
+}
+
 class sphere : public hitable {
 
 public:
 	sphere () {}
 	sphere(vec3 cen, float r, material *m) : center(cen), radius(r), mat_ptr(m) {};
 	virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float tmin, float tmax) const;
+	virtual bool hit_interval(const ray& r, float& t0, float& t1) const {
+		return sphere_interval(center, radius, r, t0, t1);
+	}
+	virtual void compute_surface_interaction(const ray& r, hit_record& rec) const;
 	virtual bool bounding_box(float t0, float t1, aabb& b)  const;
 	vec3 center;
 	float radius;
@@ -26,37 +75,29 @@ public:
 
 bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
 
-	vec3 oc = r.origin() - center;
-	float a = dot(r.direction(), r.direction());
-	float b = dot(oc, r.direction());
-	float c = dot(oc, oc) - radius * radius;
-	float discriminant = b * b - a * c;
-	if (discriminant > 0) {
-		
-		float temp = (-b - sqrt(discriminant)) / a;
-		if (temp < t_max && temp > t_min) {
-			
-			rec.t = temp;
-			rec.p = r.point_at_parameter(rec.t);
-			get_sphere_uv((rec.p - center) / radius, rec.u, rec.v);
-			rec.normal = (rec.p - center) / radius;
-			rec.mat_ptr = mat_ptr;
-			return true;
-		}
-		temp = (-b + sqrt(discriminant)) / a;
-		if (temp < t_max && temp > t_min) {
-
-			rec.t = temp;
-			rec.p = r.point_at_parameter(rec.t);
-			get_sphere_uv((rec.p - center) / radius, rec.u, rec.v);
-			rec.normal = (rec.p - center) / radius;
-			rec.mat_ptr = mat_ptr;
-			return true;
-		}
+	STAT(STAT_SPHERE_TESTS);
+	if (hit_sphere(center, radius, r, t_min, t_max, rec.t)) {
+		rec.obj = this;
+		return true;
 	}
 	return false;
 }
 
+bool sphere::occluded(const ray& r, float t_min, float t_max) const {
+
+	STAT(STAT_SPHERE_TESTS);
+	float t;
+	return hit_sphere(center, radius, r, t_min, t_max, t);
+}
+
+void sphere::compute_surface_interaction(const ray& r, hit_record& rec) const {
+
+	rec.p = r.point_at_parameter(rec.t);
+	rec.normal = (rec.p - center) / radius;
+	get_sphere_uv(rec.normal, rec.u, rec.v);
+	rec.mat_ptr = mat_ptr;
+}
+
 bool sphere::bounding_box(float t0, float t1, aabb& b) const {
 
 	b = aabb(
@@ -71,6 +112,11 @@ public:
 	moving_sphere() {}
 	moving_sphere(vec3 _center0, vec3 _center1, float _time0, float _time1, float _radius, material *mat) : center0(_center0), center1(_center1), time0(_time0), time1(_time1), radius(_radius), mat_ptr(mat) {}
 	virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float tmin, float tmax) const;
+	virtual bool hit_interval(const ray& r, float& t0, float& t1) const {
+		return sphere_interval(center(r.time()), radius, r, t0, t1);
+	}
+	virtual void compute_surface_interaction(const ray& r, hit_record& rec) const;
 	virtual bool bounding_box(float t0, float t1, aabb& b)  const;
 	vec3 center(float time) const;
 	vec3 center0, center1;
@@ -85,35 +131,28 @@ vec3 moving_sphere::center(float time) const {
 
 bool moving_sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
 
-	vec3 oc = r.origin() - center(r.time());
-	float a = dot(r.direction(), r.direction());
-	float b = dot(oc, r.direction());
-	float c = dot(oc, oc) - radius * radius;
-	float discriminant = b * b - a * c;
-	if (discriminant > 0) {
-		
-		float temp = (-b - sqrt(discriminant)) / a;
-		if (temp < t_max && temp > t_min) {
-			
-			rec.t = temp;
-			rec.p = r.point_at_parameter(rec.t);
-			rec.normal = (rec.p - center(r.time())) / radius;
-			rec.mat_ptr = mat_ptr;
-			return true;
-		}
-		temp = (-b + sqrt(discriminant)) / a;
-		if (temp < t_max && temp > t_min) {
-
-			rec.t = temp;
-			rec.p = r.point_at_parameter(rec.t);
-			rec.normal = (rec.p - center(r.time())) / radius;
-			rec.mat_ptr = mat_ptr;
-			return true;
-		}
+	STAT(STAT_MOVING_SPHERE_TESTS);
+	if (hit_sphere(center(r.time()), radius, r, t_min, t_max, rec.t)) {
+		rec.obj = this;
+		return true;
 	}
 	return false;
 }
 
+bool moving_sphere::occluded(const ray& r, float t_min, float t_max) const {
+
+	STAT(STAT_MOVING_SPHERE_TESTS);
+	float t;
+	return hit_sphere(center(r.time()), radius, r, t_min, t_max, t);
+}
+
+void moving_sphere::compute_surface_interaction(const ray& r, hit_record& rec) const {
+
+	rec.p = r.point_at_parameter(rec.t);
+	rec.normal = (rec.p - center(r.time())) / radius;
+	rec.mat_ptr = mat_ptr;
+}
+
 bool moving_sphere::bounding_box(float t0, float t1, aabb& b) const {
 
 	aabb box0 = aabb(center(t0) - vec3(radius, radius, radius), center(t0) + vec3(radius, radius, radius));
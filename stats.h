@@ -0,0 +1,119 @@
+#pragma once
+#ifndef STATSH
+#define STATSH
+
+// Per thread traversal counters, compiled out unless RAYTRACER_STATS is defined here
+// or in the project's preprocessor definitions
+//#define RAYTRACER_STATS
+
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+
+enum stat_id {
+
+	STAT_BVH_NODES,
+
+	// traversal cost, the heatmap shows the sum of these per sample
+	STAT_BOX_TESTS,
+	STAT_SPHERE_TESTS,
+	STAT_MOVING_SPHERE_TESTS,
+	STAT_TRIANGLE_TESTS,
+	STAT_RECT_TESTS,
+	STAT_SLAB_BOX_TESTS,
+	STAT_BOX4_TESTS,
+	STAT_HEIGHTFIELD_TESTS,
+	STAT_HEIGHTFIELD_CELLS,
+	STAT_MEDIUM_TESTS,
+
+	STAT_SCATTER_LAMBERTIAN,
+	STAT_SCATTER_METAL,
+	STAT_SCATTER_DIALECTRIC,
+	STAT_SCATTER_DIFFUSE_LIGHT,
+	STAT_SCATTER_ISOTROPIC,
+	STAT_VOLUME_HITS,
+
+	STAT_COUNT,
+	STAT_COST_BEGIN = STAT_BOX_TESTS,
+	STAT_COST_END = STAT_SCATTER_LAMBERTIAN
+};
+
+static const char *stat_names[STAT_COUNT] = {
+	"bvh nodes visited",
+	"bvh box tests",
+	"sphere tests",
+	"moving_sphere tests",
+	"triangle tests",
+	"rect tests",
+	"box tests",
+	"box4 tests",
+	"heightfield tests",
+	"heightfield cells",
+	"medium tests",
+	"lambertian scatters",
+	"metal scatters",
+	"dialectric scatters",
+	"diffuse_light scatters",
+	"isotropic scatters",
+	"volume hits",
+};
+
+const int STATS_MAX_DEPTH = 64;
+
+struct render_counters {
+
+	long long count[STAT_COUNT];
+	long long rays_at_depth[STATS_MAX_DEPTH];
+
+	render_counters() { clear(); }
+
+	void clear() {
+		memset(this, 0, sizeof(render_counters));
+	}
+
+	void merge(const render_counters& o) {
+		for (int i = 0; i < STAT_COUNT; i++) count[i] += o.count[i];
+		for (int i = 0; i < STATS_MAX_DEPTH; i++) rays_at_depth[i] += o.rays_at_depth[i];
+	}
+
+	long long cost() const {
+		long long c = 0;
+		for (int i = STAT_COST_BEGIN; i < STAT_COST_END; i++) c += count[i];
+		return c;
+	}
+
+	// Totals and per path averages for everything that was counted
+	void report(std::ostream& out, long long paths) const {
+
+		std::ios::fmtflags flags = out.flags();
+		std::streamsize precision = out.precision();
+		out << "Render counters (" << paths << " paths)" << std::endl;
+		out << std::fixed << std::setprecision(3);
+		for (int i = 0; i < STAT_COUNT; i++) {
+			if (count[i] == 0) continue;
+			out << "  " << std::left << std::setw(24) << stat_names[i] << std::right << std::setw(16) << count[i]
+				<< std::setw(12) << double(count[i]) / paths << " per path" << std::endl;
+		}
+		out << "  rays per depth" << std::endl;
+		for (int d = 0; d < STATS_MAX_DEPTH; d++) {
+			if (rays_at_depth[d] == 0) continue;
+			out << "    " << std::setw(2) << d << (d == STATS_MAX_DEPTH - 1 ? "+" : " ") << std::setw(16) << rays_at_depth[d]
+				<< std::setw(12) << double(rays_at_depth[d]) / paths << " per path" << std::endl;
+		}
+		out.flags(flags);
+		out.precision(precision);
+	}
+};
+
+#ifdef RAYTRACER_STATS
+thread_local static render_counters s_Counters;
+#define STAT(id) (s_Counters.count[id]++)
+#define STAT_N(id, n) (s_Counters.count[id] += (n))
+#define STAT_DEPTH(d) (s_Counters.rays_at_depth[(d) < STATS_MAX_DEPTH ? (d) : STATS_MAX_DEPTH - 1]++)
+#else
+#define STAT(id) ((void)0)
+#define STAT_N(id, n) ((void)0)
+#define STAT_DEPTH(d) ((void)0)
+#endif
+
+#endif
@@ -3,9 +3,14 @@
 #define TEXTUREH
 #include "vec3.h"
 #include "perlin.h"
+#include "arena.h"
+#include "maths.h"
 
 class texture {
 public:
+	virtual ~texture() {}
+	static void* operator new(size_t size) { return arena::allocate(size, arena::TEXTURE); }
+	static void operator delete(void *p) { arena::deallocate(p); }
 	virtual vec3 value(float u, float v, const vec3& p) const = 0;
 };
 
@@ -27,7 +32,7 @@ public:
 
 	virtual vec3 value(float u, float v, const vec3& p) const {
 
-		float sines = sin(10 * p.x()) * sin(10 * p.y()) * sin(10 * p.z());
+		float sines = math_sin(10 * p.x()) * math_sin(10 * p.y()) * math_sin(10 * p.z());
 		return sines < 0 ? odd->value(u, v, p) : even->value(u, v, p);
 	}
 
@@ -42,7 +47,7 @@ public:
 	virtual vec3 value(float u, float v, const vec3& p) const {
 		//return vec3(1,1,1) * noise.noise(scale * p);
 		//return vec3(1, 1, 1)*0.5*(1 + noise.noise(scale * p));
-		return vec3(1, 1, 1) * 0.5 * (1 + sin(scale * p.x() + 10 * noise.turb(p)));
+		return vec3(1, 1, 1) * 0.5 * (1 + math_sin(scale * p.x() + 10 * noise.turb(p)));
 	}
 	perlin noise;
 	float scale;
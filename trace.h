@@ -0,0 +1,177 @@
+#pragma once
+#ifndef TRACEH
+#define TRACEH
+
+// Timeline of named spans per thread, written as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+// Compiled out unless RAYTRACER_TRACE is defined here or in the project. When compiled in, spans
+// are only recorded between trace::start() and trace::write(), until then a scope costs one branch.
+//#define RAYTRACER_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct trace_event {
+
+	const char *name;
+	const char *arg_name;	// optional integer argument, nullptr when there is none
+	int arg;
+	double start;			// microseconds since trace::start()
+	double duration;
+};
+
+// Events of one thread, only that thread appends to it so recording takes no lock
+struct trace_buffer {
+
+	int tid;
+	std::string thread_name;
+	std::vector<trace_event> events;
+};
+
+class trace {
+public:
+
+	// The calling thread becomes thread 0, "main"
+	static void start() {
+		local();
+		epoch() = std::chrono::steady_clock::now();
+		enabled() = true;
+	}
+
+	static bool is_enabled() {
+		return enabled().load(std::memory_order_relaxed);
+	}
+
+	static double now() {
+		return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch()).count();
+	}
+
+	// The calling thread's buffer, registered on first use. Buffers outlive their threads.
+	static trace_buffer* local() {
+
+		thread_local trace_buffer *buffer = nullptr;
+		if (!buffer) {
+			std::lock_guard<std::mutex> lock(mutex());
+			buffer = new trace_buffer();
+			buffer->tid = int(buffers().size());
+			buffer->thread_name = buffer->tid == 0 ? "main" : "thread " + std::to_string(buffer->tid);
+			buffers().push_back(buffer);
+		}
+		return buffer;
+	}
+
+	static void span(trace_buffer *b, const char *name, double start, double end, const char *arg_name = nullptr, int arg = 0) {
+		trace_event e;
+		e.name = name;
+		e.arg_name = arg_name;
+		e.arg = arg;
+		e.start = start;
+		e.duration = end - start;
+		b->events.push_back(e);
+	}
+
+	// Stops recording and writes every thread's spans, call once the worker threads are joined
+	static bool write(const std::string& path) {
+
+		enabled() = false;
+		std::ofstream out(path);
+		if (!out) {
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(mutex());
+		out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+		bool first = true;
+		for (trace_buffer *b : buffers()) {
+
+			out << (first ? "" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << b->tid
+				<< ",\"args\":{\"name\":\"" << b->thread_name << "\"}}";
+			first = false;
+			for (const trace_event& e : b->events) {
+
+				out << ",\n{\"ph\":\"X\",\"name\":\"" << e.name << "\",\"pid\":1,\"tid\":" << b->tid
+					<< ",\"ts\":" << std::fixed << e.start << ",\"dur\":" << e.duration;
+				if (e.arg_name) {
+					out << ",\"args\":{\"" << e.arg_name << "\":" << e.arg << "}";
+				}
+				out << "}";
+			}
+		}
+		out << "\n]}\n";
+		return true;
+	}
+
+	static std::atomic<bool>& enabled() {
+		static std::atomic<bool> on(false);
+		return on;
+	}
+	static std::chrono::steady_clock::time_point& epoch() {
+		static std::chrono::steady_clock::time_point t;
+		return t;
+	}
+	static std::vector<trace_buffer*>& buffers() {
+		static std::vector<trace_buffer*> all;
+		return all;
+	}
+	static std::mutex& mutex() {
+		static std::mutex m;
+		return m;
+	}
+};
+
+// Records the enclosing block as a span. outermost skips the scope when a span of the same
+// name is already open on this thread, so a recursive build shows up once.
+class trace_scope {
+public:
+	trace_scope(const char *_name, const char *_arg_name = nullptr, int _arg = 0, bool outermost = false) : name(nullptr) {
+
+		if (!trace::is_enabled()) return;
+		if (outermost) {
+			for (const char *open : active()) {
+				if (strcmp(open, _name) == 0) return;
+			}
+		}
+		name = _name;
+		arg_name = _arg_name;
+		arg = _arg;
+		active().push_back(name);
+		start = trace::now();
+	}
+
+	~trace_scope() {
+		if (!name) return;
+		active().pop_back();
+		trace::span(trace::local(), name, start, trace::now(), arg_name, arg);
+	}
+
+	static std::vector<const char*>& active() {
+		thread_local std::vector<const char*> open;
+		return open;
+	}
+
+	const char *name;
+	const char *arg_name;
+	int arg;
+	double start;
+};
+
+#ifdef RAYTRACER_TRACE
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(name) trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_SCOPE_ARG(name, arg_name, arg) trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(name, arg_name, arg)
+#define TRACE_SCOPE_OUTERMOST(name) trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(name, nullptr, 0, true)
+#define TRACE_START() trace::start()
+#define TRACE_WRITE(path) trace::write(path)
+#else
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_SCOPE_ARG(name, arg_name, arg) ((void)0)
+#define TRACE_SCOPE_OUTERMOST(name) ((void)0)
+#define TRACE_START() ((void)0)
+#define TRACE_WRITE(path) ((void)0)
+#endif
+
+#endif
@@ -11,7 +11,13 @@ public:
 	triangle() {}
 	triangle(vec3 _v0, vec3 _v1, vec3 _v2, material *m) : v0(_v0), v1(_v1), v2(_v2), mat_ptr(m) { }
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const;
+	virtual void compute_surface_interaction(const ray& r, hit_record& rec) const;
 	virtual bool bounding_box(float t0, float t1, aabb& b) const;
+	bool intersect(const ray& r, float t_min, float t_max, float& t, float& u, float& v) const {
+		return intersect(v0, v1, v2, r, t_min, t_max, t, u, v);
+	}
+	static bool intersect(const vec3& v0, const vec3& v1, const vec3& v2, const ray& r, float t_min, float t_max, float& t, float& u, float& v);
 
 	vec3 v0, v1, v2;
 	material *mat_ptr;
@@ -19,10 +25,12 @@ public:
 
 
 
-bool triangle::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+// Moeller-Trumbore, t and the barycentrics u, v are only written on a hit
+bool triangle::intersect(const vec3& v0, const vec3& v1, const vec3& v2, const ray& r, float t_min, float t_max, float& t, float& u, float& v) {
 
+	STAT(STAT_TRIANGLE_TESTS);
 	vec3 e1, e2, h, s, q;
-	float a, f, u, v;
+	float a, f, bu, bv;
 	e1 = v1 - v0;
 	e2 = v2 - v0;
 	h = cross(r.direction(), e2);
@@ -33,25 +41,23 @@ bool triangle::hit(const ray& r, float t_min, float t_max, hit_record& rec) cons
 
 	f = 1 / a;
 	s = r.origin() - v0;
-	u = f * dot(s, h);
-	if (u < 0.0 || u > 1.0) {
+	bu = f * dot(s, h);
+	if (bu < 0.0 || bu > 1.0) {
 		return false;
 	}
 
 	q = cross(s, e1);
-	v = f * dot(r.direction(), q);
-	if (v < 0.0 || u + v > 1.0) {
+	bv = f * dot(r.direction(), q);
+	if (bv < 0.0 || bu + bv > 1.0) {
 		return false;
 	}
 
-	float t = f * dot(e2, q);
-	if (t > EPS) {
+	float bt = f * dot(e2, q);
+	if (bt < t_max && bt > t_min) {
 
-		rec.t = t;
-		//rec.p = r.origin() * r.direction() * t;
-		rec.p = r.point_at_parameter(t);
-		rec.mat_ptr = mat_ptr;
-		rec.normal = cross(e1, e2);
+		t = bt;
+		u = bu;
+		v = bv;
 		return true;
 	}
 	else {
@@ -59,14 +65,37 @@ bool triangle::hit(const ray& r, float t_min, float t_max, hit_record& rec) cons
 	}
 }
 
+bool triangle::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+
+	// barycentrics double as texture coordinates
+	if (intersect(r, t_min, t_max, rec.t, rec.u, rec.v)) {
+		rec.obj = this;
+		return true;
+	}
+	return false;
+}
+
+bool triangle::occluded(const ray& r, float t_min, float t_max) const {
+
+	float t, u, v;
+	return intersect(r, t_min, t_max, t, u, v);
+}
+
+void triangle::compute_surface_interaction(const ray& r, hit_record& rec) const {
+
+	rec.p = r.point_at_parameter(rec.t);
+	rec.mat_ptr = mat_ptr;
+	rec.normal = unit_vector(cross(v1 - v0, v2 - v0));
+}
+
 bool triangle::bounding_box(float t0, float t1, aabb& b) const {
 	
 	vec3 min(ffmin(ffmin(v0.x(), v1.x()), v2.x()),
 		ffmin(ffmin(v0.y(), v1.y()), v2.y()),
 		ffmin(ffmin(v0.z(), v1.z()), v2.z()));
-	vec3 max(ffmax(ffmin(v0.x(), v1.x()), v2.x()),
-		ffmax(ffmin(v0.y(), v1.y()), v2.y()),
-		ffmax(ffmin(v0.z(), v1.z()), v2.z()));
+	vec3 max(ffmax(ffmax(v0.x(), v1.x()), v2.x()),
+		ffmax(ffmax(v0.y(), v1.y()), v2.y()),
+		ffmax(ffmax(v0.z(), v1.z()), v2.z()));
 	b = aabb(min, max);
 	if (abs(b.max().x() - b.min().x()) < 0.0001f) {
 		b.min().e[0] -= 0.0001f;